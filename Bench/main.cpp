@@ -0,0 +1,511 @@
+// Bench: micro-benchmarks for the CPU-side texture paths, run against
+// whatever OpenGL driver is installed. To compare with a software
+// rasterizer, put Mesa's llvmpipe opengl32.dll next to Bench.exe.
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "MipGenerator.h"
+#include "OffAxis.h"
+#include "Panorama.h"
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+
+namespace {
+
+	typedef std::chrono::high_resolution_clock Clock;
+
+	double millisSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// A hidden window is enough for a context; nothing is ever presented.
+	GLFWwindow* createContext()
+	{
+		if (!glfwInit()) {
+			std::cerr << "Failed to initialize GLFW" << std::endl;
+			return nullptr;
+		}
+		glfwWindowHint(GLFW_VISIBLE, 0);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		GLFWwindow* window = glfwCreateWindow(64, 64, "Bench", nullptr, nullptr);
+		if (window == nullptr) {
+			std::cerr << "Unable to create an OpenGL 4.1 core context" << std::endl;
+			glfwTerminate();
+			return nullptr;
+		}
+		glfwMakeContextCurrent(window);
+		glewExperimental = GL_TRUE;
+		if (glewInit() != GLEW_OK) {
+			std::cerr << "Failed to initialize GLEW" << std::endl;
+			glfwDestroyWindow(window);
+			glfwTerminate();
+			return nullptr;
+		}
+		glGetError();
+		std::cout << "GL_RENDERER: " << glGetString(GL_RENDERER) << std::endl
+			<< "GL_VERSION:  " << glGetString(GL_VERSION) << std::endl << std::endl;
+		return window;
+	}
+
+	// Smooth gradients with a little noise, so neither the CPU nor the
+	// driver can take a shortcut on flat data.
+	void fillFaces(CubeMipChain & chain, int size)
+	{
+		chain.size = size;
+		for (int face = 0; face < 6; face++) {
+			chain.faces[face].assign(1, std::vector<unsigned char>((size_t)size * size * 4));
+			unsigned char* texel = &chain.faces[face][0][0];
+			for (int y = 0; y < size; y++) {
+				for (int x = 0; x < size; x++) {
+					texel[0] = (unsigned char)(x * 255 / size + (rand() & 7));
+					texel[1] = (unsigned char)(y * 255 / size + (rand() & 7));
+					texel[2] = (unsigned char)(face * 40 + (rand() & 7));
+					texel[3] = 0xff;
+					texel += 4;
+				}
+			}
+		}
+	}
+
+	void uploadLevel0(const CubeMipChain & chain)
+	{
+		for (int face = 0; face < 6; face++) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, chain.size, chain.size, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, &chain.faces[face][0][0]);
+		}
+	}
+
+	void uploadChain(const CubeMipChain & chain)
+	{
+		for (size_t level = 0; level < chain.faces[0].size(); level++) {
+			int size = std::max(1, chain.size >> level);
+			for (int face = 0; face < 6; face++) {
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)level, GL_RGBA8, size, size, 0, GL_RGBA,
+					GL_UNSIGNED_BYTE, &chain.faces[face][level][0]);
+			}
+		}
+	}
+
+	// CPU cube mip chains per kernel, then the same work through the driver.
+	int benchMips(int argc, char** argv)
+	{
+		int size = argc > 0 ? atoi(argv[0]) : 1024;
+		const int runs = 5;
+		if (size < 1) {
+			std::cerr << "usage: Bench mips [face size]" << std::endl;
+			return 1;
+		}
+
+		CubeMipChain source;
+		fillFaces(source, size);
+		double texels = 6.0 * size * size * 4.0 / 3.0;
+		std::cout << "Cube mip chain, 6 x " << size << "x" << size << " RGBA8, " << mipLevelCount(size, size)
+			<< " levels, best of " << runs << std::endl;
+
+		MipKernel kernels[] = { MIP_KERNEL_SCALAR, MIP_KERNEL_SSE2, MIP_KERNEL_AVX2 };
+		CubeMipChain reference, chain;
+		double cpuMillis = 0.0;
+		for (MipKernel kernel : kernels) {
+			if (kernel > bestMipKernel()) {
+				std::cout << "  " << mipKernelName(kernel) << ": not supported by this CPU" << std::endl;
+				continue;
+			}
+			double best = 1e30;
+			for (int run = 0; run < runs; run++) {
+				chain = source;
+				auto start = Clock::now();
+				buildCubeMipChain(chain, kernel);
+				best = std::min(best, millisSince(start));
+			}
+			bool match = true;
+			if (kernel == MIP_KERNEL_SCALAR) {
+				reference = chain;
+			}
+			else {
+				for (int face = 0; face < 6; face++) {
+					match = match && chain.faces[face] == reference.faces[face];
+				}
+			}
+			cpuMillis = best;
+			std::cout << "  " << mipKernelName(kernel) << ": " << best << " ms, " << texels / (best * 1000.0)
+				<< " Mtexel/s" << (match ? "" : "  OUTPUT DIFFERS FROM SCALAR") << std::endl;
+		}
+
+		GLFWwindow* window = createContext();
+		if (window == nullptr) {
+			return 1;
+		}
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		// Both sides start from system memory and end with a complete,
+		// resident chain; glFinish keeps the driver from deferring work.
+		double driverBest = 1e30, uploadBest = 1e30;
+		for (int run = 0; run < runs; run++) {
+			auto start = Clock::now();
+			uploadLevel0(source);
+			glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+			glFinish();
+			driverBest = std::min(driverBest, millisSince(start));
+
+			start = Clock::now();
+			uploadChain(chain);
+			glFinish();
+			uploadBest = std::min(uploadBest, millisSince(start));
+		}
+		glDeleteTextures(1, &texture);
+
+		std::cout << "  level 0 upload + glGenerateMipmap: " << driverBest << " ms" << std::endl
+			<< "  " << mipKernelName(bestMipKernel()) << " chain + upload of all levels: " << cpuMillis + uploadBest
+			<< " ms (" << uploadBest << " ms upload)" << std::endl;
+
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return 0;
+	}
+
+	// RGB8 and big-endian RGB16 to RGBA8, each kernel against the scalar
+	// per-texel loop. Throughput counts bytes read plus bytes written.
+	int benchRGBA(int argc, char** argv)
+	{
+		int megatexels = argc > 0 ? atoi(argv[0]) : 16;
+		const int runs = 10;
+		if (megatexels < 1) {
+			std::cerr << "usage: Bench rgba [megatexels]" << std::endl;
+			return 1;
+		}
+		size_t texels = (size_t)megatexels * 1024 * 1024;
+		std::vector<unsigned char> src(texels * 6), dst(texels * 4), reference(texels * 4);
+		for (size_t i = 0; i < src.size(); i++) {
+			src[i] = (unsigned char)rand();
+		}
+
+		PixelKernel kernels[] = { PIXEL_KERNEL_SCALAR, PIXEL_KERNEL_SSSE3, PIXEL_KERNEL_AVX2 };
+		for (int wide = 0; wide < 2; wide++) {
+			double bytes = (double)texels * ((wide ? 6 : 3) + 4);
+			std::cout << (wide ? "RGB16" : "RGB8") << " -> RGBA8, " << megatexels << " Mtexel, best of " << runs << std::endl;
+			double scalarBest = 0.0;
+			for (PixelKernel kernel : kernels) {
+				if (kernel > bestPixelKernel()) {
+					std::cout << "  " << pixelKernelName(kernel) << ": not supported by this CPU" << std::endl;
+					continue;
+				}
+				double best = 1e30;
+				for (int run = 0; run < runs; run++) {
+					auto start = Clock::now();
+					if (wide) {
+						narrowRGB16ToRGBA8(&src[0], &dst[0], texels, kernel);
+					}
+					else {
+						expandRGB8ToRGBA8(&src[0], &dst[0], texels, kernel);
+					}
+					best = std::min(best, millisSince(start));
+				}
+				if (kernel == PIXEL_KERNEL_SCALAR) {
+					reference = dst;
+					scalarBest = best;
+				}
+				std::cout << "  " << pixelKernelName(kernel) << ": " << best << " ms, " << bytes / (best * 1e6)
+					<< " GB/s, " << scalarBest / best << "x" << (dst == reference ? "" : "  OUTPUT DIFFERS FROM SCALAR")
+					<< std::endl;
+			}
+		}
+		return 0;
+	}
+
+	// Equirectangular to cube map: both coordinate kernels and filters on
+	// one thread, then the best kernel split across the loader pool.
+	int benchPanorama(int argc, char** argv)
+	{
+		int width = argc > 0 ? atoi(argv[0]) : 4096;
+		const int runs = 3;
+		if (width < 4) {
+			std::cerr << "usage: Bench panorama [panorama width]" << std::endl;
+			return 1;
+		}
+		int height = width / 2;
+		std::vector<unsigned char> panorama((size_t)width * height * 4);
+		for (size_t i = 0; i < panorama.size(); i++) {
+			panorama[i] = (unsigned char)rand();
+		}
+
+		CubeMipChain chain;
+		chain.size = panoramaFaceSize(width);
+		for (int face = 0; face < 6; face++) {
+			chain.faces[face].assign(1, std::vector<unsigned char>((size_t)chain.size * chain.size * 4));
+		}
+		double texels = 6.0 * chain.size * chain.size;
+		std::cout << "Panorama " << width << "x" << height << " -> 6 x " << chain.size << "x" << chain.size
+			<< ", best of " << runs << std::endl;
+
+		PanoramaFilter filters[] = { PANORAMA_BILINEAR, PANORAMA_BICUBIC };
+		PanoramaKernel kernels[] = { PANORAMA_KERNEL_SCALAR, PANORAMA_KERNEL_AVX2 };
+		for (PanoramaFilter filter : filters) {
+			const char* filterName = filter == PANORAMA_BICUBIC ? "bicubic" : "bilinear";
+			for (PanoramaKernel kernel : kernels) {
+				if (kernel > bestPanoramaKernel()) {
+					std::cout << "  " << filterName << " " << panoramaKernelName(kernel) << ": not supported by this CPU" << std::endl;
+					continue;
+				}
+				double best = 1e30;
+				for (int run = 0; run < runs; run++) {
+					auto start = Clock::now();
+					for (int face = 0; face < 6; face++) {
+						resamplePanorama(&panorama[0], width, height, chain, face, 0, chain.size, filter, kernel);
+					}
+					best = std::min(best, millisSince(start));
+				}
+				std::cout << "  " << filterName << " " << panoramaKernelName(kernel) << ", 1 thread: " << best << " ms, "
+					<< texels / (best * 1000.0) << " Mtexel/s" << std::endl;
+			}
+
+			double best = 1e30;
+			for (int run = 0; run < runs; run++) {
+				auto start = Clock::now();
+				panoramaToCube(&panorama[0], width, height, chain, filter, ThreadPool::shared());
+				best = std::min(best, millisSince(start));
+			}
+			std::cout << "  " << filterName << " " << panoramaKernelName(bestPanoramaKernel()) << ", "
+				<< ThreadPool::shared().size() << " threads: " << best << " ms, " << texels / (best * 1000.0)
+				<< " Mtexel/s" << std::endl;
+		}
+		return 0;
+	}
+
+	// A screen and eye with the frustum worked out by hand, and the way the
+	// pose faces, the screen's right, up and normal.
+	struct OffAxisCase
+	{
+		const char* name;
+		glm::vec3 lowerLeft, lowerRight, upperLeft, eye;
+		glm::mat4 projection, facing;
+	};
+
+	// Relative to the entry where it is above 1, as the far terms are.
+	float largestDifference(const glm::mat4 & actual, const glm::mat4 & expected)
+	{
+		float worst = 0.0f;
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 4; row++) {
+				float difference = fabsf(actual[column][row] - expected[column][row]);
+				worst = std::max(worst, difference / std::max(1.0f, fabsf(expected[column][row])));
+			}
+		}
+		return worst;
+	}
+
+	float randomIn(float low, float high)
+	{
+		return low + (high - low) * (float)rand() / (float)RAND_MAX;
+	}
+
+	glm::vec3 randomDirection()
+	{
+		for (;;) {
+			glm::vec3 v(randomIn(-1.0f, 1.0f), randomIn(-1.0f, 1.0f), randomIn(-1.0f, 1.0f));
+			if (glm::length(v) > 0.1f) {
+				return glm::normalize(v);
+			}
+		}
+	}
+
+	// A rectangular wall anywhere near the origin and turned any way, and
+	// an eye in front of it, not necessarily facing its middle.
+	struct RandomWall
+	{
+		RandomWall()
+		{
+			glm::vec3 right = randomDirection();
+			glm::vec3 up = glm::normalize(glm::cross(randomDirection(), right));
+			while (glm::length(glm::cross(up, right)) < 0.5f) {
+				up = glm::normalize(glm::cross(randomDirection(), right));
+			}
+			glm::vec3 normal = glm::cross(right, up);
+			float width = randomIn(0.5f, 4.0f), height = randomIn(0.5f, 4.0f);
+			lowerLeft = glm::vec3(randomIn(-3.0f, 3.0f), randomIn(-3.0f, 3.0f), randomIn(-3.0f, 3.0f));
+			lowerRight = lowerLeft + width * right;
+			upperLeft = lowerLeft + height * up;
+			eye = lowerLeft + randomIn(-1.0f, width + 1.0f) * right + randomIn(-1.0f, height + 1.0f) * up
+				+ randomIn(0.2f, 3.0f) * normal;
+		}
+
+		glm::vec3 lowerLeft, lowerRight, upperLeft, eye;
+	};
+
+	// Off-axis projection kernels: batches of every size from 1 to 9, so
+	// both whole and partial fours, checked against frusta worked out by
+	// hand, then random walls and eyes against OffAxisProjection; then each
+	// kernel timed on a large batch.
+	int benchOffAxis(int argc, char** argv)
+	{
+		int pairs = argc > 0 ? atoi(argv[0]) : 4096;
+		const int runs = 100;
+		if (pairs < 1) {
+			std::cerr << "usage: Bench offaxis [pairs]" << std::endl;
+			return 1;
+		}
+		const float n = 0.5f, f = 10.0f;
+
+		// The front wall is 2 m square at z = -1; the left wall is the same
+		// turned to face +x, its right edge towards -z. From an eye at (x, y,
+		// z), a wall spans A to A + 2 across and B to B + 2 up at distance D,
+		// so on the near plane l = A n / D, r = (A + 2) n / D, and so on.
+		const glm::vec3 frontLowerLeft(-1.0f, -1.0f, -1.0f), frontLowerRight(1.0f, -1.0f, -1.0f), frontUpperLeft(-1.0f, 1.0f, -1.0f);
+		const glm::vec3 leftLowerLeft(-1.0f, -1.0f, 1.0f), leftLowerRight(-1.0f, -1.0f, -1.0f), leftUpperLeft(-1.0f, 1.0f, 1.0f);
+		const glm::mat4 facingFront(1.0f);
+		const glm::mat4 facingLeft(glm::vec4(0.0f, 0.0f, -1.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+			glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		const OffAxisCase cases[] = {
+			// A = B = -1, D = 1: the symmetric 90 degree frustum.
+			{ "centred", frontLowerLeft, frontLowerRight, frontUpperLeft, glm::vec3(0.0f),
+				glm::frustum(-n, n, -n, n, n, f), facingFront },
+			// A = B = -1, D = 2: half the extents.
+			{ "centred, further back", frontLowerLeft, frontLowerRight, frontUpperLeft, glm::vec3(0.0f, 0.0f, 1.0f),
+				glm::frustum(-0.5f * n, 0.5f * n, -0.5f * n, 0.5f * n, n, f), facingFront },
+			// A = -1.5, B = -1.25, D = 1.
+			{ "off centre", frontLowerLeft, frontLowerRight, frontUpperLeft, glm::vec3(0.5f, 0.25f, 0.0f),
+				glm::frustum(-1.5f * n, 0.5f * n, -1.25f * n, 0.75f * n, n, f), facingFront },
+			// A = -0.5, B = -1.25, D = 1.
+			{ "off centre, turned", leftLowerLeft, leftLowerRight, leftUpperLeft, glm::vec3(0.0f, 0.25f, 0.5f),
+				glm::frustum(-0.5f * n, 1.5f * n, -1.25f * n, 0.75f * n, n, f), facingLeft },
+		};
+		const int caseCount = sizeof(cases) / sizeof(cases[0]);
+
+		OffAxisKernel kernels[] = { OFF_AXIS_KERNEL_SCALAR, OFF_AXIS_KERNEL_SSE2 };
+		int failures = 0;
+		std::cout << "Off-axis projections against hand-derived frusta, batches of 1 to 9" << std::endl;
+		for (OffAxisKernel kernel : kernels) {
+			if (kernel > bestOffAxisKernel()) {
+				std::cout << "  " << offAxisKernelName(kernel) << ": not supported by this CPU" << std::endl;
+				continue;
+			}
+			float worst = 0.0f;
+			for (int size = 1; size <= 9; size++) {
+				OffAxisBatch batch;
+				for (int i = 0; i < size; i++) {
+					const OffAxisCase & c = cases[i % caseCount];
+					batch.setEye(batch.add(c.lowerLeft, c.lowerRight, c.upperLeft), c.eye);
+				}
+				batch.project(kernel);
+				for (int i = 0; i < size; i++) {
+					const OffAxisCase & c = cases[i % caseCount];
+					glm::mat4 pose = c.facing;
+					pose[3] = glm::vec4(c.eye, 1.0f);
+					float error = std::max(largestDifference(batch.projection(i, n, f), c.projection),
+						largestDifference(batch.pose(i), pose));
+					if (error > 1e-5f) {
+						std::cout << "  " << offAxisKernelName(kernel) << ": " << c.name << " frustum at " << i
+							<< " of " << size << " is off by " << error << std::endl;
+						++failures;
+					}
+					worst = std::max(worst, error);
+				}
+			}
+			std::cout << "  " << offAxisKernelName(kernel) << ": largest difference " << worst << std::endl;
+		}
+
+		std::vector<RandomWall> random(pairs);
+		std::cout << "Off-axis projections against OffAxisProjection, random walls and eyes, batches of 1 to 9 and "
+			<< pairs << std::endl;
+		for (OffAxisKernel kernel : kernels) {
+			if (kernel > bestOffAxisKernel()) {
+				continue;
+			}
+			float worst = 0.0f;
+			int wrong = 0;
+			const int sizes[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, pairs };
+			for (int size : sizes) {
+				int count = std::min(size, pairs);
+				OffAxisBatch batch;
+				for (int i = 0; i < count; i++) {
+					const RandomWall & w = random[i];
+					batch.setEye(batch.add(w.lowerLeft, w.lowerRight, w.upperLeft), w.eye);
+				}
+				batch.project(kernel);
+				for (int i = 0; i < count; i++) {
+					const RandomWall & w = random[i];
+					glm::mat4 pose;
+					glm::mat4 projection = OffAxisProjection(w.lowerLeft, w.lowerRight, w.upperLeft, w.eye, n, f, pose);
+					float error = std::max(largestDifference(batch.projection(i, n, f), projection),
+						largestDifference(batch.pose(i), pose));
+					wrong += error > 1e-4f ? 1 : 0;
+					worst = std::max(worst, error);
+				}
+			}
+			std::cout << "  " << offAxisKernelName(kernel) << ": largest difference " << worst
+				<< (wrong > 0 ? "  DIFFERS FROM OffAxisProjection" : "") << std::endl;
+			failures += wrong;
+		}
+
+		std::cout << "Off-axis projections, " << pairs << " pairs, best of " << runs << std::endl;
+		OffAxisBatch batch;
+		for (int i = 0; i < pairs; i++) {
+			const RandomWall & w = random[i];
+			batch.setEye(batch.add(w.lowerLeft, w.lowerRight, w.upperLeft), w.eye);
+		}
+		double scalarBest = 0.0;
+		for (OffAxisKernel kernel : kernels) {
+			if (kernel > bestOffAxisKernel()) {
+				continue;
+			}
+			double best = 1e30;
+			for (int run = 0; run < runs; run++) {
+				auto start = Clock::now();
+				batch.project(kernel);
+				best = std::min(best, millisSince(start));
+			}
+			if (kernel == OFF_AXIS_KERNEL_SCALAR) {
+				scalarBest = best;
+			}
+			std::cout << "  " << offAxisKernelName(kernel) << ": " << best * 1e6 / pairs << " ns a pair, "
+				<< scalarBest / best << "x" << std::endl;
+		}
+		return failures > 0 ? 1 : 0;
+	}
+
+	struct Benchmark
+	{
+		const char* name;
+		const char* description;
+		int(*run)(int argc, char** argv);
+	};
+
+	const Benchmark BENCHMARKS[] = {
+		{ "mips", "[face size]  CPU cube mip chains vs glGenerateMipmap", benchMips },
+		{ "rgba", "[megatexels] RGB8/RGB16 to RGBA8 conversion kernels", benchRGBA },
+		{ "panorama", "[width]  equirectangular to cube map resampling", benchPanorama },
+		{ "offaxis", "[pairs]  off-axis projection kernels, checked and timed", benchOffAxis },
+	};
+}
+
+int main(int argc, char** argv)
+{
+	for (const Benchmark & benchmark : BENCHMARKS) {
+		if (argc > 1 && strcmp(argv[1], benchmark.name) == 0) {
+			return benchmark.run(argc - 2, argv + 2);
+		}
+	}
+
+	std::cerr << "usage: Bench <benchmark> [args]" << std::endl;
+	for (const Benchmark & benchmark : BENCHMARKS) {
+		std::cerr << "  " << benchmark.name << " " << benchmark.description << std::endl;
+	}
+	return 1;
+}
@@ -0,0 +1,454 @@
+#include "BlockCompress.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <future>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+	// A 4x4 block of RGBA8 texels in row-major order.
+	struct Block
+	{
+		unsigned char texels[16][4];
+	};
+
+	int clampByte(int v) {
+		return v < 0 ? 0 : (v > 255 ? 255 : v);
+	}
+
+	int squaredDistance(const unsigned char* a, const int* b) {
+		int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+		return dr * dr + dg * dg + db * db;
+	}
+
+	// Principal axis of the block's RGB values by power iteration; the block
+	// is then spanned by mean + axis * t for t in [tmin, tmax].
+	void principalAxis(const Block & block, float mean[3], float axis[3], float & tmin, float & tmax)
+	{
+		mean[0] = mean[1] = mean[2] = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 3; c++) {
+				mean[c] += block.texels[i][c] / 16.0f;
+			}
+		}
+
+		float cov[6] = { 0 };
+		for (int i = 0; i < 16; i++) {
+			float d[3] = { block.texels[i][0] - mean[0], block.texels[i][1] - mean[1], block.texels[i][2] - mean[2] };
+			cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+			cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+		}
+
+		axis[0] = axis[1] = axis[2] = 1.0f;
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+			float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+			float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+			float length = sqrtf(x * x + y * y + z * z);
+			if (length < 1e-6f) {
+				break;
+			}
+			axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+		}
+		float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		for (int c = 0; c < 3; c++) {
+			axis[c] /= length;
+		}
+
+		tmin = tmax = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			float t = (block.texels[i][0] - mean[0]) * axis[0] + (block.texels[i][1] - mean[1]) * axis[1]
+				+ (block.texels[i][2] - mean[2]) * axis[2];
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+	}
+
+	// Picks the nearest palette entry for every texel; returns the error.
+	int assignIndices(const Block & block, const int palette[][3], int paletteSize, int indices[16])
+	{
+		int error = 0;
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestError = squaredDistance(block.texels[i], palette[0]);
+			for (int p = 1; p < paletteSize; p++) {
+				int e = squaredDistance(block.texels[i], palette[p]);
+				if (e < bestError) {
+					best = p;
+					bestError = e;
+				}
+			}
+			indices[i] = best;
+			error += bestError;
+		}
+		return error;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	// BC1
+
+	uint16_t to565(const float color[3]) {
+		int r = std::min(31, std::max(0, (int)floorf(color[0] * 31.0f / 255.0f + 0.5f)));
+		int g = std::min(63, std::max(0, (int)floorf(color[1] * 63.0f / 255.0f + 0.5f)));
+		int b = std::min(31, std::max(0, (int)floorf(color[2] * 31.0f / 255.0f + 0.5f)));
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void from565(uint16_t v, int color[3]) {
+		int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	int encodeBC1(const Block & block, unsigned char* out)
+	{
+		float mean[3], axis[3], tmin, tmax;
+		principalAxis(block, mean, axis, tmin, tmax);
+
+		// Pull the endpoints in slightly; the extremes are usually outliers.
+		float inset = (tmax - tmin) / 16.0f;
+		float e0[3], e1[3];
+		for (int c = 0; c < 3; c++) {
+			e0[c] = mean[c] + axis[c] * (tmax - inset);
+			e1[c] = mean[c] + axis[c] * (tmin + inset);
+		}
+		uint16_t c0 = to565(e0), c1 = to565(e1);
+		if (c0 < c1) {
+			std::swap(c0, c1);
+		}
+
+		// c0 > c1 selects the four colour mode; equal endpoints only ever
+		// need index 0.
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		int indices[16];
+		int error = assignIndices(block, palette, c0 == c1 ? 1 : 4, indices);
+
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; i++) {
+			bits |= (uint32_t)indices[i] << (2 * i);
+		}
+		out[0] = (unsigned char)(c0 & 0xff);
+		out[1] = (unsigned char)(c0 >> 8);
+		out[2] = (unsigned char)(c1 & 0xff);
+		out[3] = (unsigned char)(c1 >> 8);
+		for (int i = 0; i < 4; i++) {
+			out[4 + i] = (unsigned char)(bits >> (8 * i));
+		}
+		return error;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	// BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each and
+	// 4-bit indices.
+
+	const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct BitWriter
+	{
+		unsigned char* out;
+		int position;
+		void write(uint32_t value, int bits) {
+			for (int i = 0; i < bits; i++, position++) {
+				if (value & (1u << i)) {
+					out[position >> 3] |= (unsigned char)(1 << (position & 7));
+				}
+			}
+		}
+	};
+
+	// Quantizes an endpoint to 7 bits per channel plus a shared p-bit,
+	// choosing the p-bit that reproduces the colour best.
+	void quantizeBC7(const float color[3], int quantized[3], int & pbit, int expanded[3])
+	{
+		int bestError = INT32_MAX;
+		for (int p = 0; p < 2; p++) {
+			int q[3], e[3], error = 0;
+			for (int c = 0; c < 3; c++) {
+				q[c] = std::min(127, std::max(0, (int)floorf((color[c] - p) / 2.0f + 0.5f)));
+				e[c] = (q[c] << 1) | p;
+				error += (int)((e[c] - color[c]) * (e[c] - color[c]));
+			}
+			if (error < bestError) {
+				bestError = error;
+				pbit = p;
+				memcpy(quantized, q, sizeof(q));
+				memcpy(expanded, e, sizeof(e));
+			}
+		}
+	}
+
+	int encodeBC7(const Block & block, unsigned char* out)
+	{
+		float mean[3], axis[3], tmin, tmax;
+		principalAxis(block, mean, axis, tmin, tmax);
+		float e0[3], e1[3];
+		for (int c = 0; c < 3; c++) {
+			e0[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tmin));
+			e1[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tmax));
+		}
+
+		int q[2][3], p[2], endpoint[2][3];
+		quantizeBC7(e0, q[0], p[0], endpoint[0]);
+		quantizeBC7(e1, q[1], p[1], endpoint[1]);
+
+		int palette[16][3];
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 3; c++) {
+				palette[i][c] = ((64 - BC7_WEIGHTS4[i]) * endpoint[0][c] + BC7_WEIGHTS4[i] * endpoint[1][c] + 32) >> 6;
+			}
+		}
+		int indices[16];
+		int error = assignIndices(block, palette, 16, indices);
+
+		// The anchor (texel 0) index is stored without its top bit, so it
+		// must be < 8; swap the endpoints if it is not.
+		if (indices[0] >= 8) {
+			std::swap(q[0], q[1]);
+			std::swap(p[0], p[1]);
+			for (int i = 0; i < 16; i++) {
+				indices[i] = 15 - indices[i];
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter bits = { out, 0 };
+		bits.write(1 << 6, 7);
+		for (int c = 0; c < 3; c++) {
+			bits.write(q[0][c], 7);
+			bits.write(q[1][c], 7);
+		}
+		// Opaque alpha: 127 with the chosen p-bit expands to 254 or 255.
+		bits.write(127, 7);
+		bits.write(127, 7);
+		bits.write(p[0], 1);
+		bits.write(p[1], 1);
+		bits.write(indices[0], 3);
+		for (int i = 1; i < 16; i++) {
+			bits.write(indices[i], 4);
+		}
+		return error;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	// ETC2 RGB, restricted to the ETC1-compatible individual and
+	// differential modes (the differential deltas never overflow, so the
+	// T/H/planar modes are never triggered).
+
+	const int ETC_MODIFIERS[8][4] = {
+		{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+		{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+	};
+
+	bool inSubblock(int texel, bool flip, int subblock) {
+		int x = texel & 3, y = texel >> 2;
+		return ((flip ? y : x) >= 2) == (subblock == 1);
+	}
+
+	// Best modifier table and per-texel indices for one half of the block.
+	int fitSubblock(const Block & block, bool flip, int subblock, const int base[3], int & table, int indices[16])
+	{
+		int bestError = INT32_MAX;
+		int candidate[16];
+		for (int t = 0; t < 8; t++) {
+			int palette[4][3];
+			for (int m = 0; m < 4; m++) {
+				for (int c = 0; c < 3; c++) {
+					palette[m][c] = clampByte(base[c] + ETC_MODIFIERS[t][m]);
+				}
+			}
+			int error = 0;
+			for (int i = 0; i < 16 && error < bestError; i++) {
+				if (!inSubblock(i, flip, subblock)) {
+					continue;
+				}
+				int best = 0, bestTexel = squaredDistance(block.texels[i], palette[0]);
+				for (int m = 1; m < 4; m++) {
+					int e = squaredDistance(block.texels[i], palette[m]);
+					if (e < bestTexel) {
+						best = m;
+						bestTexel = e;
+					}
+				}
+				candidate[i] = best;
+				error += bestTexel;
+			}
+			if (error < bestError) {
+				bestError = error;
+				table = t;
+				for (int i = 0; i < 16; i++) {
+					if (inSubblock(i, flip, subblock)) {
+						indices[i] = candidate[i];
+					}
+				}
+			}
+		}
+		return bestError;
+	}
+
+	int encodeETC2(const Block & block, unsigned char* out)
+	{
+		int bestError = INT32_MAX;
+		uint32_t bestHigh = 0, bestLow = 0;
+
+		for (int flip = 0; flip < 2; flip++) {
+			float average[2][3] = { { 0 } };
+			for (int i = 0; i < 16; i++) {
+				int subblock = inSubblock(i, flip != 0, 1) ? 1 : 0;
+				for (int c = 0; c < 3; c++) {
+					average[subblock][c] += block.texels[i][c] / 8.0f;
+				}
+			}
+
+			for (int differential = 0; differential < 2; differential++) {
+				int quantized[2][3], base[2][3];
+				int levels = differential ? 31 : 15;
+				bool valid = true;
+				for (int s = 0; s < 2; s++) {
+					for (int c = 0; c < 3; c++) {
+						quantized[s][c] = (int)floorf(average[s][c] * levels / 255.0f + 0.5f);
+						base[s][c] = differential ? (quantized[s][c] << 3) | (quantized[s][c] >> 2)
+							: (quantized[s][c] << 4) | quantized[s][c];
+					}
+				}
+				for (int c = 0; c < 3 && differential; c++) {
+					int delta = quantized[1][c] - quantized[0][c];
+					valid = valid && delta >= -4 && delta <= 3;
+				}
+				if (!valid) {
+					continue;
+				}
+
+				int table[2], indices[16];
+				int error = fitSubblock(block, flip != 0, 0, base[0], table[0], indices)
+					+ fitSubblock(block, flip != 0, 1, base[1], table[1], indices);
+				if (error >= bestError) {
+					continue;
+				}
+
+				uint32_t high;
+				if (differential) {
+					high = (quantized[0][0] << 27) | (((quantized[1][0] - quantized[0][0]) & 7) << 24)
+						| (quantized[0][1] << 19) | (((quantized[1][1] - quantized[0][1]) & 7) << 16)
+						| (quantized[0][2] << 11) | (((quantized[1][2] - quantized[0][2]) & 7) << 8);
+				}
+				else {
+					high = (quantized[0][0] << 28) | (quantized[1][0] << 24)
+						| (quantized[0][1] << 20) | (quantized[1][1] << 16)
+						| (quantized[0][2] << 12) | (quantized[1][2] << 8);
+				}
+				high |= (table[0] << 5) | (table[1] << 2) | (differential << 1) | flip;
+
+				// Index bits are stored column-major: texel (x, y) is bit x * 4 + y.
+				uint32_t low = 0;
+				for (int i = 0; i < 16; i++) {
+					int bit = (i & 3) * 4 + (i >> 2);
+					low |= (uint32_t)(indices[i] >> 1) << (16 + bit);
+					low |= (uint32_t)(indices[i] & 1) << bit;
+				}
+
+				bestError = error;
+				bestHigh = high;
+				bestLow = low;
+			}
+		}
+
+		for (int i = 0; i < 4; i++) {
+			out[i] = (unsigned char)(bestHigh >> (24 - 8 * i));
+			out[4 + i] = (unsigned char)(bestLow >> (24 - 8 * i));
+		}
+		return bestError;
+	}
+
+	double compressRows(BlockFormat format, const unsigned char* rgba, int width, int height,
+		int firstRow, int lastRow, unsigned char* out)
+	{
+		int blocksWide = (width + 3) / 4;
+		size_t bytes = blockBytes(format);
+		double error = 0.0;
+		Block block;
+		for (int by = firstRow; by < lastRow; by++) {
+			for (int bx = 0; bx < blocksWide; bx++) {
+				for (int i = 0; i < 16; i++) {
+					int x = std::min(bx * 4 + (i & 3), width - 1);
+					int y = std::min(by * 4 + (i >> 2), height - 1);
+					memcpy(block.texels[i], rgba + ((size_t)y * width + x) * 4, 4);
+				}
+				unsigned char* dst = out + ((size_t)by * blocksWide + bx) * bytes;
+				switch (format) {
+				case BLOCK_BC1:
+					error += encodeBC1(block, dst);
+					break;
+				case BLOCK_BC7:
+					error += encodeBC7(block, dst);
+					break;
+				case BLOCK_ETC2:
+					error += encodeETC2(block, dst);
+					break;
+				}
+			}
+		}
+		return error;
+	}
+}
+
+size_t blockBytes(BlockFormat format)
+{
+	return format == BLOCK_BC7 ? 16 : 8;
+}
+
+GLenum blockInternalFormat(BlockFormat format)
+{
+	switch (format) {
+	case BLOCK_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC7:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default:
+		return GL_COMPRESSED_RGB8_ETC2;
+	}
+}
+
+const char* blockFormatName(BlockFormat format)
+{
+	switch (format) {
+	case BLOCK_BC1:
+		return "bc1";
+	case BLOCK_BC7:
+		return "bc7";
+	default:
+		return "etc2";
+	}
+}
+
+CompressedImage compressImage(BlockFormat format, const unsigned char* rgba, int width, int height, ThreadPool & pool)
+{
+	int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	CompressedImage result;
+	result.blocks.resize((size_t)blocksWide * blocksHigh * blockBytes(format));
+	result.squaredError = 0.0;
+
+	// A few jobs per worker keeps the pool busy without much overhead.
+	int jobs = std::min(blocksHigh, (int)pool.size() * 4);
+	int rowsPerJob = (blocksHigh + jobs - 1) / jobs;
+	unsigned char* out = &result.blocks[0];
+	std::vector<std::future<double>> errors;
+	for (int row = 0; row < blocksHigh; row += rowsPerJob) {
+		int last = std::min(blocksHigh, row + rowsPerJob);
+		errors.push_back(pool.submit([=] {
+			return compressRows(format, rgba, width, height, row, last, out);
+		}));
+	}
+	for (auto & error : errors) {
+		result.squaredError += error.get();
+	}
+	return result;
+}
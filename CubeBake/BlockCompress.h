@@ -0,0 +1,35 @@
+#ifndef _BLOCK_COMPRESS_H_
+#define _BLOCK_COMPRESS_H_
+
+#include <GL\glew.h>
+
+#include <vector>
+
+class ThreadPool;
+
+// GPU block-compressed formats CubeBake can produce. All of them work on
+// 4x4 texel blocks; edge blocks of images that are not a multiple of four
+// repeat the last row/column.
+enum BlockFormat
+{
+	BLOCK_BC1,		// GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 4 bpp
+	BLOCK_BC7,		// GL_COMPRESSED_RGBA_BPTC_UNORM, 8 bpp (mode 6 only)
+	BLOCK_ETC2,		// GL_COMPRESSED_RGB8_ETC2, 4 bpp (ETC1-compatible modes)
+};
+
+struct CompressedImage
+{
+	std::vector<unsigned char> blocks;
+	// Sum of squared RGB differences between the source and the decoded
+	// blocks, for PSNR reporting.
+	double squaredError;
+};
+
+size_t blockBytes(BlockFormat format);
+GLenum blockInternalFormat(BlockFormat format);
+const char* blockFormatName(BlockFormat format);
+
+// Compresses a tightly packed RGBA8 image, spreading block rows across pool.
+CompressedImage compressImage(BlockFormat format, const unsigned char* rgba, int width, int height, ThreadPool & pool);
+
+#endif
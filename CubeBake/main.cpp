@@ -0,0 +1,568 @@
+// CubeBake: converts six PPM faces into a pre-baked .cube container that
+// SkyBox can map and upload without any CPU-side conversion, or with
+// --tiles into a tiled .vtex file that SkyBox streams as a virtual texture,
+// or with --video packs a sequence of such faces into a .cubevid container
+// for CubeVideo.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "BlockCompress.h"
+#include "CubeMapFile.h"
+#include "CubeVideoFile.h"
+#include "MipGenerator.h"
+#include "PPMImage.h"
+#include "ThreadPool.h"
+#include "VirtualTextureFile.h"
+
+namespace {
+
+	// Face files of a directory, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order.
+	// This matches the Textures/custom layout SkyBox uses.
+	const char* FACE_NAMES[6] = { "left.ppm", "right.ppm", "top.ppm", "bottom.ppm", "back.ppm", "front.ppm" };
+	const char* FACE_LABELS[6] = { "+X", "-X", "+Y", "-Y", "+Z", "-Z" };
+	// Per-frame subdirectories of a stereo sequence.
+	const char* VIEW_DIRECTORIES[2] = { "L", "R" };
+
+	// One texel of border is all bilinear filtering at a single level needs.
+	const uint32_t TILE_BORDER = 1;
+
+	struct Options
+	{
+		std::string format;
+		bool mips;
+		uint32_t tileSize;
+		double videoRate;
+		std::string output;
+		std::vector<std::string> faces;
+		std::string sequence;
+	};
+
+	void usage()
+	{
+		std::cerr << "usage: CubeBake [--format <fmt>] [--mips] <output.cube> <face directory>" << std::endl
+			<< "       CubeBake [--format <fmt>] [--mips] <output.cube> <+x> <-x> <+y> <-y> <+z> <-z>" << std::endl
+			<< std::endl
+			<< "  --format rgb    uncompressed, 3 channels (default)" << std::endl
+			<< "  --format rgba   uncompressed, 4 channels with opaque alpha (also --rgba)" << std::endl
+			<< "  --format bc1    BC1/DXT1 blocks, 4 bpp" << std::endl
+			<< "  --format bc7    BC7 blocks, 8 bpp" << std::endl
+			<< "  --format etc2   ETC2 RGB blocks, 4 bpp" << std::endl
+			<< "  --mips          store a full box-filtered mip chain, seam-corrected for 8-bit faces" << std::endl
+			<< "  --tiles <size>  write a tiled .vtex virtual texture instead; the face size must be" << std::endl
+			<< "                  size times a power of two (--format and --mips are ignored)" << std::endl
+			<< "  --video <fps>   pack the frame sequence in <face directory> into a .cubevid video;" << std::endl
+			<< "                  frame n is <n as 5 digits>/ holding the six faces, or L/ and R/" << std::endl
+			<< "                  holding them for stereo (--mips is ignored)" << std::endl;
+	}
+
+	bool parseArgs(int argc, char** argv, Options & options)
+	{
+		options.format = "rgb";
+		options.mips = false;
+		options.tileSize = 0;
+		options.videoRate = 0.0;
+		std::vector<std::string> positional;
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--rgba") == 0) {
+				options.format = "rgba";
+			}
+			else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+				options.format = argv[++i];
+				if (options.format != "rgb" && options.format != "rgba" && options.format != "bc1"
+					&& options.format != "bc7" && options.format != "etc2") {
+					std::cerr << "unknown format " << options.format << std::endl;
+					return false;
+				}
+			}
+			else if (strcmp(argv[i], "--mips") == 0) {
+				options.mips = true;
+			}
+			else if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc) {
+				options.tileSize = (uint32_t)atoi(argv[++i]);
+				if (options.tileSize == 0) {
+					std::cerr << "bad tile size " << argv[i] << std::endl;
+					return false;
+				}
+			}
+			else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+				options.videoRate = atof(argv[++i]);
+				if (options.videoRate <= 0.0) {
+					std::cerr << "bad frame rate " << argv[i] << std::endl;
+					return false;
+				}
+			}
+			else if (argv[i][0] == '-' && argv[i][1] == '-') {
+				std::cerr << "unknown option " << argv[i] << std::endl;
+				return false;
+			}
+			else {
+				positional.push_back(argv[i]);
+			}
+		}
+
+		if (options.videoRate > 0.0) {
+			if (positional.size() != 2) {
+				return false;
+			}
+			options.sequence = positional[1];
+		}
+		else if (positional.size() == 2) {
+			std::string dir = positional[1];
+			if (!dir.empty() && dir.back() != '/' && dir.back() != '\\') {
+				dir += "/";
+			}
+			for (int face = 0; face < 6; face++) {
+				options.faces.push_back(dir + FACE_NAMES[face]);
+			}
+		}
+		else if (positional.size() == 7) {
+			options.faces.assign(positional.begin() + 1, positional.end());
+		}
+		else {
+			return false;
+		}
+		options.output = positional[0];
+		return true;
+	}
+
+	// One face level, tightly packed, samples in native byte order.
+	template <typename T>
+	struct Image
+	{
+		int width, height, channels;
+		std::vector<T> samples;
+	};
+
+	template <typename T>
+	Image<T> readFace(const PPMImage & ppm, int channels, T opaque)
+	{
+		Image<T> image;
+		image.width = ppm.width();
+		image.height = ppm.height();
+		image.channels = channels;
+		image.samples.resize((size_t)image.width * image.height * channels);
+		const unsigned char* src = ppm.pixels();
+		bool wide = ppm.type() == GL_UNSIGNED_SHORT;
+		size_t texels = (size_t)image.width * image.height;
+		for (size_t i = 0; i < texels; i++) {
+			for (int c = 0; c < 3; c++) {
+				// PPM stores 16-bit samples big-endian.
+				uint32_t v = wide ? (src[0] << 8) | src[1] : src[0];
+				if (wide && sizeof(T) == 1) {
+					v = (v * 255 + 32767) / 65535;
+				}
+				image.samples[i * channels + c] = (T)v;
+				src += wide ? 2 : 1;
+			}
+			if (channels == 4) {
+				image.samples[i * channels + 3] = opaque;
+			}
+		}
+		return image;
+	}
+
+	// 2x2 box filter; odd edges reuse the last row/column.
+	template <typename T>
+	Image<T> downsample(const Image<T> & src)
+	{
+		Image<T> dst;
+		dst.width = std::max(1, src.width / 2);
+		dst.height = std::max(1, src.height / 2);
+		dst.channels = src.channels;
+		dst.samples.resize((size_t)dst.width * dst.height * dst.channels);
+		for (int y = 0; y < dst.height; y++) {
+			int y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+			for (int x = 0; x < dst.width; x++) {
+				int x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+				for (int c = 0; c < dst.channels; c++) {
+					uint32_t sum = src.samples[((size_t)y0 * src.width + x0) * src.channels + c]
+						+ src.samples[((size_t)y0 * src.width + x1) * src.channels + c]
+						+ src.samples[((size_t)y1 * src.width + x0) * src.channels + c]
+						+ src.samples[((size_t)y1 * src.width + x1) * src.channels + c];
+					dst.samples[((size_t)y * dst.width + x) * dst.channels + c] = (T)((sum + 2) / 4);
+				}
+			}
+		}
+		return dst;
+	}
+
+	// 8-bit square faces get their mip chain from MipGenerator, which also
+	// averages texels along the shared cube edges. It works in RGBA8, so
+	// levels are converted back to the output channel count on the way out.
+	bool useCubeChain(const std::vector<PPMImage*> & faces, const CubeMapFileHeader & header)
+	{
+		return header.levels > 1 && header.width == header.height && faces[0]->type() == GL_UNSIGNED_BYTE;
+	}
+
+	void buildCubeChain(const std::vector<PPMImage*> & faces, CubeMipChain & chain)
+	{
+		chain.size = faces[0]->width();
+		for (int face = 0; face < 6; face++) {
+			Image<uint8_t> image = readFace<uint8_t>(*faces[face], 4, 0xff);
+			chain.faces[face].resize(1);
+			chain.faces[face][0].swap(image.samples);
+		}
+		buildCubeMipChain(chain, bestMipKernel());
+	}
+
+	Image<uint8_t> chainImage(const CubeMipChain & chain, int face, int level, int channels)
+	{
+		Image<uint8_t> image;
+		image.width = image.height = std::max(1, chain.size >> level);
+		image.channels = channels;
+		const std::vector<unsigned char> & rgba = chain.faces[face][level];
+		if (channels == 4) {
+			image.samples = rgba;
+			return image;
+		}
+		size_t texels = (size_t)image.width * image.height;
+		image.samples.resize(texels * channels);
+		for (size_t i = 0; i < texels; i++) {
+			for (int c = 0; c < channels; c++) {
+				image.samples[i * channels + c] = rgba[i * 4 + c];
+			}
+		}
+		return image;
+	}
+
+	// Lay rows out with the header's unpack alignment.
+	template <typename T>
+	std::vector<unsigned char> pack(const Image<T> & image, size_t alignment)
+	{
+		size_t rowBytes = (size_t)image.width * image.channels * sizeof(T);
+		size_t pitch = (rowBytes + alignment - 1) / alignment * alignment;
+		std::vector<unsigned char> bytes(pitch * image.height, 0);
+		for (int y = 0; y < image.height; y++) {
+			memcpy(&bytes[y * pitch], &image.samples[(size_t)y * image.width * image.channels], rowBytes);
+		}
+		return bytes;
+	}
+
+	template <typename T>
+	bool bake(const Options & options, const std::vector<PPMImage*> & faces, CubeMapFileHeader header)
+	{
+		int channels = options.format == "rgba" ? 4 : 3;
+		std::vector<std::vector<unsigned char>> images;
+		if (useCubeChain(faces, header)) {
+			CubeMipChain chain;
+			buildCubeChain(faces, chain);
+			for (uint32_t l = 0; l < header.levels; l++) {
+				for (int face = 0; face < 6; face++) {
+					images.push_back(pack(chainImage(chain, face, l, channels), header.unpackAlignment));
+				}
+			}
+			return CubeMapFile::write(options.output.c_str(), header, images);
+		}
+
+		T opaque = (T)(sizeof(T) == 1 ? 0xff : 0xffff);
+		std::vector<Image<T>> level(6);
+		for (int face = 0; face < 6; face++) {
+			level[face] = readFace<T>(*faces[face], channels, opaque);
+		}
+
+		for (uint32_t l = 0; l < header.levels; l++) {
+			for (int face = 0; face < 6; face++) {
+				if (l > 0) {
+					level[face] = downsample(level[face]);
+				}
+				images.push_back(pack(level[face], header.unpackAlignment));
+			}
+		}
+		return CubeMapFile::write(options.output.c_str(), header, images);
+	}
+
+	bool bakeCompressed(const Options & options, const std::vector<PPMImage*> & faces, CubeMapFileHeader header,
+		BlockFormat format)
+	{
+		std::vector<Image<uint8_t>> level(6);
+		CubeMipChain chain;
+		bool cubeChain = useCubeChain(faces, header);
+		if (cubeChain) {
+			buildCubeChain(faces, chain);
+		}
+		else {
+			for (int face = 0; face < 6; face++) {
+				level[face] = readFace<uint8_t>(*faces[face], 4, 0xff);
+			}
+		}
+
+		std::vector<std::vector<unsigned char>> images;
+		for (uint32_t l = 0; l < header.levels; l++) {
+			for (int face = 0; face < 6; face++) {
+				if (cubeChain) {
+					level[face] = chainImage(chain, face, l, 4);
+				}
+				else if (l > 0) {
+					level[face] = downsample(level[face]);
+				}
+				const Image<uint8_t> & image = level[face];
+				CompressedImage compressed = compressImage(format, &image.samples[0], image.width, image.height,
+					ThreadPool::shared());
+
+				if (l == 0) {
+					double texels = (double)image.width * image.height;
+					double mse = compressed.squaredError / (texels * 3.0);
+					double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+					std::cout << "  face " << FACE_LABELS[face] << ": " << image.width << "x" << image.height << " "
+						<< blockFormatName(format) << ", " << compressed.blocks.size() << " bytes ("
+						<< texels * 3.0 / compressed.blocks.size() << ":1 vs RGB8), PSNR " << psnr << " dB" << std::endl;
+				}
+				images.push_back(compressed.blocks);
+			}
+		}
+		return CubeMapFile::write(options.output.c_str(), header, images);
+	}
+
+	// Faces are processed one at a time, level by level, and the tiles are
+	// written as they are cut, so only one face is ever held in memory.
+	bool bakeTiles(const Options & options, const std::vector<PPMImage*> & faces)
+	{
+		VirtualTextureFileHeader header;
+		if (faces[0]->width() != faces[0]->height()
+			|| !VirtualTextureFile::makeHeader(header, faces[0]->width(), options.tileSize, TILE_BORDER)) {
+			std::cerr << "faces must be square and " << options.tileSize << " times a power of two to tile" << std::endl;
+			return false;
+		}
+
+		FILE* fp = fopen(options.output.c_str(), "wb");
+		if (fp == NULL) {
+			std::cerr << "error writing virtual texture file, could not create " << options.output << std::endl;
+			return false;
+		}
+		bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+		int slot = (int)(header.tileSize + 2 * header.border);
+		std::vector<unsigned char> tile((size_t)slot * slot * 4);
+		MipKernel kernel = bestMipKernel();
+		for (int face = 0; ok && face < 6; face++) {
+			Image<uint8_t> image = readFace<uint8_t>(*faces[face], 4, 0xff);
+			int size = image.width;
+			for (uint32_t level = 0; ok && level < header.levels; level++) {
+				if (level > 0) {
+					std::vector<uint8_t> smaller((size_t)(size / 2) * (size / 2) * 4);
+					downsampleRGBA8(&image.samples[0], size, size, &smaller[0], kernel);
+					image.samples.swap(smaller);
+					size /= 2;
+				}
+				int tiles = size / (int)header.tileSize;
+				for (int ty = 0; ok && ty < tiles; ty++) {
+					for (int tx = 0; ok && tx < tiles; tx++) {
+						// Borders come from the neighbouring tiles, clamped at the face edge.
+						for (int y = 0; y < slot; y++) {
+							int sy = std::max(0, std::min(size - 1, ty * (int)header.tileSize + y - (int)header.border));
+							for (int x = 0; x < slot; x++) {
+								int sx = std::max(0, std::min(size - 1, tx * (int)header.tileSize + x - (int)header.border));
+								memcpy(&tile[((size_t)y * slot + x) * 4], &image.samples[((size_t)sy * size + sx) * 4], 4);
+							}
+						}
+						ok = fwrite(&tile[0], 1, tile.size(), fp) == tile.size();
+					}
+				}
+			}
+			std::cout << "  face " << FACE_LABELS[face] << " tiled" << std::endl;
+		}
+		ok = fclose(fp) == 0 && ok;
+		if (!ok) {
+			std::cerr << "error writing virtual texture file, short write to " << options.output << std::endl;
+			return false;
+		}
+		std::cout << "Wrote " << options.output << ": " << header.faceSize << "x" << header.faceSize << " x 6 faces in "
+			<< header.tileSize << " texel tiles, " << header.levels << " level(s), "
+			<< VirtualTextureFile::fileSize(header) << " bytes" << std::endl;
+		return true;
+	}
+
+	bool exists(const std::string & path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0;
+	}
+
+	std::string sequenceFace(const std::string & sequence, int frame, bool stereo, int view, int face)
+	{
+		char path[32];
+		if (stereo) {
+			snprintf(path, sizeof(path), "/%05d/%s/", frame, VIEW_DIRECTORIES[view]);
+		}
+		else {
+			snprintf(path, sizeof(path), "/%05d/", frame);
+		}
+		return sequence + path + FACE_NAMES[face];
+	}
+
+	// Frames are converted and written one at a time; 16-bit faces are
+	// narrowed to 8 bits, as CubeVideo would when playing the sequence.
+	bool bakeVideo(const Options & options)
+	{
+		bool stereo = !exists(sequenceFace(options.sequence, 0, false, 0, 0));
+		if (stereo && !exists(sequenceFace(options.sequence, 0, true, 0, 0))) {
+			std::cerr << "no frame sequence in " << options.sequence << std::endl;
+			return false;
+		}
+		PPMImage first;
+		if (!first.load(sequenceFace(options.sequence, 0, stereo, 0, 0).c_str())) {
+			return false;
+		}
+
+		bool rgba = options.format == "rgba";
+		bool compressed = !rgba && options.format != "rgb";
+		BlockFormat blockFormat = options.format == "bc1" ? BLOCK_BC1 : (options.format == "bc7" ? BLOCK_BC7 : BLOCK_ETC2);
+		int channels = rgba ? 4 : 3;
+
+		CubeVideoFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CUBE_VIDEO_FILE_MAGIC, 4);
+		header.version = CUBE_VIDEO_FILE_VERSION;
+		if (compressed) {
+			header.internalFormat = blockInternalFormat(blockFormat);
+			header.flags = CUBE_VIDEO_FILE_COMPRESSED;
+			header.unpackAlignment = 1;
+		}
+		else {
+			header.internalFormat = rgba ? GL_RGBA8 : GL_RGB8;
+			header.format = rgba ? GL_RGBA : GL_RGB;
+			header.type = GL_UNSIGNED_BYTE;
+			header.unpackAlignment = 4;
+		}
+		header.width = first.width();
+		header.height = first.height();
+		header.views = stereo ? 2 : 1;
+
+		std::vector<int64_t> timestamps;
+		while (exists(sequenceFace(options.sequence, (int)timestamps.size(), stereo, 0, 0))) {
+			timestamps.push_back((int64_t)(timestamps.size() * 1e6 / options.videoRate + 0.5));
+		}
+		header.frames = (uint32_t)timestamps.size();
+
+		size_t rowBytes = (size_t)header.width * channels;
+		header.faceBytes = (uint32_t)(compressed
+			? blockBytes(blockFormat) * ((header.width + 3) / 4) * ((header.height + 3) / 4)
+			: (rowBytes + header.unpackAlignment - 1) / header.unpackAlignment * header.unpackAlignment * header.height);
+
+		bool ok = CubeVideoFile::write(options.output.c_str(), header, timestamps, [&](int frame, unsigned char* pixels) {
+			for (uint32_t view = 0; view < header.views; view++) {
+				for (int face = 0; face < 6; face++) {
+					std::string path = sequenceFace(options.sequence, frame, stereo, view, face);
+					PPMImage ppm;
+					if (!ppm.load(path.c_str())) {
+						return false;
+					}
+					if (ppm.width() != first.width() || ppm.height() != first.height()) {
+						std::cerr << path << " does not match the size of the first frame" << std::endl;
+						return false;
+					}
+					std::vector<unsigned char> image = compressed
+						? compressImage(blockFormat, &readFace<uint8_t>(ppm, 4, 0xff).samples[0], ppm.width(), ppm.height(),
+							ThreadPool::shared()).blocks
+						: pack(readFace<uint8_t>(ppm, channels, 0xff), header.unpackAlignment);
+					memcpy(pixels + ((size_t)view * 6 + face) * header.faceBytes, &image[0], header.faceBytes);
+				}
+			}
+			if ((frame + 1) % 30 == 0 || frame + 1 == (int)header.frames) {
+				std::cout << "  " << frame + 1 << " of " << header.frames << " frames" << std::endl;
+			}
+			return true;
+		});
+		if (!ok) {
+			return false;
+		}
+
+		std::cout << "Wrote " << options.output << ": " << header.frames << " frames of " << header.views << " x 6 x "
+			<< header.width << "x" << header.height << " " << options.format << " at " << options.videoRate << " fps, "
+			<< (uint64_t)header.frames * header.views * 6 * header.faceBytes << " bytes of pixel data" << std::endl;
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseArgs(argc, argv, options)) {
+		usage();
+		return 1;
+	}
+	if (options.videoRate > 0.0) {
+		return bakeVideo(options) ? 0 : 1;
+	}
+
+	std::vector<PPMImage*> faces;
+	for (int face = 0; face < 6; face++) {
+		faces.push_back(new PPMImage());
+		if (!faces[face]->load(options.faces[face].c_str())) {
+			return 1;
+		}
+		if (faces[face]->width() != faces[0]->width() || faces[face]->height() != faces[0]->height()
+			|| faces[face]->maxval() != faces[0]->maxval()) {
+			std::cerr << options.faces[face] << " does not match the size and depth of " << options.faces[0] << std::endl;
+			return 1;
+		}
+	}
+
+	if (options.tileSize != 0) {
+		bool ok = bakeTiles(options, faces);
+		for (auto face : faces) {
+			delete face;
+		}
+		return ok ? 0 : 1;
+	}
+
+	bool wide = faces[0]->type() == GL_UNSIGNED_SHORT;
+	bool rgba = options.format == "rgba";
+	bool compressed = !rgba && options.format != "rgb";
+	BlockFormat blockFormat = options.format == "bc1" ? BLOCK_BC1 : (options.format == "bc7" ? BLOCK_BC7 : BLOCK_ETC2);
+
+	CubeMapFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CUBE_MAP_FILE_MAGIC, 4);
+	header.version = CUBE_MAP_FILE_VERSION;
+	if (compressed) {
+		header.internalFormat = blockInternalFormat(blockFormat);
+		header.flags = CUBE_MAP_FILE_COMPRESSED;
+	}
+	else {
+		header.format = rgba ? GL_RGBA : GL_RGB;
+		header.type = wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+		header.internalFormat = rgba ? (wide ? GL_RGBA16 : GL_RGBA8) : (wide ? GL_RGB16 : GL_RGB8);
+	}
+	header.width = faces[0]->width();
+	header.height = faces[0]->height();
+	header.levels = 1;
+	if (options.mips) {
+		for (uint32_t size = std::max(header.width, header.height); size > 1; size /= 2) {
+			++header.levels;
+		}
+	}
+	header.unpackAlignment = compressed ? 1 : 4;
+
+	bool ok;
+	if (compressed) {
+		ok = bakeCompressed(options, faces, header, blockFormat);
+	}
+	else {
+		ok = wide ? bake<uint16_t>(options, faces, header) : bake<uint8_t>(options, faces, header);
+	}
+	for (auto face : faces) {
+		delete face;
+	}
+	if (!ok) {
+		return 1;
+	}
+
+	CubeMapFile baked;
+	if (!baked.open(options.output.c_str())) {
+		return 1;
+	}
+	std::cout << "Wrote " << options.output << ": " << header.width << "x" << header.height << " x 6 faces, "
+		<< header.levels << " level(s), " << baked.byteCount() << " bytes of pixel data" << std::endl;
+	return 0;
+}
@@ -0,0 +1,143 @@
+// Embed: turns the files named in a resource list into constexpr byte
+// arrays with an index, as a header for Minimal's Resources. Minimal runs
+// it as a pre-build step, so shipped builds read their shaders from the
+// executable instead of from paths relative to the working directory.
+//
+// The list holds one path per line, relative to the list's directory, with
+// '#' starting a comment. The header is only rewritten when it changes, so
+// an unchanged list does not rebuild anything.
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+namespace {
+
+	void usage()
+	{
+		std::cerr << "usage: Embed <resource list> <output header>" << std::endl;
+	}
+
+	bool readFile(const std::string & path, std::string & contents)
+	{
+		std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+		if (!stream.is_open()) {
+			return false;
+		}
+		std::ostringstream buffer;
+		buffer << stream.rdbuf();
+		contents = buffer.str();
+		return true;
+	}
+
+	std::string trim(const std::string & line)
+	{
+		size_t comment = line.find('#');
+		std::string text = line.substr(0, comment);
+		size_t first = text.find_first_not_of(" \t\r\n");
+		size_t last = text.find_last_not_of(" \t\r\n");
+		return first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+	}
+
+	std::string directoryOf(const std::string & path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	// Keys use forward slashes whatever the list was written with.
+	std::string key(std::string path)
+	{
+		for (auto & c : path) {
+			if (c == '\\') {
+				c = '/';
+			}
+		}
+		return path;
+	}
+
+	std::string generate(const std::string & listName, const std::vector<std::string> & names,
+		const std::vector<std::string> & contents)
+	{
+		std::ostringstream out;
+		out << "// Generated by Embed from " << listName << "; do not edit." << std::endl << std::endl;
+		out << "namespace {" << std::endl;
+		char hex[8];
+		for (size_t i = 0; i < names.size(); i++) {
+			out << "\t// " << names[i] << std::endl;
+			out << "\tconstexpr unsigned char EMBEDDED_" << i << "[] = {";
+			const std::string & bytes = contents[i];
+			for (size_t b = 0; b < bytes.size(); b++) {
+				if (b % 16 == 0) {
+					out << std::endl << "\t\t";
+				}
+				snprintf(hex, sizeof(hex), "0x%02x,", (unsigned char)bytes[b]);
+				out << hex;
+			}
+			// Arrays cannot be empty; the size below excludes this.
+			out << std::endl << "\t\t0x00" << std::endl << "\t};" << std::endl;
+		}
+		out << std::endl << "\tconstexpr EmbeddedResource EMBEDDED_RESOURCES[] = {" << std::endl;
+		for (size_t i = 0; i < names.size(); i++) {
+			out << "\t\t{ \"" << key(names[i]) << "\", EMBEDDED_" << i << ", " << contents[i].size() << " }," << std::endl;
+		}
+		out << "\t\t{ nullptr, nullptr, 0 }" << std::endl << "\t};" << std::endl;
+		out << "}" << std::endl;
+		return out.str();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		usage();
+		return 1;
+	}
+	std::string listPath = argv[1];
+	std::string outputPath = argv[2];
+
+	std::string list;
+	if (!readFile(listPath, list)) {
+		std::cerr << "Embed: could not read " << listPath << std::endl;
+		return 1;
+	}
+	std::string base = directoryOf(listPath);
+	std::vector<std::string> names, contents;
+	size_t total = 0;
+	std::istringstream lines(list);
+	std::string line;
+	while (std::getline(lines, line)) {
+		std::string name = trim(line);
+		if (name.empty()) {
+			continue;
+		}
+		std::string bytes;
+		if (!readFile(base + name, bytes)) {
+			std::cerr << "Embed: could not read " << base + name << std::endl;
+			return 1;
+		}
+		total += bytes.size();
+		names.push_back(name);
+		contents.push_back(bytes);
+	}
+
+	std::string header = generate(listPath.substr(base.size()), names, contents);
+	std::string existing;
+	if (readFile(outputPath, existing) && existing == header) {
+		std::cout << "Embed: " << outputPath << " is up to date" << std::endl;
+		return 0;
+	}
+	std::ofstream output(outputPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	output << header;
+	output.close();
+	if (!output) {
+		std::cerr << "Embed: could not write " << outputPath << std::endl;
+		return 1;
+	}
+	std::cout << "Embed: " << names.size() << " file(s), " << total << " bytes into " << outputPath << std::endl;
+	return 0;
+}
@@ -0,0 +1,334 @@
+#include "Cave.h"
+#include "OffAxis.h"
+#include "ScreenQuad.h"
+#include "ViewUniforms.h"
+#include "VirtualTexture.h"
+#include "WallTargets.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+namespace {
+	// The walls' clip planes, as the eyes'.
+	const float NEAR_PLANE = 0.01f;
+	const float FAR_PLANE = 1000.0f;
+}
+
+Cave::Cave(const CaveConfig & config)
+	: layers(0), layered(WallTargets::layeredSupported()), kernel(bestOffAxisKernel()), frames(0),
+	reportedVisible(-1), reportedReplans(-1), scheduler(config.budget() * 1e6)
+{
+	// Pools fill in the order the walls are listed; a full one is followed
+	// by another of the same resolution.
+	const int poolWalls = ViewUniforms::MAX_LAYERS / WallTargets::EYES;
+	const std::vector<WallConfig> & configs = config.walls();
+	walls.resize(configs.size());
+	for (size_t i = 0; i < configs.size(); i++) {
+		Wall & wall = walls[i];
+		wall.config = configs[i];
+		wall.quad.reset(new ScreenQuad(wall.config.lowerLeft, wall.config.lowerRight, wall.config.upperLeft));
+		wall.rendered = false;
+		wall.lastRendered = 0;
+		wall.visible = true;
+
+		wall.pool = -1;
+		for (size_t p = 0; p < pools.size(); p++) {
+			const Wall & first = walls[pools[p].walls.front()];
+			if (first.config.width == wall.config.width && first.config.height == wall.config.height
+				&& (int)pools[p].walls.size() < poolWalls) {
+				wall.pool = (int)p;
+				break;
+			}
+		}
+		if (wall.pool < 0) {
+			wall.pool = (int)pools.size();
+			pools.push_back(Pool());
+		}
+		wall.index = (int)pools[wall.pool].walls.size();
+		pools[wall.pool].walls.push_back((int)i);
+	}
+
+	for (size_t p = 0; p < pools.size(); p++) {
+		Pool & pool = pools[p];
+		const WallConfig & size = walls[pool.walls.front()].config;
+		pool.targets.reset(new WallTargets(size.width, size.height, (int)pool.walls.size()));
+		pool.firstLayer = layers;
+		layers += pool.targets->layers();
+		for (size_t w = 0; w < pool.walls.size(); w++) {
+			Wall & wall = walls[pool.walls[w]];
+			wall.quad->setWall(*pool.targets, wall.index);
+		}
+
+		// A layered pool is drawn whole, so it is scheduled as one pass, as
+		// often as its most frequent wall allows and its least frequent
+		// needs.
+		if (layered) {
+			int minInterval = WallScheduler::MAX_INTERVAL, maxInterval = WallScheduler::MAX_INTERVAL;
+			for (size_t w = 0; w < pool.walls.size(); w++) {
+				const WallConfig & wall = walls[pool.walls[w]].config;
+				minInterval = std::min(minInterval, wall.interval);
+				maxInterval = std::min(maxInterval, wall.maxInterval);
+			}
+			pool.pass = scheduler.add(size.width * size.height * pool.targets->layers(), minInterval, maxInterval);
+		}
+		for (size_t w = 0; w < pool.walls.size(); w++) {
+			Wall & wall = walls[pool.walls[w]];
+			wall.pass = layered ? pool.pass
+				: scheduler.add(size.width * size.height * WallTargets::EYES, wall.config.interval, wall.config.maxInterval);
+		}
+	}
+	salience.resize(layered ? pools.size() : walls.size());
+
+	// The batch is in slot order, so each wall's screen goes in twice.
+	std::vector<int> slotWalls(layers);
+	viewers.resize(layers);
+	for (size_t i = 0; i < walls.size(); i++) {
+		const WallConfig & config = walls[i].config;
+		for (int eye = 0; eye < WallTargets::EYES; eye++) {
+			int s = slot(walls[i], eye);
+			slotWalls[s] = (int)i;
+			viewers[s] = config.eyes == WallConfig::EYES_LEFT ? 0
+				: config.eyes == WallConfig::EYES_RIGHT ? 1 : eye;
+		}
+	}
+	for (int s = 0; s < layers; s++) {
+		const WallConfig & config = walls[slotWalls[s]].config;
+		frusta.add(config.lowerLeft, config.lowerRight, config.upperLeft);
+	}
+}
+
+Cave::~Cave()
+{
+}
+
+int Cave::slot(const Wall & wall, int eye) const
+{
+	return pools[wall.pool].firstLayer + WallTargets::layer(wall.index, eye);
+}
+
+bool Cave::scheduled(const Wall & wall, unsigned frame) const
+{
+	// A wall that missed its turn, hidden or moved to another phase, is
+	// drawn on the next frame rather than a whole interval late.
+	return scheduler.turn(wall.pass, frame)
+		|| frame - wall.lastRendered > (unsigned)scheduler.interval(wall.pass);
+}
+
+bool Cave::due(const Wall & wall, unsigned frame) const
+{
+	// A hidden wall is still drawn once, so there is always an image.
+	return !wall.rendered || (wall.visible && scheduled(wall, frame));
+}
+
+void Cave::count(const Wall & wall, unsigned frame, bool drawn)
+{
+	if (drawn) {
+		++lastFrame.drawn;
+	}
+	else if (scheduled(wall, frame)) {
+		++lastFrame.culled;
+	}
+	else {
+		++lastFrame.idle;
+	}
+}
+
+void Cave::cull(const ViewUniforms & views, int eyeSlot)
+{
+	for (size_t i = 0; i < walls.size(); i++) {
+		Wall & wall = walls[i];
+		const WallConfig & config = wall.config;
+		glm::vec3 corners[4] = { config.lowerLeft, config.lowerRight, config.upperLeft,
+			config.lowerRight + config.upperLeft - config.lowerLeft };
+		wall.visible = false;
+		for (int eye = 0; eye < WallTargets::EYES && !wall.visible; eye++) {
+			// In clip space each frustum plane is x, y or z against +-w; the
+			// wall is out of view only when all its corners are outside the
+			// same plane. Walls that only cross a frustum edge pass, which
+			// errs on the side of drawing.
+			glm::vec4 clip[4];
+			for (int c = 0; c < 4; c++) {
+				clip[c] = views.viewProjection(eyeSlot + eye) * glm::vec4(corners[c], 1.0f);
+			}
+			bool outside = false;
+			for (int axis = 0; axis < 3 && !outside; axis++) {
+				for (float side = -1.0f; side <= 1.0f && !outside; side += 2.0f) {
+					int out = 0;
+					for (int c = 0; c < 4; c++) {
+						out += side * clip[c][axis] > clip[c].w ? 1 : 0;
+					}
+					outside = out == 4;
+				}
+			}
+			wall.visible = !outside;
+		}
+	}
+}
+
+void Cave::setViews(ViewUniforms & views, int firstSlot, const glm::vec3 eyes[2]) const
+{
+	for (int i = 0; i < layers; i++) {
+		frusta.setEye(i, eyes[viewers[i]]);
+	}
+	frusta.project(kernel);
+	for (int i = 0; i < layers; i++) {
+		views.set(firstSlot + i, frusta.projection(i, NEAR_PLANE, FAR_PLANE), frusta.pose(i));
+	}
+}
+
+void Cave::schedule(const glm::vec3 & head, const glm::vec3 & gaze)
+{
+	// The solid angle, in steradians, from which a wall is worth every
+	// frame, and the share of that a wall at right angles to the gaze
+	// keeps.
+	const float fullRateSolidAngle = 0.5f;
+	const float peripheralShare = 1.0f / 3.0f;
+
+	std::fill(salience.begin(), salience.end(), 0.0f);
+	for (size_t i = 0; i < walls.size(); i++) {
+		const Wall & wall = walls[i];
+		if (!wall.visible) {
+			continue;
+		}
+		const OffAxisScreen & screen = frusta.screen(slot(wall, 0));
+		glm::vec3 toCenter = screen.lowerLeft + 0.5f * (screen.width * screen.right + screen.height * screen.up) - head;
+		float distance = glm::length(toCenter);
+		glm::vec3 direction = toCenter / distance;
+		// Seen at a grazing angle the wall covers less of the view, which
+		// its solid angle takes into account.
+		float solidAngle = screen.width * screen.height * fabsf(glm::dot(screen.normal, direction)) / (distance * distance);
+		float size = std::min(1.0f, solidAngle / fullRateSolidAngle);
+		float central = std::max(0.0f, glm::dot(gaze, direction));
+		float wallSalience = size * (peripheralShare + (1.0f - peripheralShare) * central);
+		// Visible walls always take some share.
+		salience[wall.pass] = std::max(salience[wall.pass], std::max(wallSalience, 0.01f));
+	}
+	for (size_t p = 0; p < salience.size(); p++) {
+		scheduler.setSalience((int)p, salience[p]);
+	}
+	scheduler.plan();
+}
+
+void Cave::residencyViews(int eye, std::vector<VirtualTextureView> & views) const
+{
+	views.clear();
+	for (size_t i = 0; i < walls.size(); i++) {
+		const Wall & wall = walls[i];
+		if (!wall.visible) {
+			continue;
+		}
+		// The frustum's extents at unit distance, back out of the terms
+		// glm::frustum puts them in.
+		int s = slot(wall, eye);
+		glm::mat4 projection = frusta.projection(s, NEAR_PLANE, FAR_PLANE);
+		VirtualTextureView view;
+		view.orientation = glm::mat3(frusta.pose(s));
+		view.tanLeft = (1.0f - projection[2][0]) / projection[0][0];
+		view.tanRight = (1.0f + projection[2][0]) / projection[0][0];
+		view.tanDown = (1.0f - projection[2][1]) / projection[1][1];
+		view.tanUp = (1.0f + projection[2][1]) / projection[1][1];
+		view.width = wall.config.width;
+		view.height = wall.config.height;
+		views.push_back(view);
+	}
+}
+
+void Cave::render(ViewUniforms & views, int firstSlot, unsigned frame, const std::function<void(int, int)> & renderScene)
+{
+	lastFrame = PassCounts();
+	for (size_t p = 0; p < pools.size(); p++) {
+		const Pool & pool = pools[p];
+		if (layered) {
+			// Every layer is drawn together, so the pool is redrawn when any
+			// of its walls is due.
+			bool poolDue = false;
+			for (size_t w = 0; w < pool.walls.size(); w++) {
+				poolDue = poolDue || due(walls[pool.walls[w]], frame);
+			}
+			for (size_t w = 0; w < pool.walls.size(); w++) {
+				count(walls[pool.walls[w]], frame, poolDue);
+			}
+			if (!poolDue) {
+				continue;
+			}
+			pool.targets->bindLayered();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			views.bindLayers(firstSlot + pool.firstLayer, pool.targets->layers());
+			for (int eye = 0; eye < WallTargets::EYES; eye++) {
+				renderScene(pool.targets->layers(), eye);
+			}
+			for (size_t w = 0; w < pool.walls.size(); w++) {
+				walls[pool.walls[w]].rendered = true;
+				walls[pool.walls[w]].lastRendered = frame;
+			}
+			continue;
+		}
+
+		for (size_t w = 0; w < pool.walls.size(); w++) {
+			Wall & wall = walls[pool.walls[w]];
+			bool wallDue = due(wall, frame);
+			count(wall, frame, wallDue);
+			if (!wallDue) {
+				continue;
+			}
+			for (int eye = 0; eye < WallTargets::EYES; eye++) {
+				pool.targets->bindLayer(WallTargets::layer(wall.index, eye));
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				views.bind(firstSlot + slot(wall, eye));
+				renderScene(1, eye);
+			}
+			wall.rendered = true;
+			wall.lastRendered = frame;
+		}
+	}
+	total.drawn += lastFrame.drawn;
+	total.culled += lastFrame.culled;
+	total.idle += lastFrame.idle;
+	++frames;
+}
+
+void Cave::draw(ShaderVariants & shaders, int view, unsigned stereo)
+{
+	for (size_t i = 0; i < walls.size(); i++) {
+		walls[i].quad->draw(shaders, view, stereo);
+	}
+}
+
+void Cave::endFrame(std::ostream & out)
+{
+	// Between changes the counts only cycle through the walls' phases, so
+	// they are printed when a wall goes in or out of view or the intervals
+	// are replanned rather than every frame.
+	int visible = 0;
+	for (size_t i = 0; i < walls.size(); i++) {
+		visible += walls[i].visible ? 1 : 0;
+	}
+	if (visible == reportedVisible && scheduler.replans() == reportedReplans) {
+		return;
+	}
+	out << "Cave: frame " << frames << ", " << visible << " walls in view, wall passes drawn " << lastFrame.drawn
+		<< ", skipped out of view " << lastFrame.culled << ", skipped between updates " << lastFrame.idle << std::endl;
+	reportedVisible = visible;
+	reportedReplans = scheduler.replans();
+}
+
+void Cave::report(std::ostream & out) const
+{
+	out << "Cave: " << walls.size() << " walls in " << pools.size() << " render target pools, "
+		<< layers << " layers, " << (layered ? "each pool drawn in one pass" : "drawn a layer at a time") << std::endl;
+	out << "Cave: off-axis projections batched with the " << offAxisKernelName(kernel) << " kernel" << std::endl;
+	out << "Cave: update intervals";
+	for (size_t i = 0; i < walls.size(); i++) {
+		out << (i == 0 ? " " : ", ") << walls[i].config.name << " " << scheduler.interval(walls[i].pass);
+	}
+	out << "; " << scheduler.plannedPixels() / 1e6 << " megapixels a frame planned";
+	if (scheduler.budget() > 0.0) {
+		out << " of a " << scheduler.budget() / 1e6 << " budget";
+	}
+	out << ", " << scheduler.replans() << " replans" << std::endl;
+	if (frames > 0) {
+		out << "Cave: " << frames << " frames, wall passes drawn " << total.drawn << ", skipped out of view "
+			<< total.culled << ", skipped between updates " << total.idle << std::endl;
+	}
+}
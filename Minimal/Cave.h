@@ -0,0 +1,124 @@
+#ifndef _CAVE_H_
+#define _CAVE_H_
+
+#include <glm\glm.hpp>
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "CaveConfig.h"
+#include "OffAxis.h"
+#include "WallScheduler.h"
+
+class ScreenQuad;
+class ShaderVariants;
+class ViewUniforms;
+class WallTargets;
+struct VirtualTextureView;
+
+// The simulated CAVE, built from its config: a quad per wall, showing an
+// image rendered with the wall's off-axis projection for each eye. Walls
+// of the same resolution share a WallTargets array, up to as many as one
+// layered pass can draw, so the wall pass costs a submission per pool
+// rather than per wall.
+class Cave
+{
+public:
+	explicit Cave(const CaveConfig & config);
+	~Cave();
+
+	// ViewUniforms slots the walls take, one per layer.
+	int slots() const { return layers; }
+	// Sets each wall layer's view, from slot firstSlot on, for the eyes at
+	// eyes (left, right) in tracking space.
+	void setViews(ViewUniforms & views, int firstSlot, const glm::vec3 eyes[2]) const;
+	// Marks the walls neither eye can see, from the views in slots eyeSlot
+	// (left) and eyeSlot + 1 (right), which must already be set this frame.
+	// A hidden wall keeps its last image until it comes into view again.
+	void cull(const ViewUniforms & views, int eyeSlot);
+	// Sets how often each wall is redrawn from how much of the view it
+	// fills and how far from the gaze it is, seen from head looking along
+	// gaze (a unit vector), within the config's budget. Call after cull().
+	void schedule(const glm::vec3 & head, const glm::vec3 & gaze);
+	// The views eye's layers of the visible walls are drawn with, as of the
+	// last setViews(), for paging in virtual textures; replaces views.
+	void residencyViews(int eye, std::vector<VirtualTextureView> & views) const;
+	// The wall pass: the walls whose turn it is on frame draw the scene into
+	// their layers with renderScene, as RiftApp::renderScene, once per eye.
+	void render(ViewUniforms & views, int firstSlot, unsigned frame, const std::function<void(int, int)> & renderScene);
+	// Draws every wall's quad, as ScreenQuad::draw.
+	void draw(ShaderVariants & shaders, int view = 0, unsigned stereo = 0);
+	// Prints what render() did this frame when the walls in view or the
+	// plan have changed since it last did.
+	void endFrame(std::ostream & out);
+	void report(std::ostream & out) const;
+
+private:
+	Cave(const Cave &);
+	Cave & operator=(const Cave &);
+
+	// What render() did with each wall, both eyes counting as one pass.
+	struct PassCounts
+	{
+		PassCounts() : drawn(0), culled(0), idle(0) {}
+
+		int drawn;
+		// Skipped because neither eye could see the wall.
+		int culled;
+		// Skipped because it was not the wall's turn.
+		int idle;
+	};
+
+	struct Pool
+	{
+		std::unique_ptr<WallTargets> targets;
+		// Slot of the pool's first layer, relative to firstSlot.
+		int firstLayer;
+		std::vector<int> walls;
+		// The pool's scheduler pass when it is drawn in one.
+		int pass;
+	};
+
+	struct Wall
+	{
+		WallConfig config;
+		std::unique_ptr<ScreenQuad> quad;
+		int pool;
+		// The wall's place in its pool's targets.
+		int index;
+		bool rendered;
+		unsigned lastRendered;
+		bool visible;
+		// The scheduler pass that redraws the wall, its own or its pool's.
+		int pass;
+	};
+
+	bool scheduled(const Wall & wall, unsigned frame) const;
+	bool due(const Wall & wall, unsigned frame) const;
+	void count(const Wall & wall, unsigned frame, bool drawn);
+	int slot(const Wall & wall, int eye) const;
+
+	std::vector<Pool> pools;
+	std::vector<Wall> walls;
+	int layers;
+	bool layered;
+
+	// setViews' batch, a wall and eye per entry in slot order, and which
+	// eye each is seen from.
+	mutable OffAxisBatch frusta;
+	std::vector<int> viewers;
+	OffAxisKernel kernel;
+
+	PassCounts lastFrame, total;
+	unsigned frames;
+	// The walls in view and replans when endFrame() last printed.
+	int reportedVisible, reportedReplans;
+
+	WallScheduler scheduler;
+	// schedule()'s salience for each pass, the most of any of its walls.
+	std::vector<float> salience;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "CaveConfig.h"
+#include "Resources.h"
+#include "WallScheduler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+
+namespace {
+	std::string uncomment(const std::string & line)
+	{
+		return line.substr(0, line.find('#'));
+	}
+
+	bool readCorner(std::istringstream & values, glm::vec3 & corner)
+	{
+		return (bool)(values >> corner.x >> corner.y >> corner.z);
+	}
+
+	bool readInterval(std::istringstream & values, int & interval)
+	{
+		return (bool)(values >> interval) && interval > 0 && interval <= WallScheduler::MAX_INTERVAL;
+	}
+
+	WallConfig newWall(const std::string & name)
+	{
+		WallConfig wall;
+		wall.name = name;
+		wall.width = 1024;
+		wall.height = 768;
+		wall.eyes = WallConfig::EYES_BOTH;
+		wall.interval = 1;
+		// Down to 30 frames a second on a 90 Hz headset.
+		wall.maxInterval = 3;
+		return wall;
+	}
+
+	enum { LOWER_LEFT = 1, LOWER_RIGHT = 2, UPPER_LEFT = 4, ALL_CORNERS = 7 };
+
+	// A wall's edges must be at least a millimetre long, and within about
+	// a twentieth of a degree of a right angle.
+	const float MIN_EDGE = 0.001f;
+	const float MAX_COSINE = 0.001f;
+}
+
+bool CaveConfig::load(const char* path)
+{
+	walls_.clear();
+	budget_ = 0.0f;
+	std::string contents;
+	if (!Resources::read(path, contents)) {
+		std::cerr << "CaveConfig: could not read " << Resources::diskPath(path) << std::endl;
+		return false;
+	}
+
+	std::istringstream lines(contents);
+	std::string line;
+	int number = 0;
+	// The corners given for each wall, which has to have all three.
+	std::vector<int> corners;
+	while (std::getline(lines, line)) {
+		number++;
+		std::istringstream values(uncomment(line));
+		std::string key;
+		if (!(values >> key)) {
+			continue;
+		}
+
+		bool valid = true;
+		if (key == "wall") {
+			std::string name;
+			valid = (bool)(values >> name);
+			if (valid) {
+				walls_.push_back(newWall(name));
+				corners.push_back(0);
+			}
+		}
+		else if (walls_.empty()) {
+			if (key == "budget") {
+				valid = (bool)(values >> budget_) && budget_ >= 0.0f;
+			}
+			else {
+				std::cerr << "CaveConfig: " << path << ":" << number << ": " << key << " before the first wall" << std::endl;
+				return false;
+			}
+		}
+		else {
+			WallConfig & wall = walls_.back();
+			if (key == "lowerLeft") {
+				valid = readCorner(values, wall.lowerLeft);
+				corners.back() |= LOWER_LEFT;
+			}
+			else if (key == "lowerRight") {
+				valid = readCorner(values, wall.lowerRight);
+				corners.back() |= LOWER_RIGHT;
+			}
+			else if (key == "upperLeft") {
+				valid = readCorner(values, wall.upperLeft);
+				corners.back() |= UPPER_LEFT;
+			}
+			else if (key == "resolution") {
+				valid = (bool)(values >> wall.width >> wall.height) && wall.width > 0 && wall.height > 0;
+			}
+			else if (key == "eyes") {
+				std::string eyes;
+				values >> eyes;
+				valid = eyes == "both" || eyes == "left" || eyes == "right";
+				wall.eyes = eyes == "left" ? WallConfig::EYES_LEFT
+					: eyes == "right" ? WallConfig::EYES_RIGHT : WallConfig::EYES_BOTH;
+			}
+			else if (key == "interval") {
+				valid = readInterval(values, wall.interval);
+			}
+			else if (key == "maxInterval") {
+				valid = readInterval(values, wall.maxInterval);
+			}
+			else {
+				std::cerr << "CaveConfig: " << path << ":" << number << ": unknown key " << key << std::endl;
+				return false;
+			}
+		}
+		if (!valid) {
+			std::cerr << "CaveConfig: " << path << ":" << number << ": bad value for " << key << std::endl;
+			return false;
+		}
+	}
+
+	if (walls_.empty()) {
+		std::cerr << "CaveConfig: " << path << " has no walls" << std::endl;
+		return false;
+	}
+	for (size_t i = 0; i < walls_.size(); i++) {
+		if (corners[i] != ALL_CORNERS) {
+			std::cerr << "CaveConfig: wall " << walls_[i].name << " is missing a corner" << std::endl;
+			return false;
+		}
+		// The off-axis projection divides by the edges' lengths and assumes
+		// a rectangle.
+		glm::vec3 right = walls_[i].lowerRight - walls_[i].lowerLeft;
+		glm::vec3 up = walls_[i].upperLeft - walls_[i].lowerLeft;
+		float width = glm::length(right), height = glm::length(up);
+		if (width < MIN_EDGE || height < MIN_EDGE) {
+			std::cerr << "CaveConfig: wall " << walls_[i].name << " has coincident corners" << std::endl;
+			return false;
+		}
+		if (fabsf(glm::dot(right, up)) > MAX_COSINE * width * height) {
+			std::cerr << "CaveConfig: wall " << walls_[i].name << " is not a rectangle, its edges from lowerLeft "
+				<< "are not at right angles" << std::endl;
+			return false;
+		}
+		// A fixed interval above the default most is taken as both.
+		walls_[i].maxInterval = std::max(walls_[i].maxInterval, walls_[i].interval);
+	}
+	return true;
+}
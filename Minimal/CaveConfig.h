@@ -0,0 +1,45 @@
+#ifndef _CAVE_CONFIG_H_
+#define _CAVE_CONFIG_H_
+
+#include <glm\glm.hpp>
+
+#include <string>
+#include <vector>
+
+// One wall of the CAVE as described in its config file.
+struct WallConfig
+{
+	enum Eyes { EYES_BOTH, EYES_LEFT, EYES_RIGHT };
+
+	std::string name;
+	// In metres in tracking space, as seen from inside the CAVE.
+	glm::vec3 lowerLeft, lowerRight, upperLeft;
+	int width, height;
+	// Whose view the wall shows; a wall for one eye shows it to both.
+	Eyes eyes;
+	// Fewest and most frames between renders of the wall's image; 1 is
+	// every frame. WallScheduler picks within them.
+	int interval, maxInterval;
+};
+
+// The CAVE description (see cave.txt): settings for the whole CAVE, then
+// a block per wall, started by a "wall <name>" line and followed by "key
+// values" lines. Anything after a '#' is a comment. Read through
+// Resources, so a default can be embedded.
+class CaveConfig
+{
+public:
+	// False, with the reason on std::cerr, if the file cannot be read or
+	// has a mistake in it.
+	bool load(const char* path);
+	const std::vector<WallConfig> & walls() const { return walls_; }
+	// Megapixels the wall passes may draw a frame on average; 0 for no
+	// limit.
+	float budget() const { return budget_; }
+
+private:
+	std::vector<WallConfig> walls_;
+	float budget_;
+};
+
+#endif
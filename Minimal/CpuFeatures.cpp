@@ -0,0 +1,65 @@
+#include "CpuFeatures.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace {
+
+	void cpuid(int leaf, unsigned int regs[4])
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, leaf, 0);
+		for (int i = 0; i < 4; i++) {
+			regs[i] = (unsigned int)info[i];
+		}
+#else
+		__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	}
+
+	unsigned long long xgetbv0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+
+	CpuFeatures detect()
+	{
+		CpuFeatures features = {};
+		unsigned int regs[4];
+		cpuid(0, regs);
+		unsigned int maxLeaf = regs[0];
+		if (maxLeaf < 1) {
+			return features;
+		}
+
+		cpuid(1, regs);
+		features.sse2 = (regs[3] & (1u << 26)) != 0;
+		features.ssse3 = (regs[2] & (1u << 9)) != 0;
+		features.sse41 = (regs[2] & (1u << 19)) != 0;
+		bool osxsave = (regs[2] & (1u << 27)) != 0;
+		bool ymmSaved = osxsave && (xgetbv0() & 6) == 6;
+		features.avx = ymmSaved && (regs[2] & (1u << 28)) != 0;
+		features.fma = features.avx && (regs[2] & (1u << 12)) != 0;
+		if (features.avx && maxLeaf >= 7) {
+			cpuid(7, regs);
+			features.avx2 = (regs[1] & (1u << 5)) != 0;
+		}
+		return features;
+	}
+}
+
+const CpuFeatures & CpuFeatures::get()
+{
+	static const CpuFeatures features = detect();
+	return features;
+}
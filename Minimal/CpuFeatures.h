@@ -0,0 +1,32 @@
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+// Instruction set extensions the SIMD kernels dispatch on. AVX and AVX2
+// are only reported when the OS also saves the YMM registers.
+struct CpuFeatures
+{
+	bool sse2;
+	bool ssse3;
+	bool sse41;
+	bool avx;
+	bool avx2;
+	bool fma;
+
+	static const CpuFeatures & get();
+};
+
+// GCC and Clang only emit instructions beyond the baseline inside functions
+// marked for them; MSVC accepts the intrinsics anywhere.
+#ifdef _MSC_VER
+#define CPU_TARGET_SSSE3
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX2_FMA
+#else
+#define CPU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#define CPU_TARGET_AVX2_FMA __attribute__((target("avx2,fma")))
+#endif
+
+#endif
@@ -0,0 +1,217 @@
+#include "CubeMapFile.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+
+namespace {
+	// Image data starts on this boundary so it can be DMA'd straight out
+	// of the mapping.
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	// Larger than any driver's cube map limit, and small enough that an
+	// image's byte count cannot overflow.
+	const uint32_t MAX_SIZE = 65536;
+}
+
+bool CubeMapFile::open(const char* filename)
+{
+	close();
+	if (!file.open(filename)) {
+		std::cerr << "error reading cube map file, could not locate " << filename << std::endl;
+		return false;
+	}
+
+	header_ = (const CubeMapFileHeader*)file.data();
+	if (file.size() < sizeof(CubeMapFileHeader) || memcmp(header_->magic, CUBE_MAP_FILE_MAGIC, 4) != 0
+		|| header_->version != CUBE_MAP_FILE_VERSION) {
+		std::cerr << "error parsing cube map file, " << filename << " is not a version "
+			<< CUBE_MAP_FILE_VERSION << " .cube file" << std::endl;
+		close();
+		return false;
+	}
+
+	size_t tableBytes = (size_t)header_->levels * 6 * sizeof(CubeMapFileImage);
+	if (header_->levels == 0 || header_->levels > 32 || file.size() < sizeof(CubeMapFileHeader) + tableBytes) {
+		std::cerr << "error parsing cube map file, bad image table in " << filename << std::endl;
+		close();
+		return false;
+	}
+
+	images_ = (const CubeMapFileImage*)(file.data() + sizeof(CubeMapFileHeader));
+	for (uint32_t i = 0; i < header_->levels * 6; i++) {
+		if (images_[i].offset > file.size() || images_[i].size > file.size() - images_[i].offset) {
+			std::cerr << "error parsing cube map file, incomplete data in " << filename << std::endl;
+			close();
+			return false;
+		}
+	}
+
+	// The uploads hand each image to the driver by its dimensions, so one
+	// smaller than they say would be read past.
+	if (header_->width == 0 || header_->height == 0 || header_->width > MAX_SIZE || header_->height > MAX_SIZE) {
+		std::cerr << "error parsing cube map file, bad face size in " << filename << std::endl;
+		close();
+		return false;
+	}
+	for (int level = 0; level < levels(); level++) {
+		size_t expected = imageBytes(header_->internalFormat, header_->format, header_->type, compressed(),
+			width(level), height(level), (int)header_->unpackAlignment);
+		for (int face = 0; face < 6; face++) {
+			if (expected == 0 || size(face, level) != expected) {
+				std::cerr << "error parsing cube map file, level " << level << " face " << face << " of " << filename
+					<< " is " << size(face, level) << " bytes rather than " << expected << std::endl;
+				close();
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void CubeMapFile::close()
+{
+	file.close();
+	header_ = nullptr;
+	images_ = nullptr;
+}
+
+void CubeMapFile::prefetch() const
+{
+	if (header_ != nullptr) {
+		file.prefetch(0, file.size());
+	}
+}
+
+int CubeMapFile::width(int level) const
+{
+	return std::max(1, (int)header_->width >> level);
+}
+
+int CubeMapFile::height(int level) const
+{
+	return std::max(1, (int)header_->height >> level);
+}
+
+const unsigned char* CubeMapFile::data(int face, int level) const
+{
+	return file.data() + images_[level * 6 + face].offset;
+}
+
+size_t CubeMapFile::size(int face, int level) const
+{
+	return (size_t)images_[level * 6 + face].size;
+}
+
+size_t CubeMapFile::byteCount() const
+{
+	size_t total = 0;
+	for (uint32_t i = 0; i < header_->levels * 6; i++) {
+		total += (size_t)images_[i].size;
+	}
+	return total;
+}
+
+GLenum CubeMapFile::srgbInternalFormat(GLenum internalFormat)
+{
+	switch (internalFormat) {
+	case GL_RGB8:
+		return GL_SRGB8;
+	case GL_RGBA8:
+		return GL_SRGB8_ALPHA8;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	case GL_COMPRESSED_RGB8_ETC2:
+		return GL_COMPRESSED_SRGB8_ETC2;
+	default:
+		// 16-bit formats have no sRGB variant.
+		return internalFormat;
+	}
+}
+
+size_t CubeMapFile::imageBytes(GLenum internalFormat, GLenum format, GLenum type, bool compressed,
+	int width, int height, int unpackAlignment)
+{
+	if (compressed) {
+		size_t blockBytes = internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM ? 16
+			: internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_RGB8_ETC2 ? 8 : 0;
+		return blockBytes * ((width + 3) / 4) * ((height + 3) / 4);
+	}
+	size_t channels = format == GL_RGBA ? 4 : format == GL_RGB ? 3 : 0;
+	size_t channelBytes = type == GL_UNSIGNED_SHORT ? 2 : type == GL_UNSIGNED_BYTE ? 1 : 0;
+	if (unpackAlignment != 1 && unpackAlignment != 2 && unpackAlignment != 4 && unpackAlignment != 8) {
+		return 0;
+	}
+	size_t rowBytes = (width * channels * channelBytes + unpackAlignment - 1) / unpackAlignment * unpackAlignment;
+	return rowBytes * height;
+}
+
+bool CubeMapFile::needsSrgbDecode(GLenum internalFormat)
+{
+	return internalFormat == GL_RGB16 || internalFormat == GL_RGBA16;
+}
+
+bool CubeMapFile::write(const char* filename, const CubeMapFileHeader & header,
+	const std::vector<std::vector<unsigned char>> & images)
+{
+	std::vector<const std::vector<unsigned char>*> pointers;
+	for (const auto & image : images) {
+		pointers.push_back(&image);
+	}
+	return write(filename, header, pointers);
+}
+
+bool CubeMapFile::write(const char* filename, const CubeMapFileHeader & header,
+	const std::vector<const std::vector<unsigned char>*> & images)
+{
+	if (images.size() != header.levels * 6) {
+		std::cerr << "error writing cube map file, expected " << header.levels * 6 << " images" << std::endl;
+		return false;
+	}
+
+	std::vector<CubeMapFileImage> table(images.size());
+	uint64_t offset = sizeof(CubeMapFileHeader) + table.size() * sizeof(CubeMapFileImage);
+	for (size_t i = 0; i < images.size(); i++) {
+		offset = (offset + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+		table[i].offset = offset;
+		table[i].size = images[i]->size();
+		offset += images[i]->size();
+	}
+
+	std::string temporary = std::string(filename) + ".tmp";
+	FILE* fp = fopen(temporary.c_str(), "wb");
+	if (fp == NULL) {
+		std::cerr << "error writing cube map file, could not create " << temporary << std::endl;
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(&table[0], sizeof(CubeMapFileImage), table.size(), fp) == table.size();
+	uint64_t written = sizeof(CubeMapFileHeader) + table.size() * sizeof(CubeMapFileImage);
+	static const unsigned char padding[DATA_ALIGNMENT] = { 0 };
+	for (size_t i = 0; ok && i < images.size(); i++) {
+		const std::vector<unsigned char> & image = *images[i];
+		ok = fwrite(padding, 1, (size_t)(table[i].offset - written), fp) == table[i].offset - written
+			&& (image.empty() || fwrite(&image[0], 1, image.size(), fp) == image.size());
+		written = table[i].offset + table[i].size;
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		std::cerr << "error writing cube map file, short write to " << temporary << std::endl;
+		remove(temporary.c_str());
+		return false;
+	}
+
+	// rename does not replace an existing file on Windows.
+	remove(filename);
+	if (rename(temporary.c_str(), filename) != 0) {
+		std::cerr << "error writing cube map file, could not rename " << temporary << " to " << filename << std::endl;
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,84 @@
+#ifndef _CUBE_MAP_FILE_H_
+#define _CUBE_MAP_FILE_H_
+
+#include <GL\glew.h>
+
+#include <stdint.h>
+#include <vector>
+
+#include "MappedFile.h"
+
+// Pre-baked cube map container (.cube). A fixed header is followed by a
+// table of (offset, size) pairs, one per face per mip level, ordered level
+// by level with faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order. Pixel data is
+// stored exactly as glTexImage2D (or glCompressedTexImage2D) expects it, so
+// a mapped file can be uploaded without touching the pixels.
+#define CUBE_MAP_FILE_MAGIC "CUBE"
+#define CUBE_MAP_FILE_VERSION 1
+#define CUBE_MAP_FILE_COMPRESSED 0x1
+
+struct CubeMapFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t internalFormat;
+	uint32_t format;			// 0 for compressed formats
+	uint32_t type;				// 0 for compressed formats
+	uint32_t width, height;		// level 0 face size
+	uint32_t levels;
+	uint32_t unpackAlignment;
+	uint32_t flags;
+	uint32_t reserved[6];
+};
+
+struct CubeMapFileImage
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+class CubeMapFile
+{
+public:
+	CubeMapFile() : header_(nullptr), images_(nullptr) {}
+	bool open(const char* filename);
+	void close();
+	void prefetch() const;
+
+	const CubeMapFileHeader & header() const { return *header_; }
+	int levels() const { return (int)header_->levels; }
+	int width(int level) const;
+	int height(int level) const;
+	bool compressed() const { return (header_->flags & CUBE_MAP_FILE_COMPRESSED) != 0; }
+	const unsigned char* data(int face, int level) const;
+	size_t size(int face, int level) const;
+	size_t byteCount() const;
+
+	// images holds levels * 6 entries in file order; every face of a level
+	// must have the same size. The file is written under a temporary name
+	// and renamed into place, so a write cut short never leaves a truncated
+	// filename behind.
+	static bool write(const char* filename, const CubeMapFileHeader & header,
+		const std::vector<std::vector<unsigned char>> & images);
+	// The same, for images held elsewhere.
+	static bool write(const char* filename, const CubeMapFileHeader & header,
+		const std::vector<const std::vector<unsigned char>*> & images);
+	// Bytes in a width x height image of the format as glTexImage2D reads
+	// it with unpackAlignment, or as glCompressedTexImage2D takes it; 0 for
+	// formats the containers do not hold.
+	static size_t imageBytes(GLenum internalFormat, GLenum format, GLenum type, bool compressed,
+		int width, int height, int unpackAlignment);
+	// Face images hold sRGB-encoded colour. Sampling them through an sRGB
+	// format filters in linear space, and the eye buffers encode on write.
+	static GLenum srgbInternalFormat(GLenum internalFormat);
+	// True for the formats srgbInternalFormat cannot map, whose texels the
+	// shader has to decode itself (SHADER_SRGB_DECODE).
+	static bool needsSrgbDecode(GLenum internalFormat);
+
+private:
+	MappedFile file;
+	const CubeMapFileHeader* header_;
+	const CubeMapFileImage* images_;
+};
+
+#endif
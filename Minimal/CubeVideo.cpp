@@ -0,0 +1,429 @@
+#include "CubeVideo.h"
+#include "CubeMapFile.h"
+#include "PPMImage.h"
+#include "PixelConvert.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+	// Face files of a sequence frame, in GL_TEXTURE_CUBE_MAP_POSITIVE_X
+	// order; the Textures/custom layout SkyBox and CubeBake use.
+	const char* FACE_NAMES[6] = { "left.ppm", "right.ppm", "top.ppm", "bottom.ppm", "back.ppm", "front.ppm" };
+	const char* VIEW_DIRECTORIES[2] = { "L", "R" };
+
+	bool exists(const std::string & path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0;
+	}
+}
+
+CubeVideo::CubeVideo(int ringFrames)
+	: stereoSequence(false), duration(0.0), views(0), width(0), height(0), faceBytes(0), internalFormat(0), format(0),
+	type(0), unpackAlignment(4), compressed(false), ringFrames(ringFrames), persistent(false),
+	clock(-std::numeric_limits<double>::infinity()), stopping(false), started(false), startTime(0.0), presented(-1),
+	presentedCount(0), lateCount(0), skippedCount(0), filledCount(0), fillMillis(0.0), warnedBadFace(false)
+{
+}
+
+CubeVideo::~CubeVideo()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (decoder.joinable()) {
+		decoder.join();
+	}
+
+	for (auto & slot : slots) {
+		if (slot.fence) {
+			glDeleteSync(slot.fence);
+		}
+		if (slot.mapped) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		glDeleteBuffers(1, &slot.buffer);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (GLuint texture : textures) {
+		TextureCache::instance().releaseTexture(texture);
+	}
+}
+
+bool CubeVideo::open(const std::string & base, double framesPerSecond)
+{
+	std::string container = base + ".cubevid";
+	if (exists(container)) {
+		if (!file.open(container.c_str())) {
+			return false;
+		}
+		name = container;
+		const CubeVideoFileHeader & header = file.header();
+		views = file.views();
+		width = (int)header.width;
+		height = (int)header.height;
+		faceBytes = file.faceBytes();
+		compressed = file.compressed();
+		internalFormat = CubeMapFile::srgbInternalFormat(header.internalFormat);
+		format = header.format;
+		type = header.type;
+		unpackAlignment = (GLint)header.unpackAlignment;
+		for (int frame = 0; frame < file.frames(); frame++) {
+			timestamps.push_back(file.timestamp(frame));
+		}
+		// The last frame is held for as long as the one before it.
+		double last = timestamps.size() > 1 ? timestamps.back() - timestamps[timestamps.size() - 2] : 1.0 / framesPerSecond;
+		duration = timestamps.back() + last;
+	}
+	else if (!openSequence(base, framesPerSecond)) {
+		return false;
+	}
+
+	createTextures();
+	createRing();
+	decoder = std::thread(&CubeVideo::decodeLoop, this);
+	std::cout << "CubeVideo " << name << ": " << timestamps.size() << " frames of " << views << " x 6 x " << width
+		<< "x" << height << ", " << duration << " s, " << ringFrames << " x " << faceBytes * views * 6
+		<< " byte frame ring" << (persistent ? " (persistent)" : "") << std::endl;
+	return true;
+}
+
+bool CubeVideo::openSequence(const std::string & directory, double framesPerSecond)
+{
+	sequence = directory;
+	stereoSequence = false;
+	if (!exists(sequenceFace(0, 0, 0))) {
+		stereoSequence = true;
+		if (!exists(sequenceFace(0, 0, 0))) {
+			sequence.clear();
+			return false;
+		}
+	}
+	name = directory;
+	views = stereoSequence ? 2 : 1;
+
+	PPMImage first;
+	if (!first.load(sequenceFace(0, 0, 0).c_str())) {
+		sequence.clear();
+		return false;
+	}
+	width = first.width();
+	height = first.height();
+	faceBytes = (size_t)width * height * 4;
+	compressed = false;
+	internalFormat = GL_SRGB8_ALPHA8;
+	format = GL_RGBA;
+	type = GL_UNSIGNED_BYTE;
+	unpackAlignment = 4;
+
+	int frames = 0;
+	while (exists(sequenceFace(frames, 0, 0))) {
+		timestamps.push_back(frames / framesPerSecond);
+		++frames;
+	}
+	duration = frames / framesPerSecond;
+	return true;
+}
+
+std::string CubeVideo::sequenceFace(int frame, int view, int face) const
+{
+	char path[32];
+	if (stereoSequence) {
+		snprintf(path, sizeof(path), "/%05d/%s/", frame, VIEW_DIRECTORIES[view]);
+	}
+	else {
+		snprintf(path, sizeof(path), "/%05d/", frame);
+	}
+	return sequence + path + FACE_NAMES[face];
+}
+
+void CubeVideo::createTextures()
+{
+	textures.resize(views);
+	for (int view = 0; view < views; view++) {
+		glGenTextures(1, &textures[view]);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textures[view]);
+		for (int face = 0; face < 6; face++) {
+			if (compressed) {
+				glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, internalFormat, width, height, 0,
+					(GLsizei)faceBytes, nullptr);
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, internalFormat, width, height, 0, format, type,
+					nullptr);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+		// Rewritten every frame, so there is nothing to reload after an
+		// eviction.
+		TextureCache::instance().adoptTexture(textures[view], GL_TEXTURE_CUBE_MAP, faceBytes * 6, true);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void CubeVideo::createRing()
+{
+	const GLbitfield persistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	size_t frameBytes = faceBytes * views * 6;
+
+	persistent = GLEW_ARB_buffer_storage != 0;
+	slots.resize(ringFrames);
+	for (int i = 0; i < ringFrames; i++) {
+		Slot & slot = slots[i];
+		slot.fence = 0;
+		slot.mapped = nullptr;
+		slot.frame = -1;
+		slot.time = 0.0;
+		glGenBuffers(1, &slot.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		if (persistent) {
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, frameBytes, nullptr, persistentFlags);
+			slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frameBytes, persistentFlags);
+		}
+		else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, frameBytes, nullptr, GL_STREAM_DRAW);
+			mapSlot(slot);
+		}
+		freeSlots.push_back(i);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void CubeVideo::mapSlot(Slot & slot)
+{
+	// Only reached once the slot's fence has signalled.
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+	slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, faceBytes * views * 6,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+double CubeVideo::endTime(int frame, int loop) const
+{
+	double end = frame + 1 < (int)timestamps.size() ? timestamps[frame + 1] : duration;
+	return end + loop * duration;
+}
+
+void CubeVideo::decodeLoop()
+{
+	int frame = 0, loop = 0;
+	for (;;) {
+		int slot;
+		double now;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !freeSlots.empty(); });
+			if (stopping) {
+				return;
+			}
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+			now = clock;
+		}
+
+		// A frame the display has already moved past is not worth filling.
+		int skipped = 0;
+		if (now - (timestamps[frame] + loop * duration) > duration) {
+			int behind = (int)floor((now - (timestamps[frame] + loop * duration)) / duration);
+			loop += behind;
+			skipped += behind * (int)timestamps.size();
+		}
+		while (endTime(frame, loop) <= now) {
+			++skipped;
+			if (++frame == (int)timestamps.size()) {
+				frame = 0;
+				++loop;
+			}
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		fill(slots[slot], frame);
+		double millis = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots[slot].frame = frame;
+			slots[slot].time = timestamps[frame] + loop * duration;
+			ready.push_back(slot);
+			skippedCount += skipped;
+			++filledCount;
+			fillMillis += millis;
+		}
+		if (++frame == (int)timestamps.size()) {
+			frame = 0;
+			++loop;
+		}
+	}
+}
+
+void CubeVideo::fill(Slot & slot, int frame)
+{
+	// Faces are independent, so they are copied or decoded in parallel;
+	// a single thread cannot keep up with large faces at display rate.
+	std::vector<std::future<bool>> faces;
+	for (int view = 0; view < views; view++) {
+		for (int face = 0; face < 6; face++) {
+			unsigned char* dst = slot.mapped + ((size_t)view * 6 + face) * faceBytes;
+			if (sequence.empty()) {
+				const unsigned char* src = file.data(frame, view, face);
+				size_t bytes = faceBytes;
+				faces.push_back(ThreadPool::shared().submit([src, dst, bytes] {
+					memcpy(dst, src, bytes);
+					return true;
+				}));
+			}
+			else {
+				std::string path = sequenceFace(frame, view, face);
+				int w = width, h = height;
+				faces.push_back(ThreadPool::shared().submit([path, dst, w, h] {
+					PPMImage image;
+					if (!image.load(path.c_str()) || image.width() != w || image.height() != h) {
+						memset(dst, 0, (size_t)w * h * 4);
+						return false;
+					}
+					convertToRGBA8(image.pixels(), image.type(), dst, (size_t)w * h);
+					return true;
+				}));
+			}
+		}
+	}
+	bool complete = true;
+	for (auto & face : faces) {
+		complete = face.get() && complete;
+	}
+	if (!complete && !warnedBadFace) {
+		std::cerr << "CubeVideo " << name << ": frame " << frame << " has missing or mismatched faces, drawn black"
+			<< std::endl;
+		warnedBadFace = true;
+	}
+}
+
+void CubeVideo::recycleSlots()
+{
+	std::vector<int> signalled;
+	for (auto i = fencedSlots.begin(); i != fencedSlots.end();) {
+		Slot & slot = slots[*i];
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			if (!persistent) {
+				mapSlot(slot);
+			}
+			signalled.push_back(*i);
+			i = fencedSlots.erase(i);
+		}
+		else {
+			++i;
+		}
+	}
+
+	if (!signalled.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			freeSlots.insert(freeSlots.end(), signalled.begin(), signalled.end());
+		}
+		wake.notify_all();
+	}
+}
+
+bool CubeVideo::needsSrgbDecode() const
+{
+	return CubeMapFile::needsSrgbDecode(internalFormat);
+}
+
+void CubeVideo::update(double displayTime)
+{
+	if (slots.empty()) {
+		return;
+	}
+	recycleSlots();
+
+	int chosen = -1;
+	std::vector<int> late;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!started) {
+			// The clock starts with whatever frame is filled first, so a
+			// slow start does not begin by dropping frames.
+			if (ready.empty()) {
+				return;
+			}
+			startTime = displayTime - slots[ready.front()].time;
+			started = true;
+		}
+		clock = displayTime - startTime;
+
+		// Frames come out of the ring in presentation order; every one that
+		// is due but superseded by a later due one is dropped unseen.
+		while (!ready.empty() && slots[ready.front()].time <= clock) {
+			if (chosen >= 0) {
+				late.push_back(chosen);
+			}
+			chosen = ready.front();
+			ready.pop_front();
+		}
+		freeSlots.insert(freeSlots.end(), late.begin(), late.end());
+	}
+	if (!late.empty()) {
+		wake.notify_all();
+		lateCount += (int)late.size();
+	}
+	if (chosen >= 0) {
+		upload(slots[chosen]);
+		fencedSlots.push_back(chosen);
+	}
+}
+
+void CubeVideo::upload(Slot & slot)
+{
+	bool looped = slot.frame < presented;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+	if (!persistent) {
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		slot.mapped = nullptr;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+	for (int view = 0; view < views; view++) {
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textures[view]);
+		for (int face = 0; face < 6; face++) {
+			const GLvoid* offset = (const GLvoid*)(((size_t)view * 6 + face) * faceBytes);
+			if (compressed) {
+				glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, width, height, internalFormat,
+					(GLsizei)faceBytes, offset);
+			}
+			else {
+				glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, width, height, format, type, offset);
+			}
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	presented = slot.frame;
+	++presentedCount;
+
+	if (looped) {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::cout << "CubeVideo " << name << ": " << presentedCount << " frames shown, " << lateCount << " dropped late, "
+			<< skippedCount << " skipped unfilled; fill " << fillMillis / std::max(filledCount, 1) << " ms per frame"
+			<< std::endl;
+	}
+}
@@ -0,0 +1,109 @@
+#ifndef _CUBE_VIDEO_H_
+#define _CUBE_VIDEO_H_
+
+#include <GL\glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CubeVideoFile.h"
+
+// Plays a mono or stereo cube map video into one cube map texture per eye.
+// A decode thread fills whole frames into a ring of pixel buffer objects,
+// either copied out of a mapped .cubevid container or decoded from a
+// sequence of PPM faces, with the faces of a frame spread over the thread
+// pool. update() uploads the newest filled frame that is due by the
+// predicted display time and drops any older ones; the decode thread also
+// skips frames that would be late before it fills them. A slow disk or
+// decoder therefore costs frames, never a stalled render thread.
+class CubeVideo
+{
+public:
+	explicit CubeVideo(int ringFrames = 3);
+	~CubeVideo();
+
+	// GL thread only, once. Opens base + ".cubevid" or, failing that, the
+	// PPM sequence in directory base, played at framesPerSecond: frame n is
+	// base/<n as 5 digits>/ holding left.ppm, right.ppm, top.ppm, bottom.ppm,
+	// back.ppm and front.ppm, or L/ and R/ subdirectories holding them for
+	// stereo. Returns false quietly if neither exists.
+	bool open(const std::string & base, double framesPerSecond = 30.0);
+	// GL thread, once per frame, with the time that frame will be displayed
+	// (ovr_GetPredictedDisplayTime). Playback starts with the first frame to
+	// be filled and loops.
+	void update(double displayTime);
+
+	bool playing() const { return presented >= 0; }
+	// The cube map for an eye; a mono video shows the same one to both.
+	GLuint texture(int view) const { return textures[view < views ? view : 0]; }
+	// Whether the textures need SHADER_SRGB_DECODE.
+	bool needsSrgbDecode() const;
+
+private:
+	CubeVideo(const CubeVideo &);
+	CubeVideo & operator=(const CubeVideo &);
+
+	struct Slot
+	{
+		GLuint buffer;
+		unsigned char* mapped;
+		GLsync fence;
+		int frame;
+		double time;			// presentation time, counting loops
+	};
+
+	bool openSequence(const std::string & directory, double framesPerSecond);
+	std::string sequenceFace(int frame, int view, int face) const;
+	void createTextures();
+	void createRing();
+	void mapSlot(Slot & slot);
+	void decodeLoop();
+	void fill(Slot & slot, int frame);
+	void recycleSlots();
+	void upload(Slot & slot);
+	// When frame, shown in the given loop, is replaced by the next one.
+	double endTime(int frame, int loop) const;
+
+	std::string name;
+	CubeVideoFile file;
+	std::string sequence;		// directory of a PPM sequence, or empty
+	bool stereoSequence;
+	std::vector<double> timestamps;
+	double duration;
+	int views;
+	int width, height;
+	size_t faceBytes;
+	GLenum internalFormat, format, type;
+	GLint unpackAlignment;
+	bool compressed;
+
+	int ringFrames;
+	bool persistent;
+	std::vector<Slot> slots;
+	std::vector<GLuint> textures;
+	std::vector<int> fencedSlots;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<int> freeSlots;
+	std::deque<int> ready;
+	double clock;				// video time last passed to update()
+	bool stopping;
+	std::thread decoder;
+
+	// Render thread only.
+	bool started;
+	double startTime;
+	int presented;
+	int presentedCount, lateCount;
+	// Decode thread, read under the mutex when reporting.
+	int skippedCount, filledCount;
+	double fillMillis;
+	bool warnedBadFace;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "CubeVideoFile.h"
+#include "CubeMapFile.h"
+
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+	// Frames start on a page boundary, so reading one faults in only its
+	// own pages.
+	const uint64_t FRAME_ALIGNMENT = 4096;
+
+	// As CubeMapFile's limit.
+	const uint32_t MAX_SIZE = 65536;
+}
+
+bool CubeVideoFile::open(const char* filename)
+{
+	close();
+	if (!file.open(filename)) {
+		std::cerr << "error reading cube video file, could not locate " << filename << std::endl;
+		return false;
+	}
+
+	const CubeVideoFileHeader* header = (const CubeVideoFileHeader*)file.data();
+	if (file.size() < sizeof(CubeVideoFileHeader) || memcmp(header->magic, CUBE_VIDEO_FILE_MAGIC, 4) != 0
+		|| header->version != CUBE_VIDEO_FILE_VERSION) {
+		std::cerr << "error parsing cube video file, " << filename << " is not a version "
+			<< CUBE_VIDEO_FILE_VERSION << " .cubevid file" << std::endl;
+		close();
+		return false;
+	}
+
+	size_t tableBytes = (size_t)header->frames * sizeof(CubeVideoFileFrame);
+	if (header->frames == 0 || (header->views != 1 && header->views != 2) || header->faceBytes == 0
+		|| file.size() < sizeof(CubeVideoFileHeader) + tableBytes) {
+		std::cerr << "error parsing cube video file, bad frame table in " << filename << std::endl;
+		close();
+		return false;
+	}
+
+	// Frames are handed to the upload by the face dimensions, so a face
+	// smaller than they say would be read past.
+	size_t expected = header->width > 0 && header->height > 0 && header->width <= MAX_SIZE && header->height <= MAX_SIZE
+		? CubeMapFile::imageBytes(header->internalFormat, header->format, header->type,
+			(header->flags & CUBE_VIDEO_FILE_COMPRESSED) != 0, (int)header->width, (int)header->height,
+			(int)header->unpackAlignment)
+		: 0;
+	if (expected == 0 || header->faceBytes != expected) {
+		std::cerr << "error parsing cube video file, " << filename << " has " << header->faceBytes
+			<< " byte faces where its size and format take " << expected << std::endl;
+		close();
+		return false;
+	}
+
+	const CubeVideoFileFrame* frames = (const CubeVideoFileFrame*)(file.data() + sizeof(CubeVideoFileHeader));
+	uint64_t frameBytes = (uint64_t)header->views * 6 * header->faceBytes;
+	for (uint32_t i = 0; i < header->frames; i++) {
+		if (frames[i].offset > file.size() || frameBytes > file.size() - frames[i].offset
+			|| (i > 0 && frames[i].timestamp <= frames[i - 1].timestamp)) {
+			std::cerr << "error parsing cube video file, incomplete data or unordered frames in " << filename << std::endl;
+			close();
+			return false;
+		}
+	}
+	header_ = header;
+	frames_ = frames;
+	return true;
+}
+
+void CubeVideoFile::close()
+{
+	file.close();
+	header_ = nullptr;
+	frames_ = nullptr;
+}
+
+bool CubeVideoFile::write(const char* filename, const CubeVideoFileHeader & header,
+	const std::vector<int64_t> & timestamps, const std::function<bool(int frame, unsigned char* pixels)> & produce)
+{
+	if (timestamps.size() != header.frames) {
+		std::cerr << "error writing cube video file, expected " << header.frames << " timestamps" << std::endl;
+		return false;
+	}
+
+	uint64_t frameBytes = (uint64_t)header.views * 6 * header.faceBytes;
+	std::vector<CubeVideoFileFrame> table(header.frames);
+	uint64_t offset = sizeof(CubeVideoFileHeader) + table.size() * sizeof(CubeVideoFileFrame);
+	for (size_t i = 0; i < table.size(); i++) {
+		offset = (offset + FRAME_ALIGNMENT - 1) & ~(FRAME_ALIGNMENT - 1);
+		table[i].timestamp = timestamps[i];
+		table[i].offset = offset;
+		offset += frameBytes;
+	}
+
+	FILE* fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		std::cerr << "error writing cube video file, could not create " << filename << std::endl;
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(&table[0], sizeof(CubeVideoFileFrame), table.size(), fp) == table.size();
+	uint64_t written = sizeof(CubeVideoFileHeader) + table.size() * sizeof(CubeVideoFileFrame);
+	static const unsigned char padding[FRAME_ALIGNMENT] = { 0 };
+	std::vector<unsigned char> pixels((size_t)frameBytes);
+	for (size_t i = 0; ok && i < table.size(); i++) {
+		ok = produce((int)i, &pixels[0]);
+		if (!ok) {
+			break;
+		}
+		ok = fwrite(padding, 1, (size_t)(table[i].offset - written), fp) == table[i].offset - written
+			&& fwrite(&pixels[0], 1, pixels.size(), fp) == pixels.size();
+		written = table[i].offset + frameBytes;
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		std::cerr << "error writing cube video file, short write to " << filename << std::endl;
+	}
+	return ok;
+}
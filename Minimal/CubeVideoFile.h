@@ -0,0 +1,77 @@
+#ifndef _CUBE_VIDEO_FILE_H_
+#define _CUBE_VIDEO_FILE_H_
+
+#include <GL\glew.h>
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include "MappedFile.h"
+
+// Raw cube map video container (.cubevid). A fixed header is followed by a
+// table with the presentation timestamp and offset of every frame. A frame
+// holds views * 6 face images, the left eye's six faces first for stereo,
+// each in GL_TEXTURE_CUBE_MAP_POSITIVE_X order and exactly faceBytes long.
+// Pixels are stored as in a single level .cube file, so a frame can be
+// copied from the mapping into a pixel buffer and uploaded as it is.
+#define CUBE_VIDEO_FILE_MAGIC "CVID"
+#define CUBE_VIDEO_FILE_VERSION 1
+#define CUBE_VIDEO_FILE_COMPRESSED 0x1
+
+struct CubeVideoFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t internalFormat;
+	uint32_t format;			// 0 for compressed formats
+	uint32_t type;				// 0 for compressed formats
+	uint32_t width, height;		// face size
+	uint32_t views;				// 1 for mono, 2 for stereo
+	uint32_t frames;
+	uint32_t faceBytes;
+	uint32_t unpackAlignment;
+	uint32_t flags;
+	uint32_t reserved[4];
+};
+
+struct CubeVideoFileFrame
+{
+	int64_t timestamp;			// microseconds from the first frame
+	uint64_t offset;
+};
+
+class CubeVideoFile
+{
+public:
+	CubeVideoFile() : header_(nullptr), frames_(nullptr) {}
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return header_ != nullptr; }
+
+	const CubeVideoFileHeader & header() const { return *header_; }
+	int frames() const { return (int)header_->frames; }
+	int views() const { return (int)header_->views; }
+	bool compressed() const { return (header_->flags & CUBE_VIDEO_FILE_COMPRESSED) != 0; }
+	size_t faceBytes() const { return header_->faceBytes; }
+	size_t frameBytes() const { return (size_t)header_->views * 6 * header_->faceBytes; }
+	// Seconds from the first frame.
+	double timestamp(int frame) const { return frames_[frame].timestamp * 1e-6; }
+	const unsigned char* data(int frame, int view, int face) const
+	{
+		return file.data() + frames_[frame].offset + ((size_t)view * 6 + face) * header_->faceBytes;
+	}
+
+	// Writes header.frames frames one at a time: produce fills frameBytes
+	// of pixels for the given frame, so a whole video never has to be held
+	// in memory. timestamps are in microseconds.
+	static bool write(const char* filename, const CubeVideoFileHeader & header, const std::vector<int64_t> & timestamps,
+		const std::function<bool(int frame, unsigned char* pixels)> & produce);
+
+private:
+	MappedFile file;
+	const CubeVideoFileHeader* header_;
+	const CubeVideoFileFrame* frames_;
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+	const char SEPARATOR = '\\';
+
+	struct Directory
+	{
+		std::string path;
+		HANDLE handle;
+		OVERLAPPED overlapped;
+		DWORD buffer[4096];
+	};
+
+	bool startRead(Directory & directory)
+	{
+		return ReadDirectoryChangesW(directory.handle, directory.buffer, sizeof(directory.buffer), FALSE,
+			FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, NULL, &directory.overlapped, NULL) != 0;
+	}
+#else
+	const char SEPARATOR = '/';
+#endif
+}
+
+FileWatcher::FileWatcher(int settleMillis)
+	: settle(settleMillis), stopping(false)
+{
+#ifdef _WIN32
+	wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+#else
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0 || pipe(wakePipe) != 0) {
+		std::cerr << "FileWatcher: could not start inotify, files will not be watched" << std::endl;
+		return;
+	}
+	fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+#endif
+	watcher = std::thread(&FileWatcher::watcherLoop, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+#ifdef _WIN32
+	SetEvent(wakeEvent);
+	if (watcher.joinable()) {
+		watcher.join();
+	}
+	CloseHandle(wakeEvent);
+#else
+	if (watcher.joinable()) {
+		char wake = 0;
+		if (write(wakePipe[1], &wake, 1) != 1) {
+			std::cerr << "FileWatcher: could not wake the watcher thread" << std::endl;
+		}
+		watcher.join();
+		close(wakePipe[0]);
+		close(wakePipe[1]);
+	}
+	if (inotifyFd >= 0) {
+		close(inotifyFd);
+	}
+#endif
+}
+
+void FileWatcher::watch(const std::string & path)
+{
+	size_t slash = path.find_last_of(SEPARATOR);
+	if (slash == std::string::npos) {
+		std::cerr << "FileWatcher: " << path << " is not a canonical path" << std::endl;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		files.insert(path);
+	}
+	noteDirectory(path.substr(0, slash));
+}
+
+std::vector<std::string> FileWatcher::changes()
+{
+	std::vector<std::string> settled;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = pending.begin(); it != pending.end();) {
+		if (now - it->second >= settle) {
+			settled.push_back(it->first);
+			it = pending.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	return settled;
+}
+
+void FileWatcher::noteChange(const std::string & directory, const std::string & name)
+{
+	std::string path = directory + SEPARATOR + name;
+#ifdef _WIN32
+	// Canonical Windows paths are lower case.
+	std::transform(path.begin(), path.end(), path.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+#endif
+	std::lock_guard<std::mutex> lock(mutex);
+	if (files.count(path) != 0) {
+		pending[path] = std::chrono::steady_clock::now();
+	}
+}
+
+#ifdef _WIN32
+
+void FileWatcher::noteDirectory(const std::string & directory)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!directories.insert(directory).second) {
+			return;
+		}
+		newDirectories.push_back(directory);
+	}
+	SetEvent(wakeEvent);
+}
+
+void FileWatcher::watcherLoop()
+{
+	std::vector<std::unique_ptr<Directory>> watched;
+	for (;;) {
+		std::vector<HANDLE> events(1, (HANDLE)wakeEvent);
+		for (const auto & directory : watched) {
+			events.push_back(directory->overlapped.hEvent);
+		}
+		DWORD signalled = WaitForMultipleObjects((DWORD)events.size(), &events[0], FALSE, INFINITE) - WAIT_OBJECT_0;
+
+		if (signalled == 0) {
+			std::vector<std::string> added;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (stopping) {
+					break;
+				}
+				added.swap(newDirectories);
+			}
+			for (const auto & path : added) {
+				// Each wait can take MAXIMUM_WAIT_OBJECTS handles, one of
+				// which is the wake event.
+				if (watched.size() + 1 >= MAXIMUM_WAIT_OBJECTS) {
+					std::cerr << "FileWatcher: too many directories, not watching " << path << std::endl;
+					continue;
+				}
+				std::unique_ptr<Directory> directory(new Directory());
+				directory->path = path;
+				directory->handle = CreateFileA(path.c_str(), FILE_LIST_DIRECTORY,
+					FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+					FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+				if (directory->handle == INVALID_HANDLE_VALUE) {
+					std::cerr << "FileWatcher: could not open " << path << std::endl;
+					continue;
+				}
+				directory->overlapped.hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+				if (!startRead(*directory)) {
+					std::cerr << "FileWatcher: could not watch " << path << std::endl;
+					CloseHandle(directory->overlapped.hEvent);
+					CloseHandle(directory->handle);
+					continue;
+				}
+				watched.push_back(std::move(directory));
+			}
+			continue;
+		}
+		if (signalled >= events.size()) {
+			break;
+		}
+
+		Directory & directory = *watched[signalled - 1];
+		DWORD bytes = 0;
+		if (GetOverlappedResult(directory.handle, &directory.overlapped, &bytes, FALSE)) {
+			if (bytes == 0) {
+				// The buffer overflowed; treat everything in the directory as changed.
+				std::lock_guard<std::mutex> lock(mutex);
+				for (const auto & file : files) {
+					if (file.compare(0, directory.path.size() + 1, directory.path + SEPARATOR) == 0) {
+						pending[file] = std::chrono::steady_clock::now();
+					}
+				}
+			}
+			for (const unsigned char* entry = (const unsigned char*)directory.buffer; bytes > 0;) {
+				const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)entry;
+				char name[MAX_PATH];
+				int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)),
+					name, sizeof(name), NULL, NULL);
+				noteChange(directory.path, std::string(name, length));
+				if (info->NextEntryOffset == 0) {
+					break;
+				}
+				entry += info->NextEntryOffset;
+			}
+		}
+		startRead(directory);
+	}
+
+	for (const auto & directory : watched) {
+		CancelIo(directory->handle);
+		DWORD bytes;
+		GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, TRUE);
+		CloseHandle(directory->overlapped.hEvent);
+		CloseHandle(directory->handle);
+	}
+}
+
+#else
+
+void FileWatcher::noteDirectory(const std::string & directory)
+{
+	if (inotifyFd < 0) {
+		return;
+	}
+	// Editors that save by writing a new file and renaming it over the old
+	// one show up as IN_MOVED_TO rather than IN_CLOSE_WRITE.
+	int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0) {
+		std::cerr << "FileWatcher: could not watch " << directory << std::endl;
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	directories[wd] = directory;
+}
+
+void FileWatcher::watcherLoop()
+{
+	alignas(inotify_event) char buffer[4096];
+	for (;;) {
+		pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0) {
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopping) {
+				break;
+			}
+		}
+
+		ssize_t bytes;
+		while ((bytes = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+			for (char* entry = buffer; entry < buffer + bytes;) {
+				const inotify_event* event = (const inotify_event*)entry;
+				entry += sizeof(inotify_event) + event->len;
+
+				if (event->mask & IN_Q_OVERFLOW) {
+					// Events were lost; treat every watched file as changed.
+					std::lock_guard<std::mutex> lock(mutex);
+					for (const auto & file : files) {
+						pending[file] = std::chrono::steady_clock::now();
+					}
+					continue;
+				}
+				if (event->len == 0) {
+					continue;
+				}
+				std::string directory;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					auto found = directories.find(event->wd);
+					if (found == directories.end()) {
+						continue;
+					}
+					directory = found->second;
+				}
+				noteChange(directory, event->name);
+			}
+		}
+	}
+}
+
+#endif
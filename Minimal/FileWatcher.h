@@ -0,0 +1,56 @@
+#ifndef _FILE_WATCHER_H_
+#define _FILE_WATCHER_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reports watched files that have changed on disk. A background thread
+// waits on the directories holding them (ReadDirectoryChangesW on Windows,
+// inotify elsewhere), so nothing is polled on the render thread. Editors
+// often save in several steps, so a file is only reported once it has been
+// quiet for settleMillis.
+class FileWatcher
+{
+public:
+	explicit FileWatcher(int settleMillis = 250);
+	~FileWatcher();
+
+	// path must be canonical (see TextureCache::canonicalPath); changes()
+	// returns it in the same form. Thread safe.
+	void watch(const std::string & path);
+	// Files that changed and settled since the last call. Thread safe.
+	std::vector<std::string> changes();
+
+private:
+	FileWatcher(const FileWatcher &);
+	FileWatcher & operator=(const FileWatcher &);
+
+	void watcherLoop();
+	void noteChange(const std::string & directory, const std::string & name);
+	void noteDirectory(const std::string & directory);
+
+	std::chrono::milliseconds settle;
+	std::mutex mutex;
+	std::set<std::string> files;
+	std::map<std::string, std::chrono::steady_clock::time_point> pending;
+	bool stopping;
+#ifdef _WIN32
+	// Directories are opened on the watcher thread, which owns their
+	// overlapped reads; watch() queues them and sets wakeEvent.
+	std::set<std::string> directories;
+	std::vector<std::string> newDirectories;
+	void* wakeEvent;
+#else
+	std::map<int, std::string> directories;
+	int inotifyFd;
+	int wakePipe[2];
+#endif
+	std::thread watcher;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: data_(nullptr), size_(0)
+#ifdef _WIN32
+	, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr)
+#else
+	, fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == nullptr) {
+		close();
+		return false;
+	}
+
+	data_ = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (data_ == nullptr) {
+		close();
+		return false;
+	}
+	size_ = (size_t)fileSize.QuadPart;
+#else
+	fd = ::open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		close();
+		return false;
+	}
+	madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+	data_ = (const unsigned char*)mapping;
+	size_ = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (data_ != nullptr) {
+		UnmapViewOfFile(data_);
+	}
+	if (mappingHandle != nullptr) {
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (data_ != nullptr) {
+		munmap((void*)data_, size_);
+	}
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+	if (data_ == nullptr || offset >= size_) {
+		return;
+	}
+	if (length > size_ - offset) {
+		length = size_ - offset;
+	}
+
+	const size_t pageSize = 4096;
+	volatile unsigned char sink = 0;
+	for (size_t i = 0; i < length; i += pageSize) {
+		sink ^= data_[offset + i];
+	}
+	if (length > 0) {
+		sink ^= data_[offset + length - 1];
+	}
+	(void)sink;
+}
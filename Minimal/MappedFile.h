@@ -0,0 +1,36 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until
+// close() is called or the object is destroyed.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return data_ != nullptr; }
+	const unsigned char* data() const { return data_; }
+	size_t size() const { return size_; }
+	// Touch every page of [offset, offset + length) so later reads from
+	// another thread do not fault the file in.
+	void prefetch(size_t offset, size_t length) const;
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile & operator=(const MappedFile &);
+
+	const unsigned char* data_;
+	size_t size_;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "MipGenerator.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace {
+
+	void downsampleRowsScalar(const unsigned char* src, int width, int height,
+		unsigned char* dst, int dstWidth, int firstX, int y)
+	{
+		const unsigned char* row0 = src + (size_t)std::min(y * 2, height - 1) * width * 4;
+		const unsigned char* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+		unsigned char* out = dst + (size_t)y * dstWidth * 4;
+		for (int x = firstX; x < dstWidth; x++) {
+			int x0 = std::min(x * 2, width - 1) * 4, x1 = std::min(x * 2 + 1, width - 1) * 4;
+			for (int c = 0; c < 4; c++) {
+				out[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+			}
+		}
+	}
+
+	// Two output texels from four input texels in each row.
+	inline __m128i boxSSE2(__m128i top, __m128i bottom)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+		__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+	}
+
+	int downsampleRowSSE2(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int dstWidth)
+	{
+		int x = 0;
+		for (; x + 4 <= dstWidth; x += 4) {
+			__m128i a = boxSSE2(_mm_loadu_si128((const __m128i*)(row0 + x * 8)), _mm_loadu_si128((const __m128i*)(row1 + x * 8)));
+			__m128i b = boxSSE2(_mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16)), _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16)));
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(a, b));
+		}
+		return x;
+	}
+
+	CPU_TARGET_AVX2
+	int downsampleRowAVX2(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int dstWidth)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i two = _mm256_set1_epi16(2);
+		int x = 0;
+		for (; x + 8 <= dstWidth; x += 8) {
+			__m256i sums[2];
+			for (int half = 0; half < 2; half++) {
+				__m256i top = _mm256_loadu_si256((const __m256i*)(row0 + x * 8 + half * 32));
+				__m256i bottom = _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + half * 32));
+				// Per 128-bit lane: lo holds texels 0,1 and hi texels 2,3.
+				__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(top, zero), _mm256_unpacklo_epi8(bottom, zero));
+				__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(top, zero), _mm256_unpackhi_epi8(bottom, zero));
+				__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+				sums[half] = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+			}
+			// packus works per lane, leaving outputs 0,1,4,5 | 2,3,6,7 in
+			// 64-bit chunks; put them back in order.
+			__m256i packed = _mm256_packus_epi16(sums[0], sums[1]);
+			_mm256_storeu_si256((__m256i*)(out + x * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+		return x;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	// Cube map seams. Texel positions are converted to directions and back
+	// so the edge relationships follow directly from the GL cube map face
+	// conventions instead of a hand-written adjacency table.
+
+	// Major axis (0..2) and sign of each face.
+	const int FACE_AXIS[6] = { 0, 0, 1, 1, 2, 2 };
+	const float FACE_SIGN[6] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f };
+
+	void faceToDirection(int face, float s, float t, float d[3])
+	{
+		float sc = 2.0f * s - 1.0f, tc = 2.0f * t - 1.0f;
+		switch (face) {
+		case 0: d[0] = 1.0f; d[1] = -tc; d[2] = -sc; break;
+		case 1: d[0] = -1.0f; d[1] = -tc; d[2] = sc; break;
+		case 2: d[0] = sc; d[1] = 1.0f; d[2] = tc; break;
+		case 3: d[0] = sc; d[1] = -1.0f; d[2] = -tc; break;
+		case 4: d[0] = sc; d[1] = -tc; d[2] = 1.0f; break;
+		default: d[0] = -sc; d[1] = -tc; d[2] = -1.0f; break;
+		}
+	}
+
+	void directionToFace(int face, const float d[3], float & s, float & t)
+	{
+		float ma = fabsf(d[FACE_AXIS[face]]), sc, tc;
+		switch (face) {
+		case 0: sc = -d[2]; tc = -d[1]; break;
+		case 1: sc = d[2]; tc = -d[1]; break;
+		case 2: sc = d[0]; tc = d[2]; break;
+		case 3: sc = d[0]; tc = -d[2]; break;
+		case 4: sc = d[0]; tc = -d[1]; break;
+		default: sc = -d[0]; tc = -d[1]; break;
+		}
+		s = (sc / ma + 1.0f) * 0.5f;
+		t = (tc / ma + 1.0f) * 0.5f;
+	}
+
+	unsigned char* texelAt(std::vector<unsigned char> & image, int size, float s, float t)
+	{
+		int x = std::min(size - 1, std::max(0, (int)(s * size)));
+		int y = std::min(size - 1, std::max(0, (int)(t * size)));
+		return &image[((size_t)y * size + x) * 4];
+	}
+
+	void averageTexels(unsigned char** texels, int count)
+	{
+		for (int c = 0; c < 4; c++) {
+			int sum = 0;
+			for (int i = 0; i < count; i++) {
+				sum += texels[i][c];
+			}
+			unsigned char average = (unsigned char)((sum + count / 2) / count);
+			for (int i = 0; i < count; i++) {
+				texels[i][c] = average;
+			}
+		}
+	}
+
+	void fixSeams(std::vector<unsigned char>* level[6], int size)
+	{
+		// Edges, skipping the corner texels. Each edge is visited from both
+		// faces; the second visit finds the texels already equal.
+		for (int face = 0; face < 6; face++) {
+			for (int edge = 0; edge < 4; edge++) {
+				for (int i = 1; i < size - 1; i++) {
+					float along = (i + 0.5f) / size;
+					float s = edge == 0 ? 0.0f : (edge == 1 ? 1.0f : along);
+					float t = edge == 2 ? 0.0f : (edge == 3 ? 1.0f : along);
+					float d[3];
+					faceToDirection(face, s, t, d);
+
+					int neighbour = -1;
+					for (int other = 0; other < 6; other++) {
+						if (other != face && d[FACE_AXIS[other]] * FACE_SIGN[other] > 0.999f) {
+							neighbour = other;
+						}
+					}
+					float ns, nt;
+					directionToFace(neighbour, d, ns, nt);
+					unsigned char* texels[2] = { texelAt(*level[face], size, s, t), texelAt(*level[neighbour], size, ns, nt) };
+					averageTexels(texels, 2);
+				}
+			}
+		}
+
+		// Each cube corner is shared by three faces.
+		for (int corner = 0; corner < 8; corner++) {
+			float d[3] = { corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f };
+			unsigned char* texels[3];
+			int count = 0;
+			for (int face = 0; face < 6; face++) {
+				if (d[FACE_AXIS[face]] * FACE_SIGN[face] > 0.0f) {
+					float s, t;
+					directionToFace(face, d, s, t);
+					texels[count++] = texelAt(*level[face], size, s, t);
+				}
+			}
+			averageTexels(texels, count);
+		}
+	}
+}
+
+MipKernel bestMipKernel()
+{
+	static const MipKernel best = CpuFeatures::get().avx2 ? MIP_KERNEL_AVX2
+		: (CpuFeatures::get().sse2 ? MIP_KERNEL_SSE2 : MIP_KERNEL_SCALAR);
+	return best;
+}
+
+const char* mipKernelName(MipKernel kernel)
+{
+	switch (kernel) {
+	case MIP_KERNEL_AVX2:
+		return "avx2";
+	case MIP_KERNEL_SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+int mipLevelCount(int width, int height)
+{
+	int levels = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2) {
+		++levels;
+	}
+	return levels;
+}
+
+void downsampleRGBA8(const unsigned char* src, int width, int height, unsigned char* dst, MipKernel kernel)
+{
+	int dstWidth = std::max(1, width / 2), dstHeight = std::max(1, height / 2);
+	// Single row/column sources need clamping, which only the scalar loop does.
+	if (width < 2 || height < 2) {
+		kernel = MIP_KERNEL_SCALAR;
+	}
+
+	for (int y = 0; y < dstHeight; y++) {
+		const unsigned char* row0 = src + (size_t)(y * 2) * width * 4;
+		const unsigned char* row1 = row0 + (size_t)width * 4;
+		unsigned char* out = dst + (size_t)y * dstWidth * 4;
+		int done = 0;
+		if (kernel == MIP_KERNEL_AVX2) {
+			done = downsampleRowAVX2(row0, row1, out, dstWidth);
+		}
+		if (kernel != MIP_KERNEL_SCALAR) {
+			done += downsampleRowSSE2(row0 + done * 8, row1 + done * 8, out + done * 4, dstWidth - done);
+		}
+		downsampleRowsScalar(src, width, height, dst, dstWidth, done, y);
+	}
+}
+
+void buildCubeMipChain(CubeMipChain & chain, MipKernel kernel)
+{
+	std::vector<std::vector<unsigned char>>* faces = chain.faces;
+	int size = chain.size;
+	int levels = mipLevelCount(size, size);
+	for (int face = 0; face < 6; face++) {
+		faces[face].resize(levels);
+	}
+
+	for (int level = 1; level < levels; level++) {
+		int srcSize = std::max(1, size >> (level - 1)), dstSize = std::max(1, size >> level);
+		std::vector<unsigned char>* images[6];
+		for (int face = 0; face < 6; face++) {
+			faces[face][level].resize((size_t)dstSize * dstSize * 4);
+			downsampleRGBA8(&faces[face][level - 1][0], srcSize, srcSize, &faces[face][level][0], kernel);
+			images[face] = &faces[face][level];
+		}
+		if (dstSize > 1) {
+			fixSeams(images, dstSize);
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef _MIP_GENERATOR_H_
+#define _MIP_GENERATOR_H_
+
+#include <vector>
+
+// CPU mip chain generation for RGBA8 images. Each level is a 2x2 box filter
+// of the one above it; the inner loops have SSE2 and AVX2 versions chosen
+// at run time, with a scalar fallback for other CPUs and for the edges.
+enum MipKernel
+{
+	MIP_KERNEL_SCALAR,
+	MIP_KERNEL_SSE2,
+	MIP_KERNEL_AVX2,
+};
+
+MipKernel bestMipKernel();
+const char* mipKernelName(MipKernel kernel);
+
+int mipLevelCount(int width, int height);
+
+// Writes the max(1, width / 2) x max(1, height / 2) level below src to dst.
+void downsampleRGBA8(const unsigned char* src, int width, int height, unsigned char* dst, MipKernel kernel);
+
+// faces[face][level] for the six faces of a cube map in
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X order, each level a tightly packed RGBA8
+// image of max(1, size >> level) texels square.
+struct CubeMipChain
+{
+	int size;
+	std::vector<std::vector<unsigned char>> faces[6];
+};
+
+// Generates levels 1 and below from level 0 of each face. After each level
+// is built, texels on a shared cube edge (or corner) are replaced by their
+// average across the faces that meet there, so the seams do not open up as
+// the chain gets coarser.
+void buildCubeMipChain(CubeMipChain & chain, MipKernel kernel);
+
+#endif
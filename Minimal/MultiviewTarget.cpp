@@ -0,0 +1,99 @@
+#include "MultiviewTarget.h"
+#include "TextureCache.h"
+
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+
+namespace {
+	// GLEW only knows the extension from 2.1 on, so it is looked up here.
+	typedef void (APIENTRY *FramebufferTextureMultiviewProc)(GLenum target, GLenum attachment,
+		GLuint texture, GLint level, GLint baseViewIndex, GLsizei numViews);
+
+	FramebufferTextureMultiviewProc framebufferTextureMultiview()
+	{
+		return (FramebufferTextureMultiviewProc)glfwGetProcAddress("glFramebufferTextureMultiviewOVR");
+	}
+
+	GLuint createLayers(GLenum internalFormat, GLenum format, GLenum type, int width, int height)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, 2, 0, format, type, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return texture;
+	}
+}
+
+bool MultiviewTarget::supported()
+{
+	return glfwExtensionSupported("GL_OVR_multiview") && framebufferTextureMultiview() != nullptr;
+}
+
+MultiviewTarget::MultiviewTarget(int width, int height)
+	: width(width), height(height), framebuffer(0), readFramebuffer(0), color(0), depth(0), complete_(false)
+{
+	// The same sRGB encoding as the swap chain, so the copy is exact.
+	color = createLayers(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+	depth = createLayers(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, width, height);
+
+	// Rewritten every frame, so counted against the budget but never evicted.
+	size_t layerBytes = (size_t)width * height * 4;
+	TextureCache::instance().adoptTexture(color, GL_TEXTURE_2D_ARRAY, layerBytes * 2, true);
+	TextureCache::instance().adoptTexture(depth, GL_TEXTURE_2D_ARRAY, layerBytes * 2, true);
+
+	FramebufferTextureMultiviewProc attach = framebufferTextureMultiview();
+	glGenFramebuffers(1, &framebuffer);
+	glGenFramebuffers(1, &readFramebuffer);
+	if (attach == nullptr) {
+		std::cerr << "MultiviewTarget: glFramebufferTextureMultiviewOVR is missing" << std::endl;
+		return;
+	}
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	attach(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0, 0, 2);
+	attach(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0, 0, 2);
+	complete_ = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	if (!complete_) {
+		std::cerr << "MultiviewTarget: the layered framebuffer is incomplete" << std::endl;
+	}
+}
+
+MultiviewTarget::~MultiviewTarget()
+{
+	glDeleteFramebuffers(1, &readFramebuffer);
+	glDeleteFramebuffers(1, &framebuffer);
+	TextureCache::instance().releaseTexture(depth);
+	TextureCache::instance().releaseTexture(color);
+}
+
+void MultiviewTarget::bind() const
+{
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+}
+
+void MultiviewTarget::resolve(GLuint drawFramebuffer, GLuint texture, const GLint viewports[2][4]) const
+{
+	TextureCache::instance().touch(color);
+	TextureCache::instance().touch(depth);
+	// Both sides are already encoded; copy the bytes unchanged.
+	GLboolean srgb = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+	glDisable(GL_FRAMEBUFFER_SRGB);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+	for (int layer = 0; layer < 2; layer++) {
+		const GLint* vp = viewports[layer];
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0, layer);
+		glBlitFramebuffer(0, 0, vp[2], vp[3], vp[0], vp[1], vp[0] + vp[2], vp[1] + vp[3], GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	if (srgb) {
+		glEnable(GL_FRAMEBUFFER_SRGB);
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef _MULTIVIEW_TARGET_H_
+#define _MULTIVIEW_TARGET_H_
+
+#include <GL\glew.h>
+
+// A two layer colour and depth target that GL_OVR_multiview draws both
+// eyes into at once. The Rift's swap chain on PC is a single 2D texture
+// with the eyes side by side, so each layer is copied into its eye's
+// viewport afterwards.
+class MultiviewTarget
+{
+public:
+	// Whether the driver has GL_OVR_multiview; the context must be current.
+	static bool supported();
+
+	MultiviewTarget(int width, int height);
+	~MultiviewTarget();
+
+	// Binds the target for drawing, with the viewport covering one layer.
+	void bind() const;
+	// Copies layer i to viewport i ({ x, y, width, height }) of texture.
+	// Leaves the draw framebuffer bound to drawFramebuffer.
+	void resolve(GLuint drawFramebuffer, GLuint texture, const GLint viewports[2][4]) const;
+	bool complete() const { return complete_; }
+
+private:
+	MultiviewTarget(const MultiviewTarget &);
+	MultiviewTarget & operator=(const MultiviewTarget &);
+
+	int width, height;
+	GLuint framebuffer, readFramebuffer;
+	GLuint color, depth;
+	bool complete_;
+};
+
+#endif
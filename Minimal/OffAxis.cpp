@@ -0,0 +1,166 @@
+#include "OffAxis.h"
+#include "CpuFeatures.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <emmintrin.h>
+
+namespace {
+	inline __m128 dot3(__m128 x0, __m128 y0, __m128 z0, __m128 x1, __m128 y1, __m128 z1)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)), _mm_mul_ps(z0, z1));
+	}
+}
+
+glm::mat4 OffAxisProjection(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft,
+	const glm::vec3 & eye, float nearPlane, float farPlane, glm::mat4 & pose)
+{
+	// The screen's orthonormal basis.
+	glm::vec3 right = glm::normalize(lowerRight - lowerLeft);
+	glm::vec3 up = glm::normalize(upperLeft - lowerLeft);
+	glm::vec3 normal = glm::normalize(glm::cross(right, up));
+
+	// From the eye to the corners, and to the screen's plane.
+	glm::vec3 toLowerLeft = lowerLeft - eye;
+	glm::vec3 toLowerRight = lowerRight - eye;
+	glm::vec3 toUpperLeft = upperLeft - eye;
+	float distance = -glm::dot(toLowerLeft, normal);
+
+	// The screen's extents on the near plane.
+	float scale = nearPlane / distance;
+	float left = glm::dot(right, toLowerLeft) * scale;
+	float rightExtent = glm::dot(right, toLowerRight) * scale;
+	float bottom = glm::dot(up, toLowerLeft) * scale;
+	float top = glm::dot(up, toUpperLeft) * scale;
+
+	pose = glm::mat4(glm::vec4(right, 0.0f), glm::vec4(up, 0.0f), glm::vec4(normal, 0.0f), glm::vec4(eye, 1.0f));
+	return glm::frustum(left, rightExtent, bottom, top, nearPlane, farPlane);
+}
+
+OffAxisScreen::OffAxisScreen(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft)
+	: lowerLeft(lowerLeft)
+{
+	width = glm::length(lowerRight - lowerLeft);
+	height = glm::length(upperLeft - lowerLeft);
+	right = (lowerRight - lowerLeft) / width;
+	up = (upperLeft - lowerLeft) / height;
+	normal = glm::normalize(glm::cross(right, up));
+}
+
+OffAxisKernel bestOffAxisKernel()
+{
+	static const OffAxisKernel best = CpuFeatures::get().sse2 ? OFF_AXIS_KERNEL_SSE2 : OFF_AXIS_KERNEL_SCALAR;
+	return best;
+}
+
+const char* offAxisKernelName(OffAxisKernel kernel)
+{
+	return kernel == OFF_AXIS_KERNEL_SSE2 ? "sse2" : "scalar";
+}
+
+int OffAxisBatch::add(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft)
+{
+	int i = size();
+	screens.push_back(OffAxisScreen(lowerLeft, lowerRight, upperLeft));
+	if (i % 4 == 0) {
+		// The padding's lanes are computed but never read; a nonzero size
+		// keeps them finite.
+		for (int field = 0; field < FIELDS; field++) {
+			fields[field].resize(i + 4, field == TWO_OVER_WIDTH || field == TWO_OVER_HEIGHT ? 2.0f : 0.0f);
+		}
+	}
+	const OffAxisScreen & screen = screens.back();
+	const glm::vec3* axes[4] = { &screen.lowerLeft, &screen.right, &screen.up, &screen.normal };
+	for (int axis = 0; axis < 4; axis++) {
+		for (int component = 0; component < 3; component++) {
+			fields[CORNER_X + axis * 3 + component][i] = (*axes[axis])[component];
+		}
+	}
+	fields[TWO_OVER_WIDTH][i] = 2.0f / screen.width;
+	fields[TWO_OVER_HEIGHT][i] = 2.0f / screen.height;
+	return i;
+}
+
+void OffAxisBatch::setEye(int i, const glm::vec3 & eye)
+{
+	fields[EYE_X][i] = eye.x;
+	fields[EYE_Y][i] = eye.y;
+	fields[EYE_Z][i] = eye.z;
+}
+
+// With l = A * near / D and r = (A + width) * near / D, and likewise for b
+// and t with B and height, where A, B and D are the eye's offset from the
+// corner along right, up and -normal, glm::frustum's terms that change with
+// the eye come down to these; near drops out of all of them.
+void OffAxisBatch::projectScalar(float* const* f, int begin, int end)
+{
+	for (int i = begin; i < end; i++) {
+		float tx = f[CORNER_X][i] - f[EYE_X][i];
+		float ty = f[CORNER_Y][i] - f[EYE_Y][i];
+		float tz = f[CORNER_Z][i] - f[EYE_Z][i];
+		float a = f[RIGHT_X][i] * tx + f[RIGHT_Y][i] * ty + f[RIGHT_Z][i] * tz;
+		float b = f[UP_X][i] * tx + f[UP_Y][i] * ty + f[UP_Z][i] * tz;
+		float d = -(f[NORMAL_X][i] * tx + f[NORMAL_Y][i] * ty + f[NORMAL_Z][i] * tz);
+		f[M00][i] = d * f[TWO_OVER_WIDTH][i];
+		f[M11][i] = d * f[TWO_OVER_HEIGHT][i];
+		f[M20][i] = a * f[TWO_OVER_WIDTH][i] + 1.0f;
+		f[M21][i] = b * f[TWO_OVER_HEIGHT][i] + 1.0f;
+	}
+}
+
+// The scalar kernel four lanes at a time. The arrays come from std::vector,
+// which only promises the alignment of a float, hence the unaligned loads.
+void OffAxisBatch::projectSSE2(float* const* f, int begin, int end)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (int i = begin; i < end; i += 4) {
+		__m128 tx = _mm_sub_ps(_mm_loadu_ps(f[CORNER_X] + i), _mm_loadu_ps(f[EYE_X] + i));
+		__m128 ty = _mm_sub_ps(_mm_loadu_ps(f[CORNER_Y] + i), _mm_loadu_ps(f[EYE_Y] + i));
+		__m128 tz = _mm_sub_ps(_mm_loadu_ps(f[CORNER_Z] + i), _mm_loadu_ps(f[EYE_Z] + i));
+		__m128 a = dot3(_mm_loadu_ps(f[RIGHT_X] + i), _mm_loadu_ps(f[RIGHT_Y] + i), _mm_loadu_ps(f[RIGHT_Z] + i), tx, ty, tz);
+		__m128 b = dot3(_mm_loadu_ps(f[UP_X] + i), _mm_loadu_ps(f[UP_Y] + i), _mm_loadu_ps(f[UP_Z] + i), tx, ty, tz);
+		__m128 d = _mm_sub_ps(_mm_setzero_ps(),
+			dot3(_mm_loadu_ps(f[NORMAL_X] + i), _mm_loadu_ps(f[NORMAL_Y] + i), _mm_loadu_ps(f[NORMAL_Z] + i), tx, ty, tz));
+		__m128 twoOverWidth = _mm_loadu_ps(f[TWO_OVER_WIDTH] + i);
+		__m128 twoOverHeight = _mm_loadu_ps(f[TWO_OVER_HEIGHT] + i);
+		_mm_storeu_ps(f[M00] + i, _mm_mul_ps(d, twoOverWidth));
+		_mm_storeu_ps(f[M11] + i, _mm_mul_ps(d, twoOverHeight));
+		_mm_storeu_ps(f[M20] + i, _mm_add_ps(_mm_mul_ps(a, twoOverWidth), one));
+		_mm_storeu_ps(f[M21] + i, _mm_add_ps(_mm_mul_ps(b, twoOverHeight), one));
+	}
+}
+
+void OffAxisBatch::project(OffAxisKernel kernel)
+{
+	float* f[FIELDS];
+	for (int field = 0; field < FIELDS; field++) {
+		f[field] = fields[field].data();
+	}
+	// The padding makes every batch whole fours.
+	if (kernel == OFF_AXIS_KERNEL_SSE2) {
+		projectSSE2(f, 0, (int)fields[0].size());
+	}
+	else {
+		projectScalar(f, 0, size());
+	}
+}
+
+glm::mat4 OffAxisBatch::projection(int i, float nearPlane, float farPlane) const
+{
+	glm::mat4 projection(0.0f);
+	projection[0][0] = fields[M00][i];
+	projection[1][1] = fields[M11][i];
+	projection[2][0] = fields[M20][i];
+	projection[2][1] = fields[M21][i];
+	projection[2][2] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+	projection[2][3] = -1.0f;
+	projection[3][2] = -(2.0f * farPlane * nearPlane) / (farPlane - nearPlane);
+	return projection;
+}
+
+glm::mat4 OffAxisBatch::pose(int i) const
+{
+	const OffAxisScreen & screen = screens[i];
+	glm::vec3 eye(fields[EYE_X][i], fields[EYE_Y][i], fields[EYE_Z][i]);
+	return glm::mat4(glm::vec4(screen.right, 0.0f), glm::vec4(screen.up, 0.0f), glm::vec4(screen.normal, 0.0f), glm::vec4(eye, 1.0f));
+}
@@ -0,0 +1,80 @@
+#ifndef _OFF_AXIS_H_
+#define _OFF_AXIS_H_
+
+#include <glm\glm.hpp>
+
+#include <vector>
+
+// Kooima's generalized perspective projection: the frustum from eye
+// through a planar screen given by three corners, for an eye anywhere in
+// front of it. Returns the projection and sets pose to the eye's transform
+// into the world, turned to face the screen, as ViewUniforms::set takes.
+// The reference OffAxisBatch's kernels are checked against (Bench offaxis).
+glm::mat4 OffAxisProjection(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft,
+	const glm::vec3 & eye, float nearPlane, float farPlane, glm::mat4 & pose);
+
+// A screen's frame, computed once for as long as it stays put: its lower
+// left corner, unit right, up and normal (towards the viewer) and size.
+struct OffAxisScreen
+{
+	OffAxisScreen() {}
+	OffAxisScreen(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft);
+
+	glm::vec3 lowerLeft, right, up, normal;
+	float width, height;
+};
+
+enum OffAxisKernel
+{
+	OFF_AXIS_KERNEL_SCALAR,
+	OFF_AXIS_KERNEL_SSE2,
+};
+
+OffAxisKernel bestOffAxisKernel();
+const char* offAxisKernelName(OffAxisKernel kernel);
+
+// OffAxisProjection for a fixed set of screens, each seen from an eye that
+// moves every frame. With the frame known, a frustum only needs the eye's
+// offset from the corner along the screen's three axes, so the batch keeps
+// each component in its own array, padded to a multiple of four, and the
+// SSE2 kernel does four pairs an instruction.
+class OffAxisBatch
+{
+public:
+	// Adds a screen, seen from the origin until setEye(); returns its index.
+	int add(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft);
+	int size() const { return (int)screens.size(); }
+	const OffAxisScreen & screen(int i) const { return screens[i]; }
+
+	void setEye(int i, const glm::vec3 & eye);
+	// Every screen's frustum from its eye.
+	void project(OffAxisKernel kernel);
+	// As OffAxisProjection gives them, for the last project().
+	glm::mat4 projection(int i, float nearPlane, float farPlane) const;
+	glm::mat4 pose(int i) const;
+
+private:
+	// The arrays: the screen's frame with its size as 2 / width and
+	// 2 / height, the eye, then project()'s results, the projection's
+	// terms that change with the eye.
+	enum Field
+	{
+		CORNER_X, CORNER_Y, CORNER_Z,
+		RIGHT_X, RIGHT_Y, RIGHT_Z,
+		UP_X, UP_Y, UP_Z,
+		NORMAL_X, NORMAL_Y, NORMAL_Z,
+		TWO_OVER_WIDTH, TWO_OVER_HEIGHT,
+		EYE_X, EYE_Y, EYE_Z,
+		M00, M11, M20, M21,
+		FIELDS
+	};
+
+	// Pairs begin to end, given the arrays' data.
+	static void projectScalar(float* const* f, int begin, int end);
+	static void projectSSE2(float* const* f, int begin, int end);
+
+	std::vector<OffAxisScreen> screens;
+	std::vector<float> fields[FIELDS];
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "PPMImage.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+	bool isSpace(unsigned char c) {
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	// Skip whitespace and '#' comments (which run to the end of the line).
+	void skipSeparators(const unsigned char*& p, const unsigned char* end) {
+		while (p < end) {
+			if (isSpace(*p)) {
+				++p;
+			}
+			else if (*p == '#') {
+				while (p < end && *p != '\n' && *p != '\r') {
+					++p;
+				}
+			}
+			else {
+				break;
+			}
+		}
+	}
+
+	bool readInt(const unsigned char*& p, const unsigned char* end, int& value) {
+		skipSeparators(p, end);
+		if (p >= end || *p < '0' || *p > '9') {
+			return false;
+		}
+		long long v = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			v = v * 10 + (*p - '0');
+			if (v > 0x7fffffff) {
+				return false;
+			}
+			++p;
+		}
+		value = (int)v;
+		return true;
+	}
+}
+
+PPMImage::PPMImage()
+	: pixels_(nullptr), width_(0), height_(0), maxval_(0), byteCount_(0), loadMillis_(0.0)
+{
+}
+
+bool PPMImage::load(const char* filename)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	release();
+
+	if (!file.open(filename)) {
+		std::cerr << "error reading ppm file, could not locate " << filename << std::endl;
+		return false;
+	}
+
+	const unsigned char* p = file.data();
+	const unsigned char* end = p + file.size();
+
+	// Read magic number:
+	if (file.size() < 2 || p[0] != 'P' || p[1] != '6') {
+		std::cerr << "error parsing ppm file, " << filename << " is not a binary (P6) ppm" << std::endl;
+		release();
+		return false;
+	}
+	p += 2;
+
+	// Read width, height and maxval:
+	int w, h, maxval;
+	if (!readInt(p, end, w) || !readInt(p, end, h) || !readInt(p, end, maxval)
+		|| w <= 0 || h <= 0 || maxval <= 0 || maxval > 65535) {
+		std::cerr << "error parsing ppm file, bad header in " << filename << std::endl;
+		release();
+		return false;
+	}
+
+	// Exactly one whitespace character separates the header from the raster.
+	if (p >= end || !isSpace(*p)) {
+		std::cerr << "error parsing ppm file, bad header in " << filename << std::endl;
+		release();
+		return false;
+	}
+	++p;
+
+	// Values are uploaded as-is, so only full-range rasters are accepted.
+	if (maxval != 255 && maxval != 65535) {
+		std::cerr << "error parsing ppm file, unsupported maxval " << maxval << " in " << filename << std::endl;
+		release();
+		return false;
+	}
+
+	size_t bytes = (size_t)w * (size_t)h * 3 * (maxval > 255 ? 2 : 1);
+	if ((size_t)(end - p) < bytes) {
+		std::cerr << "error parsing ppm file, incomplete data" << std::endl;
+		release();
+		return false;
+	}
+
+	pixels_ = p;
+	width_ = w;
+	height_ = h;
+	maxval_ = maxval;
+	byteCount_ = bytes;
+	loadMillis_ = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
+
+void PPMImage::release()
+{
+	file.close();
+	pixels_ = nullptr;
+	width_ = height_ = maxval_ = 0;
+	byteCount_ = 0;
+	loadMillis_ = 0.0;
+}
+
+void PPMImage::prefetch() const
+{
+	if (pixels_ != nullptr) {
+		file.prefetch((size_t)(pixels_ - file.data()), byteCount_);
+	}
+}
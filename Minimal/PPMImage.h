@@ -0,0 +1,38 @@
+#ifndef _PPM_IMAGE_H_
+#define _PPM_IMAGE_H_
+
+#include <GL\glew.h>
+
+#include "MappedFile.h"
+
+// A binary (P6) PPM file mapped into memory. The header is parsed in place
+// and pixels() points straight into the mapping, so the raster can be
+// converted for upload without an intermediate copy.
+class PPMImage
+{
+public:
+	PPMImage();
+	bool load(const char* filename);
+	void release();
+	// Fault the raster into memory; used by the loader threads.
+	void prefetch() const;
+
+	const unsigned char* pixels() const { return pixels_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int maxval() const { return maxval_; }
+	size_t byteCount() const { return byteCount_; }
+	// GL_UNSIGNED_BYTE for maxval < 256, otherwise big-endian GL_UNSIGNED_SHORT.
+	GLenum type() const { return maxval_ > 255 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE; }
+	// Milliseconds spent mapping the file and parsing the header.
+	double loadMillis() const { return loadMillis_; }
+
+private:
+	MappedFile file;
+	const unsigned char* pixels_;
+	int width_, height_, maxval_;
+	size_t byteCount_;
+	double loadMillis_;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "Panorama.h"
+#include "CpuFeatures.h"
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace {
+
+	const float PI = 3.14159265358979f;
+
+	// Row bands per face when converting on a pool.
+	const int BANDS_PER_FACE = 8;
+
+	// Texel directions are centre + sc * across + tc * down, with sc and tc
+	// in [-1, 1], following the GL cube map face conventions.
+	const float FACE_BASIS[6][3][3] = {
+		{ { 1, 0, 0 }, { 0, 0, -1 }, { 0, -1, 0 } },
+		{ { -1, 0, 0 }, { 0, 0, 1 }, { 0, -1, 0 } },
+		{ { 0, 1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+		{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, -1 } },
+		{ { 0, 0, 1 }, { 1, 0, 0 }, { 0, -1, 0 } },
+		{ { 0, 0, -1 }, { -1, 0, 0 }, { 0, -1, 0 } },
+	};
+
+	// Panorama pixel coordinates of texels [firstX, size) of a face row,
+	// with pixel centres at integers.
+	void rowCoordsScalar(int face, float tc, int size, int width, int height, float* u, float* v, int firstX)
+	{
+		const float (*basis)[3] = FACE_BASIS[face];
+		for (int x = firstX; x < size; x++) {
+			float sc = (2.0f * x + 1.0f) / size - 1.0f;
+			float d[3];
+			for (int i = 0; i < 3; i++) {
+				d[i] = basis[0][i] + sc * basis[1][i] + tc * basis[2][i];
+			}
+			float lon = atan2f(d[0], -d[2]);
+			float lat = atan2f(d[1], sqrtf(d[0] * d[0] + d[2] * d[2]));
+			u[x] = (lon / (2.0f * PI) + 0.5f) * width - 0.5f;
+			v[x] = (0.5f - lat / PI) * height - 0.5f;
+		}
+	}
+
+	// atan2 from an odd polynomial for atan on [0, 1] (Abramowitz & Stegun
+	// 4.4.49, |error| < 2e-8) plus octant fix-ups.
+	CPU_TARGET_AVX2_FMA
+	inline __m256 atan2AVX2(__m256 y, __m256 x)
+	{
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		__m256 ax = _mm256_andnot_ps(signMask, x), ay = _mm256_andnot_ps(signMask, y);
+		__m256 big = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+		__m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), big);
+		__m256 s = _mm256_mul_ps(a, a);
+		__m256 p = _mm256_set1_ps(0.0028662257f);
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.0161657367f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.0429096138f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.0752896400f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.1065626393f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.1420889944f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(0.1999355085f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(-0.3333314528f));
+		p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(1.0f));
+		__m256 r = _mm256_mul_ps(p, a);
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI * 0.5f), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI), r), x);
+		return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+	}
+
+	CPU_TARGET_AVX2_FMA
+	int rowCoordsAVX2(int face, float tc, int size, int width, int height, float* u, float* v)
+	{
+		const float (*basis)[3] = FACE_BASIS[face];
+		__m256 base[3], across[3];
+		for (int i = 0; i < 3; i++) {
+			base[i] = _mm256_set1_ps(basis[0][i] + tc * basis[2][i]);
+			across[i] = _mm256_set1_ps(basis[1][i]);
+		}
+		const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256 uScale = _mm256_set1_ps(width / (2.0f * PI)), uOffset = _mm256_set1_ps(width * 0.5f - 0.5f);
+		const __m256 vScale = _mm256_set1_ps(-height / PI), vOffset = _mm256_set1_ps(height * 0.5f - 0.5f);
+		const __m256 negate = _mm256_set1_ps(-0.0f);
+
+		int x = 0;
+		for (; x + 8 <= size; x += 8) {
+			__m256 sc = _mm256_sub_ps(_mm256_mul_ps(_mm256_fmadd_ps(_mm256_add_ps(lanes, _mm256_set1_ps((float)x)),
+				_mm256_set1_ps(2.0f), _mm256_set1_ps(1.0f)), _mm256_set1_ps(1.0f / size)), _mm256_set1_ps(1.0f));
+			__m256 dx = _mm256_fmadd_ps(sc, across[0], base[0]);
+			__m256 dy = _mm256_fmadd_ps(sc, across[1], base[1]);
+			__m256 dz = _mm256_fmadd_ps(sc, across[2], base[2]);
+			__m256 lon = atan2AVX2(dx, _mm256_xor_ps(dz, negate));
+			__m256 lat = atan2AVX2(dy, _mm256_sqrt_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dz, dz))));
+			_mm256_storeu_ps(u + x, _mm256_fmadd_ps(lon, uScale, uOffset));
+			_mm256_storeu_ps(v + x, _mm256_fmadd_ps(lat, vScale, vOffset));
+		}
+		return x;
+	}
+
+	inline __m128 loadTexel(const unsigned char* texel)
+	{
+		int bits;
+		memcpy(&bits, texel, 4);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero);
+		return _mm_cvtepi32_ps(wide);
+	}
+
+	inline void storeTexel(unsigned char* texel, __m128 value)
+	{
+		__m128i rounded = _mm_cvtps_epi32(value);
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(rounded, rounded), rounded);
+		int bits = _mm_cvtsi128_si32(packed);
+		memcpy(texel, &bits, 4);
+	}
+
+	inline int wrapColumn(int x, int width)
+	{
+		x %= width;
+		return x < 0 ? x + width : x;
+	}
+
+	inline int clampRow(int y, int height)
+	{
+		return std::min(height - 1, std::max(0, y));
+	}
+
+	void filterBilinear(const unsigned char* rgba, int width, int height, float u, float v, unsigned char* out)
+	{
+		float fx = floorf(u), fy = floorf(v);
+		int x0 = (int)fx, y0 = (int)fy;
+		__m128 tx = _mm_set1_ps(u - fx), ty = _mm_set1_ps(v - fy);
+		const unsigned char* row0 = rgba + (size_t)clampRow(y0, height) * width * 4;
+		const unsigned char* row1 = rgba + (size_t)clampRow(y0 + 1, height) * width * 4;
+		int c0 = wrapColumn(x0, width) * 4, c1 = wrapColumn(x0 + 1, width) * 4;
+
+		__m128 top = loadTexel(row0 + c0), bottom = loadTexel(row1 + c0);
+		top = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(loadTexel(row0 + c1), top), tx));
+		bottom = _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(loadTexel(row1 + c1), bottom), tx));
+		storeTexel(out, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty)));
+	}
+
+	inline void catmullRom(float t, float w[4])
+	{
+		w[0] = ((-0.5f * t + 1.0f) * t - 0.5f) * t;
+		w[1] = (1.5f * t - 2.5f) * t * t + 1.0f;
+		w[2] = ((-1.5f * t + 2.0f) * t + 0.5f) * t;
+		w[3] = (0.5f * t - 0.5f) * t * t;
+	}
+
+	void filterBicubic(const unsigned char* rgba, int width, int height, float u, float v, unsigned char* out)
+	{
+		float fx = floorf(u), fy = floorf(v);
+		int x0 = (int)fx, y0 = (int)fy;
+		float wx[4], wy[4];
+		catmullRom(u - fx, wx);
+		catmullRom(v - fy, wy);
+		int columns[4];
+		for (int i = 0; i < 4; i++) {
+			columns[i] = wrapColumn(x0 - 1 + i, width) * 4;
+		}
+
+		__m128 sum = _mm_setzero_ps();
+		for (int j = 0; j < 4; j++) {
+			const unsigned char* row = rgba + (size_t)clampRow(y0 - 1 + j, height) * width * 4;
+			__m128 line = _mm_mul_ps(loadTexel(row + columns[0]), _mm_set1_ps(wx[0]));
+			for (int i = 1; i < 4; i++) {
+				line = _mm_add_ps(line, _mm_mul_ps(loadTexel(row + columns[i]), _mm_set1_ps(wx[i])));
+			}
+			sum = _mm_add_ps(sum, _mm_mul_ps(line, _mm_set1_ps(wy[j])));
+		}
+		// Catmull-Rom overshoots at edges; storeTexel saturates to [0, 255].
+		storeTexel(out, sum);
+	}
+}
+
+PanoramaKernel bestPanoramaKernel()
+{
+	static const PanoramaKernel best = CpuFeatures::get().avx2 && CpuFeatures::get().fma
+		? PANORAMA_KERNEL_AVX2 : PANORAMA_KERNEL_SCALAR;
+	return best;
+}
+
+const char* panoramaKernelName(PanoramaKernel kernel)
+{
+	return kernel == PANORAMA_KERNEL_AVX2 ? "avx2" : "scalar";
+}
+
+int panoramaFaceSize(int width)
+{
+	return std::max(1, width / 4);
+}
+
+void resamplePanorama(const unsigned char* rgba, int width, int height, CubeMipChain & chain,
+	int face, int firstRow, int lastRow, PanoramaFilter filter, PanoramaKernel kernel)
+{
+	int size = chain.size;
+	std::vector<float> u(size), v(size);
+	unsigned char* faceTexels = &chain.faces[face][0][0];
+	for (int y = firstRow; y < lastRow; y++) {
+		float tc = (2.0f * y + 1.0f) / size - 1.0f;
+		int done = 0;
+		if (kernel == PANORAMA_KERNEL_AVX2) {
+			done = rowCoordsAVX2(face, tc, size, width, height, &u[0], &v[0]);
+		}
+		rowCoordsScalar(face, tc, size, width, height, &u[0], &v[0], done);
+
+		unsigned char* out = faceTexels + (size_t)y * size * 4;
+		if (filter == PANORAMA_BICUBIC) {
+			for (int x = 0; x < size; x++) {
+				filterBicubic(rgba, width, height, u[x], v[x], out + x * 4);
+			}
+		}
+		else {
+			for (int x = 0; x < size; x++) {
+				filterBilinear(rgba, width, height, u[x], v[x], out + x * 4);
+			}
+		}
+	}
+}
+
+void panoramaToCube(const unsigned char* rgba, int width, int height, CubeMipChain & chain,
+	PanoramaFilter filter, ThreadPool & pool)
+{
+	PanoramaKernel kernel = bestPanoramaKernel();
+	for (int face = 0; face < 6; face++) {
+		chain.faces[face].resize(1);
+		chain.faces[face][0].resize((size_t)chain.size * chain.size * 4);
+	}
+
+	std::vector<std::future<void>> bands;
+	for (int face = 0; face < 6; face++) {
+		for (int band = 0; band < BANDS_PER_FACE; band++) {
+			int first = chain.size * band / BANDS_PER_FACE, last = chain.size * (band + 1) / BANDS_PER_FACE;
+			CubeMipChain* target = &chain;
+			bands.push_back(pool.submit([=] {
+				resamplePanorama(rgba, width, height, *target, face, first, last, filter, kernel);
+			}));
+		}
+	}
+	for (auto & band : bands) {
+		band.wait();
+	}
+}
+
+std::shared_future<std::shared_ptr<CubeMipChain>> queuePanoramaToCube(const std::shared_future<DecodedImageRef> & image,
+	PanoramaFilter filter, ThreadPool & pool)
+{
+	struct Source
+	{
+		std::vector<unsigned char> rgba;
+		int width, height;
+		std::shared_ptr<CubeMipChain> chain;
+	};
+
+	// Each stage is queued only once the one before it is done, so no
+	// worker is held waiting on another.
+	std::shared_future<std::shared_ptr<Source>> source = pool.submitAfter([image] {
+		const PPMImage & ppm = image.get()->image;
+		if (ppm.pixels() == nullptr) {
+			return std::shared_ptr<Source>();
+		}
+		std::shared_ptr<Source> expanded = std::make_shared<Source>();
+		expanded->width = ppm.width();
+		expanded->height = ppm.height();
+		expanded->rgba.resize((size_t)ppm.width() * ppm.height() * 4);
+		convertToRGBA8(ppm.pixels(), ppm.type(), &expanded->rgba[0], (size_t)ppm.width() * ppm.height());
+
+		expanded->chain = std::make_shared<CubeMipChain>();
+		expanded->chain->size = panoramaFaceSize(ppm.width());
+		for (int face = 0; face < 6; face++) {
+			expanded->chain->faces[face].resize(1);
+			expanded->chain->faces[face][0].resize((size_t)expanded->chain->size * expanded->chain->size * 4);
+		}
+		return expanded;
+	}, image).share();
+
+	PanoramaKernel kernel = bestPanoramaKernel();
+	std::vector<std::shared_future<void>> bands;
+	for (int face = 0; face < 6; face++) {
+		for (int band = 0; band < BANDS_PER_FACE; band++) {
+			bands.push_back(pool.submitAfter([=] {
+				const Source* expanded = source.get().get();
+				if (expanded != nullptr) {
+					int size = expanded->chain->size;
+					resamplePanorama(&expanded->rgba[0], expanded->width, expanded->height, *expanded->chain, face,
+						size * band / BANDS_PER_FACE, size * (band + 1) / BANDS_PER_FACE, filter, kernel);
+				}
+			}, source).share());
+		}
+	}
+
+	return pool.submitAfter([source] {
+		std::shared_ptr<Source> expanded = source.get();
+		return expanded ? expanded->chain : std::shared_ptr<CubeMipChain>();
+	}, source, bands).share();
+}
@@ -0,0 +1,54 @@
+#ifndef _PANORAMA_H_
+#define _PANORAMA_H_
+
+#include <future>
+#include <memory>
+
+#include "MipGenerator.h"
+#include "TextureCache.h"
+
+class ThreadPool;
+
+// Equirectangular panorama to cube map conversion. Longitude runs across
+// the panorama with -Z in the middle and +X to its right; latitude runs
+// from +90 degrees on the top row to -90 on the bottom row.
+enum PanoramaFilter
+{
+	PANORAMA_BILINEAR,
+	PANORAMA_BICUBIC,	// Catmull-Rom, clamped to the source range
+};
+
+// How texel directions become panorama coordinates: libm atan2 per texel,
+// or eight texels at a time with a polynomial atan2 (error < 1e-6 rad).
+// Filtering uses SSE2 either way.
+enum PanoramaKernel
+{
+	PANORAMA_KERNEL_SCALAR,
+	PANORAMA_KERNEL_AVX2,
+};
+
+PanoramaKernel bestPanoramaKernel();
+const char* panoramaKernelName(PanoramaKernel kernel);
+
+// A quarter of the panorama width, i.e. 90 degrees of longitude per face.
+int panoramaFaceSize(int width);
+
+// Fills rows [firstRow, lastRow) of level 0 of one face from an RGBA8
+// panorama. Level 0 of the face must already be allocated.
+void resamplePanorama(const unsigned char* rgba, int width, int height, CubeMipChain & chain,
+	int face, int firstRow, int lastRow, PanoramaFilter filter, PanoramaKernel kernel);
+
+// Converts all six faces in row bands on pool and waits for them. Must not
+// be called from a job on the same pool.
+void panoramaToCube(const unsigned char* rgba, int width, int height, CubeMipChain & chain,
+	PanoramaFilter filter, ThreadPool & pool);
+
+// Queues the conversion of a panorama that may still be decoding. The
+// RGBA8 expansion and the row bands run on pool once the decode, a job on
+// the same pool, is done, so the result can be polled from the GL thread or
+// given to ThreadPool::submitAfter. The chain
+// holds level 0 only, or is null if the image could not be loaded.
+std::shared_future<std::shared_ptr<CubeMipChain>> queuePanoramaToCube(const std::shared_future<DecodedImageRef> & image,
+	PanoramaFilter filter, ThreadPool & pool);
+
+#endif
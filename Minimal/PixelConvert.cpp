@@ -0,0 +1,180 @@
+#include "PixelConvert.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <tmmintrin.h>
+
+namespace {
+
+	void expandScalar(const unsigned char* src, unsigned char* dst, size_t texels)
+	{
+		for (size_t i = 0; i < texels; i++) {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = 0xff;
+			src += 3;
+			dst += 4;
+		}
+	}
+
+	void narrowScalar(const unsigned char* src, unsigned char* dst, size_t samples)
+	{
+		for (size_t i = 0; i < samples; i++) {
+			unsigned int v = (src[0] << 8) | src[1];
+			dst[i] = (unsigned char)((v * 255 + 32767) / 65535);
+			src += 2;
+		}
+	}
+
+	// Spreads texels 0-3 of the low 12 bytes into four RGBA texels.
+	CPU_TARGET_SSSE3
+	inline __m128i expand4(__m128i rgb)
+	{
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+		return _mm_or_si128(_mm_shuffle_epi8(rgb, spread), alpha);
+	}
+
+	// 16 texels per iteration from three loads, so nothing is read past the
+	// end of the source.
+	CPU_TARGET_SSSE3
+	size_t expandSSSE3(const unsigned char* src, unsigned char* dst, size_t texels)
+	{
+		size_t i = 0;
+		for (; i + 16 <= texels; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + i * 3 + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(src + i * 3 + 32));
+			_mm_storeu_si128((__m128i*)(dst + i * 4), expand4(a));
+			_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), expand4(_mm_alignr_epi8(b, a, 12)));
+			_mm_storeu_si128((__m128i*)(dst + i * 4 + 32), expand4(_mm_alignr_epi8(c, b, 8)));
+			_mm_storeu_si128((__m128i*)(dst + i * 4 + 48), expand4(_mm_srli_si128(c, 4)));
+		}
+		return i;
+	}
+
+	// Eight texels per 32-byte load: a cross-lane permute puts bytes 0-11
+	// and 12-23 at the bottom of each 128-bit lane for the in-lane shuffle.
+	// The load covers 32 bytes, so the loop stops while 11 texels remain.
+	CPU_TARGET_AVX2
+	size_t expandAVX2(const unsigned char* src, unsigned char* dst, size_t texels)
+	{
+		const __m256i split = _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5);
+		const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+		size_t i = 0;
+		for (; i + 11 <= texels; i += 8) {
+			__m256i rgb = _mm256_loadu_si256((const __m256i*)(src + i * 3));
+			__m256i rgba = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(rgb, split), spread);
+			_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(rgba, alpha));
+		}
+		return i;
+	}
+
+	// Big-endian 16-bit samples to 8 bits; 16 bytes is always a whole
+	// number of samples. round(v / 257) is ((v * 0xff01 >> 16) + 128) >> 8
+	// for every 16-bit v.
+	CPU_TARGET_SSSE3
+	size_t narrowSSSE3(const unsigned char* src, unsigned char* dst, size_t samples)
+	{
+		const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		const __m128i scale = _mm_set1_epi16((short)0xff01);
+		const __m128i half = _mm_set1_epi16(128);
+		size_t i = 0;
+		for (; i + 16 <= samples; i += 16) {
+			__m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 2)), swap);
+			__m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 2 + 16)), swap);
+			lo = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(lo, scale), half), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(hi, scale), half), 8);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+		}
+		return i;
+	}
+
+	CPU_TARGET_AVX2
+	size_t narrowAVX2(const unsigned char* src, unsigned char* dst, size_t samples)
+	{
+		const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		const __m256i scale = _mm256_set1_epi16((short)0xff01);
+		const __m256i half = _mm256_set1_epi16(128);
+		size_t i = 0;
+		for (; i + 32 <= samples; i += 32) {
+			__m256i lo = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i * 2)), swap);
+			__m256i hi = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i * 2 + 32)), swap);
+			lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mulhi_epu16(lo, scale), half), 8);
+			hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mulhi_epu16(hi, scale), half), 8);
+			// packus interleaves the lanes; restore sample order.
+			__m256i packed = _mm256_packus_epi16(lo, hi);
+			_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+		return i;
+	}
+}
+
+PixelKernel bestPixelKernel()
+{
+	static const PixelKernel best = CpuFeatures::get().avx2 ? PIXEL_KERNEL_AVX2
+		: (CpuFeatures::get().ssse3 ? PIXEL_KERNEL_SSSE3 : PIXEL_KERNEL_SCALAR);
+	return best;
+}
+
+const char* pixelKernelName(PixelKernel kernel)
+{
+	switch (kernel) {
+	case PIXEL_KERNEL_AVX2:
+		return "avx2";
+	case PIXEL_KERNEL_SSSE3:
+		return "ssse3";
+	default:
+		return "scalar";
+	}
+}
+
+void expandRGB8ToRGBA8(const unsigned char* src, unsigned char* dst, size_t texels, PixelKernel kernel)
+{
+	size_t done = 0;
+	if (kernel == PIXEL_KERNEL_AVX2) {
+		done = expandAVX2(src, dst, texels);
+	}
+	if (kernel != PIXEL_KERNEL_SCALAR) {
+		done += expandSSSE3(src + done * 3, dst + done * 4, texels - done);
+	}
+	expandScalar(src + done * 3, dst + done * 4, texels - done);
+}
+
+void narrowRGB16ToRGBA8(const unsigned char* src, unsigned char* dst, size_t texels, PixelKernel kernel)
+{
+	// Narrow a block of samples to RGB8 on the stack, then expand it, so
+	// both steps stay in cache.
+	const size_t blockTexels = 256;
+	unsigned char rgb[blockTexels * 3];
+	for (size_t first = 0; first < texels; first += blockTexels) {
+		size_t samples = std::min(blockTexels, texels - first) * 3;
+		const unsigned char* in = src + first * 6;
+		size_t done = 0;
+		if (kernel == PIXEL_KERNEL_AVX2) {
+			done = narrowAVX2(in, rgb, samples);
+		}
+		if (kernel != PIXEL_KERNEL_SCALAR) {
+			done += narrowSSSE3(in + done * 2, rgb + done, samples - done);
+		}
+		narrowScalar(in + done * 2, rgb + done, samples - done);
+		expandRGB8ToRGBA8(rgb, dst + first * 4, samples / 3, kernel);
+	}
+}
+
+void convertToRGBA8(const unsigned char* src, GLenum type, unsigned char* dst, size_t texels)
+{
+	if (type == GL_UNSIGNED_SHORT) {
+		narrowRGB16ToRGBA8(src, dst, texels, bestPixelKernel());
+	}
+	else {
+		expandRGB8ToRGBA8(src, dst, texels, bestPixelKernel());
+	}
+}
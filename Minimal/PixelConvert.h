@@ -0,0 +1,31 @@
+#ifndef _PIXEL_CONVERT_H_
+#define _PIXEL_CONVERT_H_
+
+#include <GL\glew.h>
+
+#include <stddef.h>
+
+// Conversions from PPM rasters to RGBA8, the layout drivers upload without
+// a swizzle. The kernels have SSSE3 and AVX2 versions chosen at run time,
+// with a scalar fallback; all of them produce identical output.
+enum PixelKernel
+{
+	PIXEL_KERNEL_SCALAR,
+	PIXEL_KERNEL_SSSE3,
+	PIXEL_KERNEL_AVX2,
+};
+
+PixelKernel bestPixelKernel();
+const char* pixelKernelName(PixelKernel kernel);
+
+// Tightly packed RGB8 to RGBA8 with opaque alpha.
+void expandRGB8ToRGBA8(const unsigned char* src, unsigned char* dst, size_t texels, PixelKernel kernel);
+
+// Big-endian RGB16, as stored in PPM files, to RGBA8. Each sample is
+// rounded to the nearest 8-bit value, v * 255 / 65535.
+void narrowRGB16ToRGBA8(const unsigned char* src, unsigned char* dst, size_t texels, PixelKernel kernel);
+
+// Either of the above for a PPM sample type, with the best kernel.
+void convertToRGBA8(const unsigned char* src, GLenum type, unsigned char* dst, size_t texels);
+
+#endif
@@ -0,0 +1,201 @@
+#include "Program.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+namespace {
+	const char* const SETTER_NAMES[] = { "an int", "a float", "a vec3", "a mat4" };
+}
+
+Program::Program(GLuint id)
+	: id_(id), uploads_(0), skipped_(0)
+{
+	reflect();
+}
+
+void Program::replace(GLuint id)
+{
+	id_ = id;
+	uniforms.clear();
+	attributes.clear();
+	reflect();
+}
+
+bool Program::accepts(GLenum type, SetterType setter)
+{
+	switch (setter) {
+	case SET_INT:
+		switch (type) {
+		case GL_INT: case GL_BOOL:
+		case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_2D_RECT: case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_MULTISAMPLE:
+		case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+		case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE: case GL_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+		case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+			return true;
+		}
+		return false;
+	case SET_FLOAT:
+		return type == GL_FLOAT;
+	case SET_VEC3:
+		return type == GL_FLOAT_VEC3;
+	default:
+		return type == GL_FLOAT_MAT4;
+	}
+}
+
+Program::UniformHandle Program::uniform(const char* name)
+{
+	auto found = handles.find(name);
+	if (found != handles.end()) {
+		UniformHandle handle = { found->second };
+		return handle;
+	}
+	UniformHandle handle = { (int)handleUniforms.size() };
+	int index = -1;
+	for (size_t i = 0; i < uniforms.size() && index < 0; i++) {
+		if (uniforms[i].name == name) {
+			index = (int)i;
+		}
+	}
+	handles[name] = handle.index;
+	handleUniforms.push_back(index);
+	return handle;
+}
+
+void Program::reflect()
+{
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> name(maxLength + 1);
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		GLsizei length = 0;
+		glGetActiveUniform(id_, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+		Uniform uniform;
+		uniform.name.assign(&name[0], length);
+		// Arrays are reported as "name[0]"; the setters take the bare name.
+		if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0) {
+			uniform.name.resize(uniform.name.size() - 3);
+		}
+		uniform.location = glGetUniformLocation(id_, &name[0]);
+		uniform.type = type;
+		uniform.known = false;
+		uniform.warned = false;
+		// Members of uniform blocks have no location and are not set here.
+		if (uniform.location >= 0) {
+			uniforms.push_back(uniform);
+		}
+	}
+
+	// Handles made for the previous version point at this one's uniforms.
+	std::fill(handleUniforms.begin(), handleUniforms.end(), -1);
+	for (size_t i = 0; i < uniforms.size(); i++) {
+		auto found = handles.find(uniforms[i].name);
+		if (found != handles.end()) {
+			handleUniforms[found->second] = (int)i;
+		}
+	}
+
+	count = maxLength = 0;
+	glGetProgramiv(id_, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(id_, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	name.assign(maxLength + 1, 0);
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		GLsizei length = 0;
+		glGetActiveAttrib(id_, i, (GLsizei)name.size(), &length, &size, &type, &name[0]);
+		Attribute attribute;
+		attribute.name.assign(&name[0], length);
+		attribute.location = glGetAttribLocation(id_, &name[0]);
+		attributes.push_back(attribute);
+	}
+}
+
+GLint Program::uniformLocation(const char* name) const
+{
+	for (const auto & uniform : uniforms) {
+		if (uniform.name == name) {
+			return uniform.location;
+		}
+	}
+	return -1;
+}
+
+GLint Program::attributeLocation(const char* name) const
+{
+	for (const auto & attribute : attributes) {
+		if (attribute.name == name) {
+			return attribute.location;
+		}
+	}
+	return -1;
+}
+
+void Program::bindBlock(const char* name, GLuint binding) const
+{
+	GLuint index = glGetUniformBlockIndex(id_, name);
+	if (index != GL_INVALID_INDEX) {
+		glUniformBlockBinding(id_, index, binding);
+	}
+}
+
+Program::Uniform* Program::changed(UniformHandle handle, SetterType type, const void* value, size_t bytes)
+{
+	int index = handleUniforms[handle.index];
+	if (index < 0) {
+		return nullptr;
+	}
+	Uniform & uniform = uniforms[index];
+	if (!accepts(uniform.type, type)) {
+		if (!uniform.warned) {
+			std::cerr << "Program " << id_ << ": uniform " << uniform.name << " has GL type 0x" << std::hex
+				<< uniform.type << std::dec << " but was set with " << SETTER_NAMES[type] << "; ignored" << std::endl;
+			uniform.warned = true;
+		}
+		return nullptr;
+	}
+	if (uniform.known && memcmp(uniform.value, value, bytes) == 0) {
+		++skipped_;
+		return nullptr;
+	}
+	memcpy(uniform.value, value, bytes);
+	uniform.known = true;
+	++uploads_;
+	return &uniform;
+}
+
+void Program::set(UniformHandle handle, GLint value)
+{
+	if (Uniform* uniform = changed(handle, SET_INT, &value, sizeof(value))) {
+		glProgramUniform1i(id_, uniform->location, value);
+	}
+}
+
+void Program::set(UniformHandle handle, GLfloat value)
+{
+	if (Uniform* uniform = changed(handle, SET_FLOAT, &value, sizeof(value))) {
+		glProgramUniform1f(id_, uniform->location, value);
+	}
+}
+
+void Program::set(UniformHandle handle, const glm::vec3 & value)
+{
+	if (Uniform* uniform = changed(handle, SET_VEC3, &value[0], sizeof(GLfloat) * 3)) {
+		glProgramUniform3fv(id_, uniform->location, 1, &value[0]);
+	}
+}
+
+void Program::set(UniformHandle handle, const glm::mat4 & value)
+{
+	if (Uniform* uniform = changed(handle, SET_MAT4, &value[0][0], sizeof(GLfloat) * 16)) {
+		glProgramUniformMatrix4fv(id_, uniform->location, 1, GL_FALSE, &value[0][0]);
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include <GL\glew.h>
+#include <glm\glm.hpp>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A linked shader program with its active uniforms and attributes read
+// back once, after linking. The setters find uniforms by name through a
+// hash of that list, or through a UniformHandle looked up once, rather than
+// asking the driver, and skip the upload when the uniform already holds
+// the value. A value of another type than the shader declares is not
+// uploaded, and reported once per uniform. They write through
+// glProgramUniform, so the program does not have to be bound. Names the
+// program does not use (for instance ones the compiler optimised away) are
+// ignored.
+//
+// Uniform values belong to the program object, so there must be only one
+// Program per GL program; ProgramCache hands them out. The GL program is
+// owned by the cache, not by this object.
+class Program
+{
+public:
+	explicit Program(GLuint id);
+	// Takes over a newly linked version of the program (a hot reload) and
+	// reflects it again; every uniform is uploaded on its next set.
+	void replace(GLuint id);
+
+	GLuint id() const { return id_; }
+	void use() const { glUseProgram(id_); }
+	// -1 when the program has no such active uniform or attribute.
+	GLint uniformLocation(const char* name) const;
+	GLint attributeLocation(const char* name) const;
+	// GLSL 3.30 cannot give a uniform block its binding point in the
+	// shader, so it is set here. Does nothing if the block is inactive.
+	void bindBlock(const char* name, GLuint binding) const;
+
+	// A uniform found once by name. It stays valid across replace(), and
+	// refers to nothing while the name is not an active uniform.
+	struct UniformHandle
+	{
+		int index;
+	};
+	UniformHandle uniform(const char* name);
+
+	// Ints also set bools and samplers.
+	void set(const char* name, GLint value) { set(uniform(name), value); }
+	void set(const char* name, GLfloat value) { set(uniform(name), value); }
+	void set(const char* name, const glm::vec3 & value) { set(uniform(name), value); }
+	void set(const char* name, const glm::mat4 & value) { set(uniform(name), value); }
+	void set(UniformHandle uniform, GLint value);
+	void set(UniformHandle uniform, GLfloat value);
+	void set(UniformHandle uniform, const glm::vec3 & value);
+	void set(UniformHandle uniform, const glm::mat4 & value);
+
+	// Uploads made and skipped since the program was created.
+	size_t uploads() const { return uploads_; }
+	size_t skipped() const { return skipped_; }
+
+private:
+	struct Uniform
+	{
+		std::string name;
+		GLint location;
+		GLenum type;
+		bool known;				// value holds what the program has
+		bool warned;			// a mismatched set has been reported
+		GLfloat value[16];
+	};
+
+	// What a setter writes, checked against Uniform::type.
+	enum SetterType { SET_INT, SET_FLOAT, SET_VEC3, SET_MAT4 };
+	static bool accepts(GLenum type, SetterType setter);
+
+	struct Attribute
+	{
+		std::string name;
+		GLint location;
+	};
+
+	void reflect();
+	// The uniform to upload to, or null if the handle refers to nothing,
+	// the uniform is not of type or value (bytes long) is what it already
+	// holds; records the new value.
+	Uniform* changed(UniformHandle handle, SetterType type, const void* value, size_t bytes);
+
+	GLuint id_;
+	std::vector<Uniform> uniforms;
+	// Every name a handle was made for, with the handle, and the index
+	// into uniforms each handle stands for now, or -1.
+	std::unordered_map<std::string, int> handles;
+	std::vector<int> handleUniforms;
+	std::vector<Attribute> attributes;
+	size_t uploads_, skipped_;
+};
+
+#endif
@@ -0,0 +1,419 @@
+#include "ProgramCache.h"
+#include "FileWatcher.h"
+#include "Resources.h"
+#include "ShaderCompiler.h"
+#include "shader.h"
+#include "TextureCache.h"
+#include "ViewUniforms.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+	const char CACHE_FILE_MAGIC[4] = { 'P', 'B', 'I', 'N' };
+	const uint32_t CACHE_FILE_VERSION = 1;
+
+	struct CacheFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t driverHash;
+		uint32_t count;
+		uint32_t reserved;
+	};
+
+	struct CacheFileEntry
+	{
+		uint64_t key;
+		uint32_t format;
+		uint32_t size;
+	};
+
+	// 64-bit FNV-1a; the strings are separated so "ab" + "c" and "a" + "bc"
+	// hash differently.
+	uint64_t hashString(uint64_t hash, const std::string & text)
+	{
+		for (unsigned char c : text) {
+			hash = (hash ^ c) * 1099511628211ull;
+		}
+		return (hash ^ 0xff) * 1099511628211ull;
+	}
+
+	const uint64_t HASH_BASIS = 14695981039346656037ull;
+
+	std::string glString(GLenum name)
+	{
+		const GLubyte* value = glGetString(name);
+		return value != nullptr ? std::string((const char*)value) : std::string();
+	}
+}
+
+ProgramCache & ProgramCache::instance()
+{
+	static ProgramCache cache(Resources::cachePath("shaders.cache"));
+	return cache;
+}
+
+ProgramCache::ProgramCache(const std::string & cacheFile)
+	: cacheFile(cacheFile), started(false), binaries_(false), driverHash(0), dirty(false), watcher(nullptr),
+	shared_(0), binaryHits_(0), binaryRejects_(0), compiles_(0), reloads_(0), reloadFailures_(0), millis_(0.0)
+{
+}
+
+ProgramCache::~ProgramCache()
+{
+}
+
+void ProgramCache::start()
+{
+	// Needs a current context, so it waits for the first load.
+	started = true;
+	driverHash = hashString(hashString(hashString(HASH_BASIS, glString(GL_VENDOR)), glString(GL_RENDERER)),
+		glString(GL_VERSION));
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	binaries_ = formats > 0 && !cacheFile.empty();
+	if (binaries_) {
+		readCacheFile();
+	}
+}
+
+Program* ProgramCache::load(const char* vertexPath, const char* fragmentPath, unsigned features)
+{
+	return loadVariants(vertexPath, fragmentPath, std::vector<unsigned>(1, features))[0];
+}
+
+std::vector<Program*> ProgramCache::loadVariants(const char* vertexPath, const char* fragmentPath,
+	const std::vector<unsigned> & featureSets)
+{
+	std::vector<Program*> loaded(featureSets.size(), nullptr);
+	if (!started) {
+		start();
+	}
+
+	std::string vertexSource, fragmentSource;
+	if (!ReadShaderFile(vertexPath, vertexSource) || !ReadShaderFile(fragmentPath, fragmentSource)) {
+		return loaded;
+	}
+
+	// Every variant's compile is issued before any is checked, so a driver
+	// that compiles in the background works on them together.
+	struct Variant
+	{
+		size_t index;
+		uint64_t key;
+		GLuint program;
+		bool compiled;
+		std::chrono::high_resolution_clock::time_point begin;
+	};
+	std::vector<Variant> variants;
+	for (size_t i = 0; i < featureSets.size(); i++) {
+		Variant variant;
+		variant.index = i;
+		variant.begin = std::chrono::high_resolution_clock::now();
+		std::string vertexVariant = InjectShaderDefines(vertexSource, featureSets[i]);
+		std::string fragmentVariant = InjectShaderDefines(fragmentSource, featureSets[i]);
+		variant.key = hashString(hashString(HASH_BASIS, vertexVariant), fragmentVariant);
+
+		auto found = programs.find(variant.key);
+		if (found != programs.end()) {
+			++shared_;
+			loaded[i] = found->second.program.get();
+			continue;
+		}
+		bool duplicate = false;
+		for (const auto & other : variants) {
+			duplicate = duplicate || other.key == variant.key;
+		}
+		if (duplicate) {
+			continue;
+		}
+		variant.program = binaries_ ? loadBinary(variant.key) : 0;
+		variant.compiled = variant.program == 0;
+		if (variant.compiled) {
+			variant.program = BeginProgram(vertexPath, vertexVariant, fragmentPath, fragmentVariant, binaries_);
+			++compiles_;
+		}
+		variants.push_back(variant);
+	}
+
+	for (const auto & variant : variants) {
+		if (variant.compiled) {
+			FinishProgram(variant.program);
+			if (binaries_) {
+				saveBinary(variant.key, variant.program);
+			}
+		}
+		Program* reflected = new Program(variant.program);
+		bindBlocks(*reflected);
+		Entry & entry = programs[variant.key];
+		entry.program.reset(reflected);
+		entry.vertexPath = vertexPath;
+		entry.fragmentPath = fragmentPath;
+		entry.vertexFile = TextureCache::canonicalPath(Resources::diskPath(vertexPath).c_str());
+		entry.fragmentFile = TextureCache::canonicalPath(Resources::diskPath(fragmentPath).c_str());
+		entry.features = featureSets[variant.index];
+		entry.requested = variant.key;
+		if (watcher != nullptr) {
+			watchEntry(entry);
+		}
+
+		double millis = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - variant.begin).count();
+		millis_ += millis;
+		std::cout << "ProgramCache: " << vertexPath << " + " << fragmentPath;
+		if (entry.features != 0) {
+			std::cout << " (features " << entry.features << ")";
+		}
+		std::cout << " " << (variant.compiled ? "compiled" : "binary") << " in " << millis << " ms" << std::endl;
+	}
+	// Duplicate feature sets share the first one's program.
+	for (size_t i = 0; i < featureSets.size(); i++) {
+		if (loaded[i] == nullptr) {
+			loaded[i] = load(vertexPath, fragmentPath, featureSets[i]);
+		}
+	}
+	writeCacheFile();
+	return loaded;
+}
+
+void ProgramCache::bindBlocks(const Program & program) const
+{
+	// Mono shaders have one View block, stereo ones an array of two and
+	// layered ones the Layers block.
+	program.bindBlock(ViewUniforms::BLOCK_NAME, ViewUniforms::BINDING);
+	program.bindBlock((std::string(ViewUniforms::BLOCK_NAME) + "[0]").c_str(), ViewUniforms::BINDING);
+	program.bindBlock((std::string(ViewUniforms::BLOCK_NAME) + "[1]").c_str(), ViewUniforms::RIGHT_BINDING);
+	program.bindBlock(ViewUniforms::LAYERS_BLOCK_NAME, ViewUniforms::LAYERS_BINDING);
+}
+
+GLuint ProgramCache::loadBinary(uint64_t key)
+{
+	auto found = binaries.find(key);
+	if (found == binaries.end()) {
+		return 0;
+	}
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, found->second.format, &found->second.bytes[0], (GLsizei)found->second.bytes.size());
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE) {
+		// Drivers may refuse a binary for reasons the tag does not capture.
+		glDeleteProgram(program);
+		binaries.erase(found);
+		++binaryRejects_;
+		return 0;
+	}
+	++binaryHits_;
+	return program;
+}
+
+void ProgramCache::saveBinary(uint64_t key, GLuint program)
+{
+	GLint linked = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (linked != GL_TRUE || length <= 0) {
+		return;
+	}
+	Binary & binary = binaries[key];
+	binary.bytes.resize(length);
+	glGetProgramBinary(program, length, nullptr, &binary.format, &binary.bytes[0]);
+	dirty = true;
+}
+
+void ProgramCache::readCacheFile()
+{
+	FILE* fp = fopen(cacheFile.c_str(), "rb");
+	if (fp == NULL) {
+		return;
+	}
+	CacheFileHeader header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, CACHE_FILE_MAGIC, 4) != 0
+		|| header.version != CACHE_FILE_VERSION || header.driverHash != driverHash) {
+		// Another driver's binaries; the file is rewritten on the first compile.
+		fclose(fp);
+		return;
+	}
+	for (uint32_t i = 0; i < header.count; i++) {
+		CacheFileEntry entry;
+		Binary binary;
+		if (fread(&entry, sizeof(entry), 1, fp) != 1 || entry.size == 0 || entry.size > 64 * 1024 * 1024) {
+			break;
+		}
+		binary.format = entry.format;
+		binary.bytes.resize(entry.size);
+		if (fread(&binary.bytes[0], 1, entry.size, fp) != entry.size) {
+			break;
+		}
+		binaries[entry.key] = std::move(binary);
+	}
+	fclose(fp);
+}
+
+void ProgramCache::writeCacheFile()
+{
+	if (!dirty) {
+		return;
+	}
+	dirty = false;
+	FILE* fp = fopen(cacheFile.c_str(), "wb");
+	if (fp == NULL) {
+		std::cerr << "ProgramCache: could not write " << cacheFile << std::endl;
+		return;
+	}
+	CacheFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_FILE_MAGIC, 4);
+	header.version = CACHE_FILE_VERSION;
+	header.driverHash = driverHash;
+	header.count = (uint32_t)binaries.size();
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for (auto it = binaries.begin(); ok && it != binaries.end(); ++it) {
+		CacheFileEntry entry = { it->first, it->second.format, (uint32_t)it->second.bytes.size() };
+		ok = fwrite(&entry, sizeof(entry), 1, fp) == 1
+			&& fwrite(&it->second.bytes[0], 1, it->second.bytes.size(), fp) == it->second.bytes.size();
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		std::cerr << "ProgramCache: short write to " << cacheFile << std::endl;
+	}
+}
+
+void ProgramCache::watch(FileWatcher & watcher)
+{
+	this->watcher = &watcher;
+	for (const auto & entry : programs) {
+		watchEntry(entry.second);
+	}
+}
+
+void ProgramCache::watchEntry(const Entry & entry)
+{
+	// Embedded copies cannot change.
+	if (Resources::onDisk(entry.vertexPath.c_str())) {
+		watcher->watch(entry.vertexFile);
+	}
+	if (Resources::onDisk(entry.fragmentPath.c_str())) {
+		watcher->watch(entry.fragmentFile);
+	}
+}
+
+void ProgramCache::reloadShaders(const std::vector<std::string> & changed)
+{
+	for (auto & it : programs) {
+		Entry & entry = it.second;
+		bool edited = false;
+		for (const auto & file : changed) {
+			edited = edited || file == entry.vertexFile || file == entry.fragmentFile;
+		}
+		if (!edited) {
+			continue;
+		}
+		// Read here rather than on the compiler's thread so the key is known;
+		// they are small files.
+		ShaderCompiler::Job job;
+		job.vertexPath = entry.vertexPath;
+		job.fragmentPath = entry.fragmentPath;
+		if (!ReadShaderFile(entry.vertexPath.c_str(), job.vertexSource)
+			|| !ReadShaderFile(entry.fragmentPath.c_str(), job.fragmentSource)) {
+			std::cerr << "ProgramCache: keeping " << entry.vertexPath << " + " << entry.fragmentPath
+				<< " as it was" << std::endl;
+			continue;
+		}
+		job.vertexSource = InjectShaderDefines(job.vertexSource, entry.features);
+		job.fragmentSource = InjectShaderDefines(job.fragmentSource, entry.features);
+		uint64_t key = hashString(hashString(HASH_BASIS, job.vertexSource), job.fragmentSource);
+		if (key == entry.requested) {
+			// Saved without a change, or back to what is being built.
+			continue;
+		}
+		if (!compiler) {
+			compiler.reset(new ShaderCompiler());
+		}
+		entry.requested = key;
+		job.tag = key;
+		job.retrievable = binaries_;
+		compiler->compile(job);
+	}
+	if (compiler) {
+		swapReloaded();
+	}
+}
+
+void ProgramCache::swapReloaded()
+{
+	for (const auto & result : compiler->finished()) {
+		auto it = programs.begin();
+		while (it != programs.end() && it->second.requested != result.tag) {
+			++it;
+		}
+		if (it == programs.end() || it->first == result.tag) {
+			// Superseded by a later edit, or edited back to what is running.
+			glDeleteProgram(result.program);
+			continue;
+		}
+		Entry & entry = it->second;
+		if (!result.linked) {
+			++reloadFailures_;
+			std::cerr << "ProgramCache: " << entry.vertexPath << " + " << entry.fragmentPath
+				<< " did not link; keeping the running version" << std::endl;
+			glDeleteProgram(result.program);
+			entry.requested = it->first;
+			continue;
+		}
+
+		++reloads_;
+		GLuint old = entry.program->id();
+		entry.program->replace(result.program);
+		bindBlocks(*entry.program);
+		glDeleteProgram(old);
+		std::cout << "ProgramCache: reloaded " << entry.vertexPath << " + " << entry.fragmentPath << " in "
+			<< result.millis << " ms" << (compiler->parallel() ? " (parallel compile)" : "") << std::endl;
+
+		// File it under its new sources, unless another program already has
+		// them, and keep the binary of the new version only. Fetching and
+		// writing it waits for shutdown, off the frame.
+		if (programs.find(result.tag) == programs.end()) {
+			dirty = binaries.erase(it->first) > 0 || dirty;
+			unsaved.erase(it->first);
+			if (binaries_) {
+				unsaved.insert(result.tag);
+			}
+			programs[result.tag] = std::move(entry);
+			programs.erase(it);
+		}
+	}
+}
+
+void ProgramCache::shutdown()
+{
+	compiler.reset();
+	for (uint64_t key : unsaved) {
+		auto found = programs.find(key);
+		if (found != programs.end()) {
+			saveBinary(key, found->second.program->id());
+		}
+	}
+	unsaved.clear();
+	if (binaries_) {
+		writeCacheFile();
+	}
+}
+
+void ProgramCache::report(std::ostream & out) const
+{
+	size_t uploads = 0, skipped = 0;
+	for (const auto & program : programs) {
+		uploads += program.second.program->uploads();
+		skipped += program.second.program->skipped();
+	}
+	out << "ProgramCache: " << programs.size() << " program(s), " << shared_ << " shared, " << binaryHits_
+		<< " from binaries, " << compiles_ << " compiled, " << binaryRejects_ << " binaries rejected, "
+		<< millis_ << " ms" << (binaries_ ? "" : cacheFile.empty() ? " (nowhere to keep program binaries)" : " (no program binary support)") << "; uniforms " << uploads
+		<< " uploaded, " << skipped << " unchanged; " << reloads_ << " reloaded, " << reloadFailures_
+		<< " failed to reload" << std::endl;
+}
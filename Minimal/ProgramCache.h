@@ -0,0 +1,110 @@
+#ifndef _PROGRAM_CACHE_H_
+#define _PROGRAM_CACHE_H_
+
+#include <GL\glew.h>
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Program.h"
+
+class FileWatcher;
+class ShaderCompiler;
+
+// Process-wide cache of linked shader programs, keyed by a hash of the
+// shader sources. Loading the same sources twice returns the same program.
+// Where the driver supports program binaries, each program's binary is
+// also kept in one cache file between runs (see Resources::cachePath), so
+// later launches skip the compile and link. The file is tagged with the
+// vendor, renderer and version strings and is discarded when the driver
+// changes. A binary the driver rejects is compiled from source and
+// replaced. The file is written once per loadVariants() that compiled
+// something, and for reloaded programs only at shutdown(), never in the
+// middle of a frame.
+//
+// Once watching, edited shader files are compiled again in the background
+// (see ShaderCompiler) and each Program switches to the new version between
+// frames, only after it links; on failure the old version stays in use.
+// Pointers handed out by load() stay valid across reloads. GL thread only.
+class ProgramCache
+{
+public:
+	static ProgramCache & instance();
+	~ProgramCache();
+
+	// The program for the pair of shader files built with features (see
+	// ShaderFeature), or null if one cannot be read. The cache keeps
+	// ownership.
+	Program* load(const char* vertexPath, const char* fragmentPath, unsigned features = 0);
+	// load() for several feature sets at once, with the compiles overlapped.
+	std::vector<Program*> loadVariants(const char* vertexPath, const char* fragmentPath,
+		const std::vector<unsigned> & featureSets);
+	void report(std::ostream & out) const;
+
+	// Registers the files of every program, loaded now or later.
+	void watch(FileWatcher & watcher);
+	// Starts compiling the programs using any of changed (from
+	// FileWatcher::changes), and swaps in those that have finished.
+	// Never waits for the compiler.
+	void reloadShaders(const std::vector<std::string> & changed);
+	// Stops the background compiler and saves the binaries of reloaded
+	// programs; call before the context goes away.
+	void shutdown();
+
+private:
+	// No binaries are kept when cacheFile is empty.
+	explicit ProgramCache(const std::string & cacheFile);
+	ProgramCache(const ProgramCache &);
+	ProgramCache & operator=(const ProgramCache &);
+
+	struct Binary
+	{
+		GLenum format;
+		std::vector<unsigned char> bytes;
+	};
+
+	struct Entry
+	{
+		std::unique_ptr<Program> program;
+		std::string vertexPath, fragmentPath;
+		// Canonical, as FileWatcher reports them.
+		std::string vertexFile, fragmentFile;
+		unsigned features;
+		// Key of the newest sources sent to the compiler; results for
+		// older ones are dropped.
+		uint64_t requested;
+	};
+
+	void start();
+	GLuint loadBinary(uint64_t key);
+	void saveBinary(uint64_t key, GLuint program);
+	void readCacheFile();
+	// Writes the cache file if binaries changed since it was last written.
+	void writeCacheFile();
+	void bindBlocks(const Program & program) const;
+	void watchEntry(const Entry & entry);
+	void swapReloaded();
+
+	std::string cacheFile;
+	bool started;
+	bool binaries_;
+	uint64_t driverHash;
+	std::map<uint64_t, Entry> programs;
+	std::map<uint64_t, Binary> binaries;
+	// binaries differs from the cache file.
+	bool dirty;
+	// Reloaded programs whose binaries are fetched at shutdown().
+	std::set<uint64_t> unsaved;
+	FileWatcher* watcher;
+	std::unique_ptr<ShaderCompiler> compiler;
+
+	int shared_, binaryHits_, binaryRejects_, compiles_, reloads_, reloadFailures_;
+	double millis_;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "Resources.h"
+
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EmbeddedResources.h"
+
+namespace {
+	// The code names its files relative to the working directory it is
+	// started from, through the project directory.
+	const char PROJECT_PREFIX[] = "../Minimal/";
+
+	// path relative to the Minimal directory, or null if it is outside it.
+	const char* projectRelative(const char* path)
+	{
+		size_t length = sizeof(PROJECT_PREFIX) - 1;
+		return strncmp(path, PROJECT_PREFIX, length) == 0 ? path + length : nullptr;
+	}
+
+	std::string findOverrideDirectory()
+	{
+		const char* directory = getenv("MINIMAL_RESOURCE_DIR");
+		if (directory != nullptr && directory[0] != '\0') {
+			std::string path = directory;
+			if (path.back() != '/' && path.back() != '\\') {
+				path += '/';
+			}
+			return path;
+		}
+#ifdef USE_EMBEDDED_RESOURCES
+		return std::string();
+#else
+		return PROJECT_PREFIX;
+#endif
+	}
+}
+
+const std::string & Resources::overrideDirectory()
+{
+	static const std::string directory = findOverrideDirectory();
+	return directory;
+}
+
+const EmbeddedResource* Resources::embedded(const char* path)
+{
+	const char* relative = projectRelative(path);
+	if (relative == nullptr) {
+		return nullptr;
+	}
+	for (const EmbeddedResource* resource = EMBEDDED_RESOURCES; resource->path != nullptr; ++resource) {
+		if (strcmp(resource->path, relative) == 0) {
+			return resource;
+		}
+	}
+	return nullptr;
+}
+
+bool Resources::onDisk(const char* path)
+{
+	return !overrideDirectory().empty() || embedded(path) == nullptr;
+}
+
+std::string Resources::diskPath(const char* path)
+{
+	const char* relative = projectRelative(path);
+	if (relative == nullptr || overrideDirectory().empty()) {
+		return path;
+	}
+	return overrideDirectory() + relative;
+}
+
+std::string Resources::cachePath(const char* name)
+{
+	if (!overrideDirectory().empty()) {
+		return overrideDirectory() + name;
+	}
+#ifdef _WIN32
+	const char* directory = getenv("LOCALAPPDATA");
+#else
+	const char* directory = getenv("XDG_CACHE_HOME");
+#endif
+	if (directory == nullptr || directory[0] == '\0') {
+		return std::string();
+	}
+	// Straight in the directory, which exists, so nothing has to be created;
+	// the prefix keeps it apart from other programs' files.
+	std::string path = directory;
+	if (path.back() != '/' && path.back() != '\\') {
+		path += '/';
+	}
+	return path + "Minimal-" + name;
+}
+
+bool Resources::read(const char* path, std::string & contents)
+{
+	if (!onDisk(path)) {
+		const EmbeddedResource* resource = embedded(path);
+		contents.assign((const char*)resource->data, resource->size);
+		return true;
+	}
+	std::ifstream stream(diskPath(path).c_str(), std::ios::in | std::ios::binary);
+	if (!stream.is_open()) {
+		return false;
+	}
+	stream.seekg(0, std::ios::end);
+	contents.resize((size_t)stream.tellg());
+	stream.seekg(0, std::ios::beg);
+	if (!contents.empty()) {
+		stream.read(&contents[0], contents.size());
+	}
+	return true;
+}
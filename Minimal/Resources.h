@@ -0,0 +1,45 @@
+#ifndef _RESOURCES_H_
+#define _RESOURCES_H_
+
+#include <stddef.h>
+#include <string>
+
+struct EmbeddedResource
+{
+	const char* path;			// relative to the Minimal directory
+	const unsigned char* data;
+	size_t size;
+};
+
+// Files built into the executable by the Embed pre-build step (see
+// Resources.txt), looked up by the paths the code already uses, such as
+// "../Minimal/shader.vert". Files that are not embedded are read from disk.
+//
+// For development an override directory, standing in for the Minimal
+// directory, takes precedence over the embedded copies so files can be
+// edited and hot-reloaded. It comes from the MINIMAL_RESOURCE_DIR
+// environment variable. Release builds define USE_EMBEDDED_RESOURCES and
+// otherwise read only the embedded copies; other builds fall back to
+// "../Minimal".
+class Resources
+{
+public:
+	static const std::string & overrideDirectory();
+
+	// The embedded copy of path, or null.
+	static const EmbeddedResource* embedded(const char* path);
+	// Whether path is read from disk, i.e. worth watching for changes.
+	static bool onDisk(const char* path);
+	// Where path is on disk: under the override directory when one is set.
+	static std::string diskPath(const char* path);
+	// path's contents, from disk or the embedded copy as above.
+	static bool read(const char* path, std::string & contents);
+	// Where to keep a file the program writes for later runs, such as the
+	// program binary cache: in the override directory when there is one,
+	// else in the user's cache directory (LOCALAPPDATA on Windows,
+	// XDG_CACHE_HOME elsewhere). Empty when neither is known, in which case
+	// nothing is kept.
+	static std::string cachePath(const char* name);
+};
+
+#endif
@@ -1,44 +1,22 @@
 #include "ScreenQuad.h"
 
-ScreenQuad::ScreenQuad(int state)
+#include "Program.h"
+#include "ShaderVariants.h"
+#include "WallTargets.h"
+
+ScreenQuad::ScreenQuad(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft)
+	: toWorld(1.0f), walls(nullptr), wall(0)
 {
-	if (state == 0) {
-		//Bottom Left
-		quadVerts[0] = -1.0f;
-		quadVerts[1] = -1.0f;
-		quadVerts[2] = -3.0f;
-		//Bottom Right
-		quadVerts[3] = 1.0f;
-		quadVerts[4] = -1.0f;
-		quadVerts[5] = -3.0f;
-		//Top Left
-		quadVerts[6] = -1.0f;
-		quadVerts[7] = 1.0f;
-		quadVerts[8] = -3.0f;
-		//Top Right
-		quadVerts[9] = 1.0f;
-		quadVerts[10] = 1.0f;
-		quadVerts[11] = -3.0f;
-	}
-	if (state == 1) {
-		//Bottom Left
-		quadVerts[0] = -1.0f;
-		quadVerts[1] = -1.0f;
-		quadVerts[2] = -3.0f;
-		//Bottom Right
-		quadVerts[3] = 1.0f;
-		quadVerts[4] = -1.0f;
-		quadVerts[5] = -3.0f;
-		//Top Left
-		quadVerts[6] = -1.0f;
-		quadVerts[7] = 1.0f;
-		quadVerts[8] = -3.0f;
-		//Top Right
-		quadVerts[9] = 1.0f;
-		quadVerts[10] = 1.0f;
-		quadVerts[11] = -3.0f;
+	// Position, then where it falls on the wall image.
+	const glm::vec3 corners[4] = { lowerLeft, lowerRight, upperLeft, lowerRight + upperLeft - lowerLeft };
+	for (int corner = 0; corner < 4; corner++) {
+		quadVerts[corner * 5 + 0] = corners[corner].x;
+		quadVerts[corner * 5 + 1] = corners[corner].y;
+		quadVerts[corner * 5 + 2] = corners[corner].z;
+		quadVerts[corner * 5 + 3] = (GLfloat)(corner & 1);
+		quadVerts[corner * 5 + 4] = (GLfloat)(corner >> 1);
 	}
-	
+
 	static const GLuint quadI[] = {  // Note that we start from 0!
 									 // Front face
 		0, 1, 2,
@@ -59,74 +37,48 @@ ScreenQuad::ScreenQuad(int state)
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quadI), quadI, GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
 
 
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glBindVertexArray(0);
-
-	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
-	FramebufferName = 0;
-	glGenFramebuffers(1, &FramebufferName);
-	glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-
-	// The texture we're going to render to
-	renderedTexture;
-	glGenTextures(1, &renderedTexture);
-
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
-
-	// Give an empty image to OpenGL ( the last "0" )
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2048, 2048, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	// Poor filtering. Needed !
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	// Set "renderedTexture" as our colour attachement #0
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderedTexture, 0);
-
-	// The depth buffer
-	GLuint depthrenderbuffer;
-	glGenRenderbuffers(1, &depthrenderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 2048, 2048);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
-
-
-	// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-
 }
 
-ScreenQuad::~ScreenQuad() {}
+ScreenQuad::~ScreenQuad()
+{
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+}
 
 
-void ScreenQuad::draw(GLuint shaderProgram, const glm::mat4 &projection, const glm::mat4 &modelview)
+void ScreenQuad::draw(ShaderVariants & shaders, int view, unsigned stereo)
 {
+	if (walls == nullptr) {
+		return;
+	}
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
-	glUseProgram(shaderProgram);
-
-	GLuint texId = glGetUniformLocation(shaderProgram, "texFramebuffer");
-	glUniform1i(texId, 0);
-
-	GLuint MatrixID = glGetUniformLocation(shaderProgram, "projection");
-	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &projection[0][0]);
-
-	MatrixID = glGetUniformLocation(shaderProgram, "modelview");
-	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &modelview[0][0]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, walls->texture());
+	// The wall texture is sRGB and sampled at its one level.
+	Program & program = shaders.get(stereo);
+	program.use();
+	program.set("texFramebuffer", 0);
+	program.set("layer", (GLint)WallTargets::layer(wall, stereo != 0 ? 0 : view));
+	if (stereo != 0) {
+		program.set("rightLayer", (GLint)WallTargets::layer(wall, 1));
+	}
+	program.set("model", toWorld);
 
 	glBindVertexArray(VAO);
-
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	if (stereo == SHADER_STEREO_INSTANCED) {
+		glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, 2);
+	}
+	else {
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	}
 	glBindVertexArray(0);
-	
-
 }
@@ -5,20 +5,30 @@
 #include<glm\glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+class ShaderVariants;
+class WallTargets;
+
+// One CAVE wall as seen from outside it: a quad showing the wall's image.
 class ScreenQuad
 {
 public:
-	ScreenQuad(int state);
+	// The corners are in the world, the fourth opposite lowerLeft.
+	ScreenQuad(const glm::vec3 & lowerLeft, const glm::vec3 & lowerRight, const glm::vec3 & upperLeft);
 	~ScreenQuad();
-	void draw(GLuint, const glm::mat4 &, const glm::mat4 &);
-	GLuint FramebufferName;
-	GLuint renderedTexture;
+	// Shows the wall's layers of walls, the one for each eye. Not owned.
+	void setWall(const WallTargets & walls, int wall) { this->walls = &walls; this->wall = wall; }
+	// Draws with the view bound to ViewUniforms::BINDING, showing view's
+	// layer, or both eyes at once when stereo is SHADER_STEREO_INSTANCED or
+	// SHADER_MULTIVIEW.
+	void draw(ShaderVariants &, int view = 0, unsigned stereo = 0);
 	GLfloat quadVerts[20];
 
 private:
 	glm::mat4 toWorld;
 	GLfloat angle;
 	GLuint VBO, VAO, EBO;
+	const WallTargets* walls;
+	int wall;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "ShaderCompiler.h"
+#include "shader.h"
+
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+	typedef void (APIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+	double millisSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+ShaderCompiler::ShaderCompiler()
+	: parallel_(false), context(nullptr), stopping(false)
+{
+	// Older GLEW builds do not know the extension, so it is looked up here.
+	MaxShaderCompilerThreadsProc maxThreads = nullptr;
+	if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) {
+		maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+	}
+	else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+		maxThreads = (MaxShaderCompilerThreadsProc)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+	}
+	if (maxThreads != nullptr) {
+		// As many compiler threads as the driver likes.
+		maxThreads(0xFFFFFFFF);
+		parallel_ = true;
+		return;
+	}
+
+	// The hidden window takes the hints the main window was made with.
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	context = glfwCreateWindow(1, 1, "shader compiler", nullptr, glfwGetCurrentContext());
+	glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+	if (context == nullptr) {
+		std::cerr << "ShaderCompiler: no shared context; shaders will compile on the render thread" << std::endl;
+		return;
+	}
+	worker = std::thread(&ShaderCompiler::workerLoop, this);
+}
+
+ShaderCompiler::~ShaderCompiler()
+{
+	if (worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+	if (context != nullptr) {
+		glfwDestroyWindow(context);
+	}
+	for (const auto & job : pending) {
+		glDeleteProgram(job.program);
+	}
+	for (const auto & result : done) {
+		glDeleteProgram(result.program);
+	}
+}
+
+void ShaderCompiler::compile(const Job & job)
+{
+	if (worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		wake.notify_one();
+		return;
+	}
+	Pending started;
+	started.start = std::chrono::high_resolution_clock::now();
+	started.job = job;
+	started.program = BeginProgram(job.vertexPath.c_str(), job.vertexSource, job.fragmentPath.c_str(),
+		job.fragmentSource, job.retrievable);
+	pending.push_back(std::move(started));
+}
+
+std::vector<ShaderCompiler::Result> ShaderCompiler::finished()
+{
+	std::vector<Result> results;
+	if (worker.joinable()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		results.swap(done);
+		return results;
+	}
+	// Without the extension (and without a worker) the status queries below
+	// wait for the driver; that is the fallback's cost.
+	while (!pending.empty()) {
+		Pending & front = pending.front();
+		GLint complete = GL_TRUE;
+		if (parallel_) {
+			glGetProgramiv(front.program, GL_COMPLETION_STATUS_KHR, &complete);
+		}
+		if (complete != GL_TRUE) {
+			break;
+		}
+		Result result;
+		result.tag = front.job.tag;
+		result.program = front.program;
+		result.linked = FinishProgram(front.program);
+		result.millis = millisSince(front.start);
+		results.push_back(result);
+		pending.pop_front();
+	}
+	return results;
+}
+
+void ShaderCompiler::workerLoop()
+{
+	glfwMakeContextCurrent(context);
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping) {
+				break;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		Result result;
+		result.tag = job.tag;
+		result.program = BeginProgram(job.vertexPath.c_str(), job.vertexSource, job.fragmentPath.c_str(),
+			job.fragmentSource, job.retrievable);
+		result.linked = FinishProgram(result.program);
+		// The render thread's context may use the program once this returns.
+		glFinish();
+		result.millis = millisSince(start);
+		std::lock_guard<std::mutex> lock(mutex);
+		done.push_back(result);
+	}
+	glfwMakeContextCurrent(nullptr);
+}
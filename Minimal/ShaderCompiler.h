@@ -0,0 +1,77 @@
+#ifndef _SHADER_COMPILER_H_
+#define _SHADER_COMPILER_H_
+
+#include <GL\glew.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// Compiles and links programs without blocking the render thread. Where the
+// driver has KHR_parallel_shader_compile (or the ARB version), the compile
+// is issued on the GL thread and finished() polls GL_COMPLETION_STATUS_KHR,
+// which never waits. Otherwise a worker thread with a hidden context shared
+// with the caller's does the whole compile and link. Either way results are
+// only handed back from finished(), on the GL thread, once they are usable.
+// Construct, call and destroy on the GL thread with its context current.
+class ShaderCompiler
+{
+public:
+	struct Job
+	{
+		uint64_t tag;			// the caller's; handed back in the Result
+		std::string vertexPath, vertexSource;
+		std::string fragmentPath, fragmentSource;
+		bool retrievable;		// see CompileProgram
+	};
+
+	struct Result
+	{
+		uint64_t tag;
+		GLuint program;			// the caller deletes it if !linked
+		bool linked;
+		double millis;
+	};
+
+	ShaderCompiler();
+	~ShaderCompiler();
+
+	void compile(const Job & job);
+	// Jobs completed since the last call, in the order they were queued.
+	std::vector<Result> finished();
+	bool parallel() const { return parallel_; }
+
+private:
+	ShaderCompiler(const ShaderCompiler &);
+	ShaderCompiler & operator=(const ShaderCompiler &);
+
+	struct Pending
+	{
+		Job job;
+		GLuint program;
+		std::chrono::high_resolution_clock::time_point start;
+	};
+
+	void workerLoop();
+
+	bool parallel_;
+	std::deque<Pending> pending;
+
+	// Worker thread, when the driver cannot compile in parallel.
+	GLFWwindow* context;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Job> jobs;
+	std::vector<Result> done;
+	bool stopping;
+	std::thread worker;
+};
+
+#endif
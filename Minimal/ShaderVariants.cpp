@@ -0,0 +1,58 @@
+#include "ShaderVariants.h"
+#include "Program.h"
+#include "ProgramCache.h"
+
+#include <iostream>
+#include <stdexcept>
+
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath)
+	: vertexPath(vertexPath), fragmentPath(fragmentPath)
+{
+	for (auto & variant : variants) {
+		variant = nullptr;
+	}
+}
+
+std::vector<unsigned> ShaderVariants::combinations(const std::vector<unsigned> & bases, unsigned optional)
+{
+	std::vector<unsigned> sets;
+	for (unsigned base : bases) {
+		// Walks the subsets of optional, from all of it down to none.
+		unsigned subset = optional;
+		for (;;) {
+			sets.push_back(base | subset);
+			if (subset == 0) {
+				break;
+			}
+			subset = (subset - 1) & optional;
+		}
+	}
+	return sets;
+}
+
+bool ShaderVariants::preload(const std::vector<unsigned> & featureSets)
+{
+	std::vector<Program*> loaded = ProgramCache::instance().loadVariants(vertexPath.c_str(), fragmentPath.c_str(),
+		featureSets);
+	for (size_t i = 0; i < featureSets.size(); i++) {
+		if (loaded[i] == nullptr) {
+			return false;
+		}
+		variants[featureSets[i]] = loaded[i];
+	}
+	return true;
+}
+
+Program & ShaderVariants::get(unsigned features)
+{
+	Program* & variant = variants[features];
+	if (variant == nullptr) {
+		std::cerr << "ShaderVariants: " << vertexPath << " + " << fragmentPath << " features " << features
+			<< " were not preloaded" << std::endl;
+		variant = ProgramCache::instance().load(vertexPath.c_str(), fragmentPath.c_str(), features);
+		if (variant == nullptr) {
+			throw std::runtime_error("Could not load the shaders");
+		}
+	}
+	return *variant;
+}
@@ -0,0 +1,32 @@
+#ifndef _SHADER_VARIANTS_H_
+#define _SHADER_VARIANTS_H_
+
+#include <string>
+#include <vector>
+
+#include "shader.h"
+
+class Program;
+
+// The feature variants (see ShaderFeature) of one pair of shader files.
+// preload() builds the sets a scene needs up front, together; draw sites
+// then pick a program by feature mask, which is a table lookup. A mask that
+// was not preloaded is built when first asked for, blocking, with a warning.
+class ShaderVariants
+{
+public:
+	ShaderVariants(const char* vertexPath, const char* fragmentPath);
+
+	// Every base combined with every subset of optional.
+	static std::vector<unsigned> combinations(const std::vector<unsigned> & bases, unsigned optional);
+
+	// False if the files could not be read.
+	bool preload(const std::vector<unsigned> & featureSets);
+	Program & get(unsigned features);
+
+private:
+	std::string vertexPath, fragmentPath;
+	Program* variants[1 << SHADER_FEATURE_BITS];
+};
+
+#endif
@@ -1,4 +1,23 @@
 #include "SkyBox.h"
+#include "CubeMapFile.h"
+#include "CubeVideo.h"
+#include "FileWatcher.h"
+#include "MipGenerator.h"
+#include "Panorama.h"
+#include "Program.h"
+#include "PixelConvert.h"
+#include "ShaderVariants.h"
+#include "TextureCache.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
 
 GLfloat skyVerts[] = {
 	// Front skyVerts
@@ -34,7 +53,115 @@ GLuint skyI[] = {  // Note that we start from 0!
 	6, 7, 3
 };
 
-SkyBox::SkyBox(int state)
+namespace {
+	struct BakedFormat
+	{
+		const char* suffix;
+		bool(*supported)();
+	};
+
+	// Candidate .cube files in order of preference.
+	const BakedFormat BAKED_FORMATS[] = {
+		{ ".bc7.cube", [] { return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc; } },
+		{ ".bc1.cube", [] { return GLEW_EXT_texture_compression_s3tc != 0; } },
+		{ ".etc2.cube", [] { return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility; } },
+		{ ".cube", [] { return true; } },
+	};
+	const int BAKED_FORMAT_COUNT = sizeof(BAKED_FORMATS) / sizeof(BAKED_FORMATS[0]);
+
+	// Modification time of path, or false if it does not exist.
+	bool fileTime(const char* path, time_t & modified)
+	{
+		struct stat info;
+		if (stat(path, &info) != 0) {
+			return false;
+		}
+		modified = info.st_mtime;
+		return true;
+	}
+
+	// Set once by whichever box creates the texture; the uploads change the
+	// minification filter when they add mip levels.
+	void initCubeMap(GLuint texture)
+	{
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	std::shared_future<void> completed()
+	{
+		std::promise<void> done;
+		done.set_value();
+		return done.get_future().share();
+	}
+
+	// Converted panoramas are saved under their own suffix, so they never
+	// hide a container CubeBake makes later, as uncompressed .cube files
+	// that startDecoding picks up like any other.
+	const char* const PANORAMA_CACHE_SUFFIX = ".panorama.cube";
+
+	void writePanoramaCache(const std::string & filename, const CubeMipChain & chain)
+	{
+		CubeMapFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CUBE_MAP_FILE_MAGIC, 4);
+		header.version = CUBE_MAP_FILE_VERSION;
+		header.internalFormat = GL_RGBA8;
+		header.format = GL_RGBA;
+		header.type = GL_UNSIGNED_BYTE;
+		header.width = header.height = chain.size;
+		header.levels = (uint32_t)chain.faces[0].size();
+		header.unpackAlignment = 4;
+
+		std::vector<const std::vector<unsigned char>*> images;
+		for (uint32_t level = 0; level < header.levels; level++) {
+			for (int face = 0; face < 6; face++) {
+				images.push_back(&chain.faces[face][level]);
+			}
+		}
+		if (CubeMapFile::write(filename.c_str(), header, images)) {
+			std::cout << "SkyBox: cached converted panorama as " << filename << std::endl;
+		}
+	}
+
+	// Runs on the pool once all six faces are decoded. Returns null when the
+	// faces cannot form a cube map, in which case they are uploaded without
+	// mips.
+	std::shared_ptr<const CubeMipChain> buildMipChain(const std::vector<std::shared_future<DecodedImageRef>> & images)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<CubeMipChain> chain = std::make_shared<CubeMipChain>();
+		chain->size = images[0].get()->image.width();
+		for (int face = 0; face < 6; face++) {
+			const PPMImage & image = images[face].get()->image;
+			if (image.pixels() == nullptr || image.width() != chain->size || image.height() != chain->size) {
+				std::cerr << "SkyBox faces are not square and of equal size, skipping mipmaps" << std::endl;
+				return nullptr;
+			}
+
+			size_t texels = (size_t)chain->size * chain->size;
+			chain->faces[face].resize(1);
+			chain->faces[face][0].resize(texels * 4);
+			convertToRGBA8(image.pixels(), image.type(), &chain->faces[face][0][0], texels);
+		}
+
+		MipKernel kernel = bestMipKernel();
+		buildCubeMipChain(*chain, kernel);
+		std::cout << "SkyBox mip chain: " << chain->size << "x" << chain->size << " x " << chain->faces[0].size()
+			<< " levels (" << mipKernelName(kernel) << ") in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+			<< " ms" << std::endl;
+		return std::shared_ptr<const CubeMipChain>(chain);
+	}
+}
+
+SkyBox::SkyBox(int state, TextureUploader* uploader, size_t virtualTextureBytes)
+	: textId(0), bakedBase(nullptr), panorama(nullptr), fromPanorama(false), mipmapped(state != 0 && uploader == nullptr), uploader(uploader), placeholderId(0), resident(false),
+	virtualTextureBytes(virtualTextureBytes), video(nullptr), srgbDecode(false), mipBias(0.0f)
 {
 	this->toWorld = glm::mat4(1.0f);
 	if (state == 0) {
@@ -47,6 +174,8 @@ SkyBox::SkyBox(int state)
 	else {
 		scale(200.0f);
 		if (state == 1) {
+			bakedBase = "../Minimal/Textures/left";
+			panorama = "../Minimal/Textures/left.ppm";
 			faces.push_back("../Minimal/Textures/left-ppm/px.ppm");
 			faces.push_back("../Minimal/Textures/left-ppm/nx.ppm"); 
 			faces.push_back("../Minimal/Textures/left-ppm/py.ppm");
@@ -56,6 +185,8 @@ SkyBox::SkyBox(int state)
 		}
 
 		else if (state == 2) {
+			bakedBase = "../Minimal/Textures/right";
+			panorama = "../Minimal/Textures/right.ppm";
 			faces.push_back("../Minimal/Textures/right-ppm/px.ppm");
 			faces.push_back("../Minimal/Textures/right-ppm/nx.ppm");
 			faces.push_back("../Minimal/Textures/right-ppm/py.ppm");
@@ -65,6 +196,7 @@ SkyBox::SkyBox(int state)
 		}
 		else if (state == 3) {
 			scale(glm::vec3(1.0f, 4.0f , 1.0f));
+			bakedBase = "../Minimal/Textures/custom";
 			faces.push_back("../Minimal/Textures/custom/left.ppm");
 			faces.push_back("../Minimal/Textures/custom/right.ppm");
 			faces.push_back("../Minimal/Textures/custom/top.ppm");
@@ -75,9 +207,11 @@ SkyBox::SkyBox(int state)
 	}
 
 	this->angle = 0.0f;
+	this->textureBytes = 0;
 
-	unsigned char *image;
-	int width, height;
+	// Start decoding straight away so the pool works while the GL objects
+	// are created below.
+	startDecoding();
 
 	// Create buffers/arrays
 	glGenVertexArrays(1, &VAO);
@@ -103,49 +237,620 @@ SkyBox::SkyBox(int state)
 
 	numOfIndices = 36;
 
-	glGenTextures(1, &textId);
+	//glEnable(GL_CULL_FACE);
+	//glCullFace(GL_BACK);
+
+	// Select GL_MODULATE to mix texture with polygon color for shading:
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+}
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textId);
+SkyBox::~SkyBox()
+{
+	if (streamGroup) {
+		streamGroup->cancelled = true;
+	}
+	for (auto & group : reloadGroups) {
+		group->cancelled = true;
+	}
+	if (placeholderId != 0) {
+		glDeleteTextures(1, &placeholderId);
+	}
+
+	TextureCache & cache = TextureCache::instance();
+	for (GLuint i = 0; i < pending.size(); i++) {
+		if (!uploaded[i]) {
+			cache.releaseImage(canonicalFaces[i]);
+		}
+	}
+	cache.releaseTexture(textId);
+
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteBuffers(1, &VBO);
+	glDeleteBuffers(1, &EBO);
+}
+
+void SkyBox::reload()
+{
+	std::cout << "SkyBox " << faces[0] << ": texture was evicted, reloading" << std::endl;
+	if (streamGroup) {
+		streamGroup->cancelled = true;
+		streamGroup.reset();
+	}
+	for (auto & group : reloadGroups) {
+		group->cancelled = true;
+	}
+	reloadGroups.clear();
+
+	// Let go of everything the last load held and run it again; the
+	// evicted texture is deleted once no other box holds it either.
+	TextureCache & cache = TextureCache::instance();
+	for (GLuint i = 0; i < pending.size(); i++) {
+		if (!uploaded[i]) {
+			cache.releaseImage(canonicalFaces[i]);
+		}
+	}
+	cache.releaseTexture(textId);
+	textId = 0;
+	canonicalFaces.clear();
+	pending.clear();
+	uploaded.clear();
+	bakedFile.clear();
+	bakedPending = std::shared_future<std::shared_ptr<const CubeMapFile>>();
+	mipPending = std::shared_future<std::shared_ptr<const CubeMipChain>>();
+	textureBytes = 0;
+	resident = false;
+	startDecoding();
+}
+
+void SkyBox::startDecoding()
+{
+	// A tiled version wins over everything else: it is only made for boxes
+	// too large to keep resident as a whole.
+	if (startVirtual()) {
+		return;
+	}
+
+	// A panorama stands in for the six faces only when they are missing.
+	time_t panoramaTime = 0, modified;
+	fromPanorama = panorama != nullptr && !fileTime(faces[0], modified) && fileTime(panorama, panoramaTime);
+
+	// Prefer a pre-baked container (see CubeBake) over the individual faces,
+	// and a compressed one the driver can sample over an uncompressed one.
+	// Containers older than the panorama they stand for are stale.
+	for (int i = 0; bakedBase != nullptr && i < BAKED_FORMAT_COUNT; i++) {
+		if (!BAKED_FORMATS[i].supported()) {
+			continue;
+		}
+		std::string candidate = std::string(bakedBase) + BAKED_FORMATS[i].suffix;
+		if (fileTime(candidate.c_str(), modified) && (!fromPanorama || modified >= panoramaTime)) {
+			bakedFile = candidate;
+			startBaked();
+			return;
+		}
+	}
+	std::string cached = bakedBase != nullptr ? std::string(bakedBase) + PANORAMA_CACHE_SUFFIX : std::string();
+	if (fromPanorama && !cached.empty() && fileTime(cached.c_str(), modified) && modified >= panoramaTime) {
+		bakedFile = cached;
+		startBaked();
+		return;
+	}
+	startUnbaked();
+}
+
+void SkyBox::startUnbaked()
+{
+	if (fromPanorama) {
+		startPanorama();
+		return;
+	}
 
+	TextureCache & cache = TextureCache::instance();
 	for (GLuint i = 0; i < faces.size(); i++) {
-		image = loadPPM(faces[i], width, height);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width,
-			height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+		canonicalFaces.push_back(TextureCache::canonicalPath(faces[i]));
 	}
 
+	bool created;
+	// A level count of 0 stands for the full mip chain.
+	textId = cache.acquireTexture(TextureCache::cubeMapKey(canonicalFaces, GL_SRGB8_ALPHA8, mipmapped ? 0 : 1),
+		GL_TEXTURE_CUBE_MAP, created);
+	if (!created) {
+		// Another SkyBox already owns (or is uploading) this cube map.
+		uploaded.assign(faces.size(), true);
+		resident = true;
+		decodeDone = completed();
+		return;
+	}
+	initCubeMap(textId);
 
-	//glEnable(GL_CULL_FACE);
-	//glCullFace(GL_BACK);
+	for (GLuint i = 0; i < faces.size(); i++) {
+		pending.push_back(cache.acquireImage(canonicalFaces[i]));
+	}
+	uploaded.assign(faces.size(), false);
+	if (uploader != nullptr) {
+		startStreaming();
+	}
 
-	// Make sure no bytes are padded:
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	// Queued only once the faces are decoded, so no worker sits waiting
+	// for them.
+	std::vector<std::shared_future<DecodedImageRef>> images = pending;
+	if (mipmapped) {
+		mipPending = ThreadPool::shared().submitAfter([images] { return buildMipChain(images); }, images).share();
+		decodeDone = ThreadPool::shared().submitAfter([] {}, mipPending).share();
+		return;
+	}
+	decodeDone = ThreadPool::shared().submitAfter([] {}, images).share();
+}
 
-	// Select GL_MODULATE to mix texture with polygon color for shading:
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+bool SkyBox::startVirtual()
+{
+	time_t modified;
+	std::string tiles = bakedBase != nullptr ? std::string(bakedBase) + ".vtex" : std::string();
+	if (tiles.empty() || !fileTime(tiles.c_str(), modified)) {
+		return false;
+	}
+	virtualTexture.reset(new VirtualTexture());
+	if (!virtualTexture->open(tiles.c_str(), virtualTextureBytes)) {
+		virtualTexture.reset();
+		return false;
+	}
+	resident = true;
+	decodeDone = completed();
+	return true;
+}
+
+void SkyBox::updateResidency(const VirtualTextureView* views, int count, size_t uploadBytes)
+{
+	if (!virtualTexture) {
+		return;
+	}
+	// Bring the eye orientations into the box's own space, where the cube
+	// map is looked up.
+	glm::mat3 worldToBox = glm::inverse(glm::mat3(toWorld));
+	std::vector<VirtualTextureView> local(views, views + count);
+	for (auto & view : local) {
+		view.orientation = worldToBox * view.orientation;
+	}
+	virtualTexture->update(local.data(), count, uploadBytes);
+}
+
+void SkyBox::startBaked()
+{
+	bool created;
+	std::string path = TextureCache::canonicalPath(bakedFile.c_str());
+	textId = TextureCache::instance().acquireTexture(TextureCache::cubeMapKey(std::vector<std::string>(1, path), 0, 0),
+		GL_TEXTURE_CUBE_MAP, created);
+	if (!created) {
+		resident = true;
+		decodeDone = completed();
+		return;
+	}
+	initCubeMap(textId);
+
+	bakedPending = ThreadPool::shared().submit([path] {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<CubeMapFile> file = std::make_shared<CubeMapFile>();
+		if (file->open(path.c_str())) {
+			file->prefetch();
+		}
+		else {
+			file.reset();
+		}
+		std::cout << "SkyBox " << path << ": mapped in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+			<< " ms" << std::endl;
+		return std::shared_ptr<const CubeMapFile>(file);
+	}).share();
+	decodeDone = ThreadPool::shared().submitAfter([] {}, bakedPending).share();
+}
+
+void SkyBox::startPanorama()
+{
+	TextureCache & cache = TextureCache::instance();
+	canonicalFaces.push_back(TextureCache::canonicalPath(panorama));
+
+	bool created;
+	textId = cache.acquireTexture(TextureCache::cubeMapKey(canonicalFaces, GL_SRGB8_ALPHA8, mipmapped ? 0 : 1),
+		GL_TEXTURE_CUBE_MAP, created);
+	if (!created) {
+		uploaded.assign(1, true);
+		resident = true;
+		decodeDone = completed();
+		return;
+	}
+	initCubeMap(textId);
+	pending.push_back(cache.acquireImage(canonicalFaces[0]));
+	uploaded.assign(1, false);
+
+	// The conversion starts once the decode is done and this job once the
+	// conversion is, so neither the GL thread nor a worker waits on them.
+	std::shared_future<std::shared_ptr<CubeMipChain>> converted = queuePanoramaToCube(pending[0], PANORAMA_BICUBIC,
+		ThreadPool::shared());
+	std::shared_future<DecodedImageRef> image = pending[0];
+	std::string cacheFile = bakedBase != nullptr ? std::string(bakedBase) + PANORAMA_CACHE_SUFFIX : std::string();
+	std::string source = panorama;
+	bool mips = mipmapped;
+	mipPending = ThreadPool::shared().submitAfter([converted, image, cacheFile, source, mips] {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::shared_ptr<CubeMipChain> chain = converted.get();
+		if (!chain) {
+			return std::shared_ptr<const CubeMipChain>();
+		}
+		const PPMImage & ppm = image.get()->image;
+		if (ppm.width() != ppm.height() * 2) {
+			std::cerr << "SkyBox: " << source << " is " << ppm.width() << "x" << ppm.height()
+				<< ", not a 2:1 equirectangular panorama; it will look stretched" << std::endl;
+		}
+		if (mips) {
+			buildCubeMipChain(*chain, bestMipKernel());
+		}
+		std::cout << "SkyBox " << source << ": converted to 6 x " << chain->size << "x" << chain->size << " in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+			<< " ms after decode" << std::endl;
+		if (!cacheFile.empty()) {
+			writePanoramaCache(cacheFile, *chain);
+		}
+		return std::shared_ptr<const CubeMipChain>(chain);
+	}, converted, image).share();
+	decodeDone = ThreadPool::shared().submitAfter([] {}, mipPending).share();
+}
+
+void SkyBox::uploadBaked(const CubeMapFile & file)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	const CubeMapFileHeader & header = file.header();
+
+	GLenum internalFormat = CubeMapFile::srgbInternalFormat(header.internalFormat);
+	srgbDecode = CubeMapFile::needsSrgbDecode(internalFormat);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textId);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, header.unpackAlignment);
+	for (int level = 0; level < file.levels(); level++) {
+		for (int face = 0; face < 6; face++) {
+			if (file.compressed()) {
+				glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat,
+					file.width(level), file.height(level), 0, (GLsizei)file.size(face, level), file.data(face, level));
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat,
+					file.width(level), file.height(level), 0, header.format, header.type, file.data(face, level));
+			}
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, file.levels() - 1);
+	if (file.levels() > 1) {
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	}
+
+	textureBytes = file.byteCount();
+	TextureCache::instance().setTextureBytes(textId, textureBytes);
+	std::cout << "SkyBox " << bakedFile << ": " << file.width(0) << "x" << file.height(0) << " x "
+		<< file.levels() << " level(s), " << textureBytes << " bytes, upload "
+		<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+		<< " ms" << std::endl;
+}
+
+void SkyBox::uploadMipChain(const CubeMipChain & chain)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	int levels = (int)chain.faces[0].size();
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textId);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	textureBytes = 0;
+	for (int level = 0; level < levels; level++) {
+		int size = std::max(1, chain.size >> level);
+		for (int face = 0; face < 6; face++) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_SRGB8_ALPHA8, size, size, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, &chain.faces[face][level][0]);
+			textureBytes += chain.faces[face][level].size();
+		}
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	TextureCache::instance().setTextureBytes(textId, textureBytes);
+	std::cout << "SkyBox " << faces[0] << ": " << chain.size << "x" << chain.size << " x " << levels
+		<< " level(s), " << textureBytes << " bytes, upload "
+		<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+		<< " ms" << std::endl;
+}
+
+void SkyBox::startStreaming()
+{
+	const int placeholderSize = 16;
 
+	glGenTextures(1, &placeholderId);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderId);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+	// onResident only ever runs inside TextureUploader::update on the GL
+	// thread, and the destructor cancels the group first, so using this is
+	// safe here.
+	streamGroup = std::make_shared<UploadGroup>();
+	streamGroup->onResident = [this] {
+		TextureCache & cache = TextureCache::instance();
+		for (GLuint i = 0; i < pending.size(); i++) {
+			const PPMImage & image = pending[i].get()->image;
+			textureBytes += (size_t)image.width() * image.height() * 4;
+			cache.releaseImage(canonicalFaces[i]);
+			uploaded[i] = true;
+		}
+		cache.setTextureBytes(textId, textureBytes);
+		glDeleteTextures(1, &placeholderId);
+		placeholderId = 0;
+		resident = true;
+	};
+
+	for (GLuint i = 0; i < faces.size(); i++) {
+		UploadRequest request;
+		request.image = pending[i];
+		request.texture = textId;
+		request.bindTarget = GL_TEXTURE_CUBE_MAP;
+		request.imageTarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+		request.level = 0;
+		request.internalFormat = GL_SRGB8_ALPHA8;
+		request.placeholder = placeholderId;
+		request.placeholderSize = placeholderSize;
+		request.group = streamGroup;
+		uploader->enqueue(request);
+	}
+}
+
+bool SkyBox::watch(FileWatcher & watcher)
+{
+	// Baked, panorama and virtual boxes have no per-face source to reload.
+	if (uploader == nullptr || canonicalFaces.size() != faces.size()) {
+		std::cerr << "SkyBox " << faces[0] << ": hot reload needs a streamed box built from face files" << std::endl;
+		return false;
+	}
+	for (const auto & face : canonicalFaces) {
+		watcher.watch(face);
+	}
+	return true;
 }
 
-SkyBox::~SkyBox() {}
+void SkyBox::reloadFaces(const std::vector<std::string> & changed)
+{
+	if (uploader == nullptr || canonicalFaces.size() != faces.size()) {
+		return;
+	}
+
+	std::vector<GLuint> reloaded;
+	for (GLuint i = 0; i < canonicalFaces.size(); i++) {
+		if (std::find(changed.begin(), changed.end(), canonicalFaces[i]) != changed.end()) {
+			reloaded.push_back(i);
+		}
+	}
+	if (reloaded.empty()) {
+		return;
+	}
 
+	// Finished groups are no longer worth cancelling.
+	reloadGroups.erase(std::remove_if(reloadGroups.begin(), reloadGroups.end(),
+		[](const std::shared_ptr<UploadGroup> & old) { return old->remaining == 0; }), reloadGroups.end());
+	std::shared_ptr<UploadGroup> group = std::make_shared<UploadGroup>();
+	reloadGroups.push_back(group);
+
+	// Only logs, so it is safe even if it runs after the box is gone.
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t count = reloaded.size();
+	group->onResident = [start, count] {
+		std::cout << "SkyBox: reloaded " << count << " face(s) in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+			<< " ms" << std::endl;
+	};
+
+	// Decoding happens on the pool and the upload is spread over frames by
+	// the uploader's budget; the old face stays visible until overwritten.
+	for (GLuint face : reloaded) {
+		UploadRequest request;
+		request.image = TextureCache::instance().reloadImage(canonicalFaces[face]);
+		request.texture = textId;
+		request.bindTarget = GL_TEXTURE_CUBE_MAP;
+		request.imageTarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+		request.level = 0;
+		request.internalFormat = GL_SRGB8_ALPHA8;
+		request.placeholder = 0;
+		request.placeholderSize = 0;
+		request.group = group;
+		uploader->enqueue(request);
+	}
+}
 
-void SkyBox::draw(GLuint shaderProgram, const glm::mat4 &projection, const glm::mat4 &modelview)
+bool SkyBox::finishLoading(bool wait)
 {
+	if (bakedPending.valid() && !resident) {
+		// Baked files need no CPU work, so they are uploaded in one go even
+		// when an uploader was supplied.
+		if (!wait && bakedPending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return false;
+		}
+		std::shared_ptr<const CubeMapFile> file = bakedPending.get();
+		bakedPending = std::shared_future<std::shared_ptr<const CubeMapFile>>();
+		if (file) {
+			uploadBaked(*file);
+			resident = true;
+		}
+		else {
+			// Corrupt, truncated or from another version: load what it was
+			// baked from instead, and carry on below as that load would.
+			std::cerr << "SkyBox " << bakedFile << ": cannot use the baked cube map, loading the "
+				<< (fromPanorama ? "panorama" : "faces") << " instead" << std::endl;
+			TextureCache::instance().releaseTexture(textId);
+			textId = 0;
+			bakedFile.clear();
+			startUnbaked();
+		}
+	}
+
+	if (streamGroup) {
+		// The uploader does the work; waiting just drains it without a budget.
+		while (wait && !resident) {
+			uploader->update(SIZE_MAX);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return resident;
+	}
+
+	if (mipPending.valid()) {
+		if (!wait && mipPending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return false;
+		}
+		std::shared_ptr<const CubeMipChain> chain = mipPending.get();
+		mipPending = std::shared_future<std::shared_ptr<const CubeMipChain>>();
+		if (chain) {
+			uploadMipChain(*chain);
+			for (GLuint i = 0; i < pending.size(); i++) {
+				TextureCache::instance().releaseImage(canonicalFaces[i]);
+				uploaded[i] = true;
+			}
+			resident = true;
+			return true;
+		}
+		if (fromPanorama) {
+			// The panorama failed to load; there is nothing to upload.
+			TextureCache::instance().releaseImage(canonicalFaces[0]);
+			uploaded[0] = true;
+			resident = true;
+			return true;
+		}
+		// Otherwise fall through and upload the faces as they are.
+	}
+
+	size_t left = std::count(uploaded.begin(), uploaded.end(), false);
+	if (left == 0) {
+		return true;
+	}
+
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textId);
-	glUseProgram(shaderProgram);
-	GLuint MatrixID = glGetUniformLocation(shaderProgram, "projection");
-	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &projection[0][0]);
 
-	MatrixID = glGetUniformLocation(shaderProgram, "modelview");
-	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &(modelview*toWorld)[0][0]);
+	// Upload faces in the order the pool finishes them, not in face order.
+	while (left > 0) {
+		bool progress = false;
+		for (GLuint i = 0; i < pending.size(); i++) {
+			if (uploaded[i] || pending[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				continue;
+			}
+			uploadFace(i, *pending[i].get());
+			uploaded[i] = true;
+			TextureCache::instance().releaseImage(canonicalFaces[i]);
+			progress = true;
+			--left;
+		}
+		if (!wait) {
+			break;
+		}
+		if (!progress) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	if (left == 0) {
+		TextureCache::instance().setTextureBytes(textId, textureBytes);
+		resident = true;
+	}
+	return left == 0;
+}
+
+void SkyBox::uploadFace(GLuint face, const DecodedImage & decoded)
+{
+	const PPMImage & image = decoded.image;
+	if (image.pixels() == nullptr) {
+		return;
+	}
+
+	// The face is expanded to RGBA8 in the single copy out of the file
+	// mapping; 3-byte rows would send the driver down its swizzle path. The
+	// mapping is released when the decoded image goes out of scope.
+	auto start = std::chrono::high_resolution_clock::now();
+	size_t texels = (size_t)image.width() * image.height();
+	std::vector<unsigned char> rgba(texels * 4);
+	convertToRGBA8(image.pixels(), image.type(), &rgba[0], texels);
+	double convertMillis = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8_ALPHA8, image.width(),
+		image.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+	textureBytes += rgba.size();
+	double uploadMillis = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "SkyBox face " << face << " (" << faces[face] << "): " << image.width() << "x" << image.height()
+		<< ", " << image.byteCount() << " bytes, decode " << decoded.decodeMillis << " ms, convert "
+		<< convertMillis << " ms, upload " << uploadMillis << " ms" << std::endl;
+}
+
+
+void SkyBox::draw(ShaderVariants & shaders, int view, unsigned stereo)
+{
+	// One instance per eye; the vertex shader places each in its half.
+	render(shaders, view, stereo, stereo == SHADER_STEREO_INSTANCED ? 2 : 1);
+}
+
+void SkyBox::drawLayered(ShaderVariants & shaders, int layers, int eye)
+{
+	render(shaders, eye, SHADER_LAYERED, (layers - eye + 1) / 2);
+}
+
+void SkyBox::render(ShaderVariants & shaders, int view, unsigned viewFeatures, int instances)
+{
+	// An evicted texture comes back through the same path it first loaded by.
+	if (textId != 0 && !TextureCache::instance().touch(textId)) {
+		reload();
+	}
+	// Pick up any faces that finished decoding since the last frame.
+	finishLoading(false);
+	bool playing = video != nullptr && video->playing();
+	GLuint texture = resident || placeholderId == 0 ? textId : placeholderId;
+	if (playing) {
+		texture = video->texture(viewFeatures != 0 ? 0 : view);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	if (viewFeatures != 0) {
+		glActiveTexture(GL_TEXTURE0 + RIGHT_EYE_UNIT);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, playing ? video->texture(1) : texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	unsigned features = viewFeatures;
+	if (virtualTexture && !playing) {
+		features |= SHADER_VIRTUAL_TEXTURE;
+	}
+	else if (playing ? video->needsSrgbDecode() : srgbDecode) {
+		features |= SHADER_SRGB_DECODE;
+	}
+	if (mipBias != 0.0f) {
+		features |= SHADER_MIP_BIAS;
+	}
+	Program & program = shaders.get(features);
+	program.use();
+	if (features & SHADER_MIP_BIAS) {
+		program.set("mipBias", mipBias);
+	}
+
+	if (features & SHADER_VIRTUAL_TEXTURE) {
+		program.set("pageTable", (GLint)VirtualTexture::PAGE_TABLE_UNIT);
+		program.set("atlas", (GLint)VirtualTexture::ATLAS_UNIT);
+		virtualTexture->bind(program);
+	}
+	if (viewFeatures != 0) {
+		program.set("skyboxRight", (GLint)RIGHT_EYE_UNIT);
+	}
+	if (viewFeatures == SHADER_LAYERED) {
+		program.set("firstLayer", (GLint)view);
+		program.set("layerStep", (GLint)2);
+	}
+	program.set("model", toWorld);
 
 	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, numOfIndices, GL_UNSIGNED_INT, 0);
+	if (instances > 1) {
+		glDrawElementsInstanced(GL_TRIANGLES, numOfIndices, GL_UNSIGNED_INT, 0, instances);
+	}
+	else {
+		glDrawElements(GL_TRIANGLES, numOfIndices, GL_UNSIGNED_INT, 0);
+	}
 	glBindVertexArray(0);
 }
 
@@ -167,56 +872,3 @@ void SkyBox::setScale(float scalefactor) {
 	this->toWorld[2] = glm::mat4(1.0f)[2];
 	scale(scalefactor);
 }
-
-unsigned char* SkyBox::loadPPM(const char* filename, int& width, int& height)
-{
-	const int BUFSIZE = 128;
-	FILE* fp;
-	unsigned int read;
-	unsigned char* rawData;
-	char buf[3][BUFSIZE];
-	char* retval_fgets;
-	size_t retval_sscanf;
-
-	if ((fp = fopen(filename, "rb")) == NULL)
-	{
-		std::cerr << "error reading ppm file, could not locate " << filename << std::endl;
-		width = 0;
-		height = 0;
-		return 0;
-	}
-
-	// Read magic number:
-	retval_fgets = fgets(buf[0], BUFSIZE, fp);
-
-	// Read width and height:
-	do
-	{
-		retval_fgets = fgets(buf[0], BUFSIZE, fp);
-	} while (buf[0][0] == '#');
-	retval_sscanf = sscanf(buf[0], "%s %s", buf[1], buf[2]);
-	width = atoi(buf[1]);
-	height = atoi(buf[2]);
-
-	// Read maxval:
-	do
-	{
-		retval_fgets = fgets(buf[0], BUFSIZE, fp);
-	} while (buf[0][0] == '#');
-
-	// Read image data:
-	rawData = new unsigned char[width * height * 3];
-	read = fread(rawData, width * height * 3, 1, fp);
-	fclose(fp);
-	if (read != 1)
-	{
-		std::cerr << "error parsing ppm file, incomplete data" << std::endl;
-		delete[] rawData;
-		width = 0;
-		height = 0;
-
-		return 0;
-	}
-
-	return rawData;
-}
\ No newline at end of file
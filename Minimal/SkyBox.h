@@ -5,19 +5,72 @@
 #include<glm\glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <future>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
+class CubeMapFile;
+class CubeVideo;
+struct CubeMipChain;
+struct DecodedImage;
+class FileWatcher;
+class ShaderVariants;
+struct UploadGroup;
+class TextureUploader;
+class VirtualTexture;
+struct VirtualTextureView;
+
 class SkyBox
 {
 public:
-	SkyBox(int);
+	// With an uploader the faces stream in over several frames and a low
+	// resolution placeholder is drawn until they are all resident. Without
+	// one, the large environment boxes get a full mip chain built on the
+	// thread pool before upload. When a tiled .vtex version of the box
+	// exists it is streamed as a virtual texture instead, holding at most
+	// virtualTextureBytes of tiles.
+	SkyBox(int, TextureUploader* uploader = nullptr, size_t virtualTextureBytes = 256 * 1024 * 1024);
 	~SkyBox();
-	void draw(GLuint, const glm::mat4 &, const glm::mat4 &);
+	// Where the right eye's texture goes when both eyes are drawn at once.
+	static const GLuint RIGHT_EYE_UNIT = 3;
+
+	// Draws with the view bound to ViewUniforms::BINDING, using the variant
+	// of the shaders the box's texture needs; view picks the eye of a
+	// stereo video. With stereo set to SHADER_STEREO_INSTANCED or
+	// SHADER_MULTIVIEW both eyes are drawn in one go instead, with their
+	// views bound by ViewUniforms::bindStereo.
+	void draw(ShaderVariants &, int view = 0, unsigned stereo = 0);
+	// Draws into eye's layers among the first layers of the bound array
+	// target at once, each with its view from ViewUniforms::bindLayers.
+	// Even layers are left eyes, odd ones right.
+	void drawLayered(ShaderVariants &, int layers, int eye);
+	// Level of detail bias for the box's faces; 0 leaves the MIP_BIAS
+	// feature out.
+	void setMipBias(float bias) { mipBias = bias; }
+	float getMipBias() const { return mipBias; }
 	void scale(float scalefactor);
 	void translate(glm::vec3 transfactor);
 	void setScale(float scalefactor);
+	// Upload faces that have finished decoding. Must be called on the GL
+	// thread; with wait set it blocks until every face is resident.
+	bool finishLoading(bool wait = true);
+	// Becomes ready once all faces are decoded and waiting for upload, so
+	// several SkyBoxes can be constructed before any of them is finished.
+	std::shared_future<void> decoded() const { return decodeDone; }
+	// Pages in the virtual texture tiles the eye views need, uploading up to
+	// uploadBytes of them. The views' orientations are in world space. Does
+	// nothing for ordinary boxes.
+	void updateResidency(const VirtualTextureView* views, int count, size_t uploadBytes);
+	// Hot reload for streamed boxes built from face files: watch registers
+	// the faces, and reloadFaces re-decodes any of them in changed (from
+	// FileWatcher::changes) and streams them into the existing texture.
+	bool watch(FileWatcher & watcher);
+	void reloadFaces(const std::vector<std::string> & changed);
+	// Shows the video's frames in place of the box's own faces whenever it
+	// has one to show; null goes back to the faces. Not owned.
+	void setVideo(const CubeVideo* video) { this->video = video; }
 
 private:
 	GLuint textId;
@@ -27,7 +80,42 @@ private:
 	unsigned int numOfIndices;
 	std::string left, right, up, down, back, front;
 	std::vector<const GLchar *> faces;
-	unsigned char* loadPPM(const char* filename, int& width, int& height);
+	const char* bakedBase;
+	// Equirectangular stand-in for missing faces, converted on the pool.
+	const char* panorama;
+	bool fromPanorama;
+	std::string bakedFile;
+	std::shared_future<std::shared_ptr<const CubeMapFile>> bakedPending;
+	std::vector<std::string> canonicalFaces;
+	std::vector<std::shared_future<std::shared_ptr<const DecodedImage>>> pending;
+	std::vector<bool> uploaded;
+	bool mipmapped;
+	std::shared_future<std::shared_ptr<const CubeMipChain>> mipPending;
+	std::shared_future<void> decodeDone;
+	size_t textureBytes;
+	TextureUploader* uploader;
+	std::shared_ptr<UploadGroup> streamGroup;
+	std::vector<std::shared_ptr<UploadGroup>> reloadGroups;
+	GLuint placeholderId;
+	bool resident;
+	size_t virtualTextureBytes;
+	std::unique_ptr<VirtualTexture> virtualTexture;
+	const CubeVideo* video;
+	// The faces are in a format the sampler does not decode from sRGB.
+	bool srgbDecode;
+	float mipBias;
+	void render(ShaderVariants & shaders, int view, unsigned viewFeatures, int instances);
+	void startDecoding();
+	void reload();
+	bool startVirtual();
+	void startBaked();
+	// The panorama or faces, when there is no usable baked file.
+	void startUnbaked();
+	void startPanorama();
+	void uploadBaked(const CubeMapFile & file);
+	void uploadMipChain(const CubeMipChain & chain);
+	void startStreaming();
+	void uploadFace(GLuint face, const DecodedImage & decoded);
 	void scale(glm::vec3 scalarVector);
 };
 
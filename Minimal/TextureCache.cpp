@@ -0,0 +1,258 @@
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <limits.h>
+#endif
+
+namespace {
+	std::shared_future<DecodedImageRef> decode(const std::string & canonicalPath)
+	{
+		std::string path = canonicalPath;
+		return ThreadPool::shared().submit([path] {
+			auto start = std::chrono::high_resolution_clock::now();
+			std::shared_ptr<DecodedImage> decoded = std::make_shared<DecodedImage>();
+			if (decoded->image.load(path.c_str())) {
+				decoded->image.prefetch();
+			}
+			decoded->decodeMillis = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			return DecodedImageRef(decoded);
+		}).share();
+	}
+}
+
+TextureCache::TextureCache()
+	: textureHits_(0), textureMisses_(0), imageHits_(0), imageMisses_(0), residentBytes_(0), budget_(SIZE_MAX),
+	evictions_(0), frame_(1), reportedBytes_(0), reportedEvictions_(0), warnedBudget_(false)
+{
+}
+
+TextureCache & TextureCache::instance()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+std::string TextureCache::canonicalPath(const char* path)
+{
+#ifdef _WIN32
+	char buf[_MAX_PATH];
+	if (_fullpath(buf, path, _MAX_PATH) == nullptr) {
+		return path;
+	}
+	// NTFS paths are case-insensitive and accept either separator.
+	std::string result(buf);
+	std::transform(result.begin(), result.end(), result.begin(), [](char c) {
+		return c == '/' ? '\\' : (char)tolower((unsigned char)c);
+	});
+	return result;
+#else
+	char buf[PATH_MAX];
+	if (realpath(path, buf) == nullptr) {
+		return path;
+	}
+	return buf;
+#endif
+}
+
+std::string TextureCache::cubeMapKey(const std::vector<std::string> & canonicalFaces, GLenum internalFormat, GLint levels)
+{
+	std::ostringstream key;
+	key << "cube:" << std::hex << internalFormat << ":" << std::dec << levels;
+	for (const auto & face : canonicalFaces) {
+		key << "|" << face;
+	}
+	return key.str();
+}
+
+GLuint TextureCache::acquireTexture(const std::string & key, GLenum target, bool & created)
+{
+	auto found = texturesByKey.find(key);
+	if (found != texturesByKey.end()) {
+		++textureHits_;
+		++textures[found->second].refs;
+		created = false;
+		return found->second;
+	}
+
+	++textureMisses_;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	TextureEntry entry = { key, target, 1, 0, frame_, false, false };
+	textures[texture] = entry;
+	texturesByKey[key] = texture;
+	created = true;
+	return texture;
+}
+
+void TextureCache::adoptTexture(GLuint texture, GLenum target, size_t bytes, bool pinned)
+{
+	// Adopted textures are never shared, so the name makes a unique key.
+	std::ostringstream key;
+	key << "adopted:" << texture;
+	TextureEntry entry = { key.str(), target, 1, bytes, frame_, pinned, false };
+	textures[texture] = entry;
+	texturesByKey[entry.key] = texture;
+	residentBytes_ += bytes;
+}
+
+void TextureCache::setTextureBytes(GLuint texture, size_t bytes)
+{
+	auto found = textures.find(texture);
+	if (found == textures.end()) {
+		return;
+	}
+	residentBytes_ = residentBytes_ - found->second.bytes + bytes;
+	found->second.bytes = bytes;
+}
+
+void TextureCache::setPinned(GLuint texture, bool pinned)
+{
+	auto found = textures.find(texture);
+	if (found != textures.end()) {
+		found->second.pinned = pinned;
+	}
+}
+
+void TextureCache::releaseTexture(GLuint texture)
+{
+	auto found = textures.find(texture);
+	if (found == textures.end() || --found->second.refs > 0) {
+		return;
+	}
+	residentBytes_ -= found->second.bytes;
+	// An evicted texture's key may already belong to its replacement.
+	auto byKey = texturesByKey.find(found->second.key);
+	if (byKey != texturesByKey.end() && byKey->second == texture) {
+		texturesByKey.erase(byKey);
+	}
+	textures.erase(found);
+	glDeleteTextures(1, &texture);
+}
+
+bool TextureCache::touch(GLuint texture)
+{
+	auto found = textures.find(texture);
+	if (found == textures.end()) {
+		return true;
+	}
+	found->second.lastDrawn = frame_;
+	return !found->second.evicted;
+}
+
+void TextureCache::evict(GLuint texture, TextureEntry & entry)
+{
+	// The name stays allocated until every owner has released it, so it
+	// cannot be handed out again while they still hold it; only the storage
+	// goes, by respecifying every image as empty.
+	GLenum faces = entry.target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+	GLenum first = entry.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : entry.target;
+	glBindTexture(entry.target, texture);
+	for (GLint level = 0; level < 16; level++) {
+		for (GLenum face = 0; face < faces; face++) {
+			glTexImage2D(first + face, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	glBindTexture(entry.target, 0);
+
+	residentBytes_ -= entry.bytes;
+	entry.bytes = 0;
+	entry.evicted = true;
+	// The next acquire of this key creates a fresh texture to reload into.
+	texturesByKey.erase(entry.key);
+	++evictions_;
+}
+
+void TextureCache::endFrame(std::ostream & out)
+{
+	// Only textures not drawn this frame are candidates, oldest first.
+	while (residentBytes_ > budget_) {
+		auto oldest = textures.end();
+		for (auto it = textures.begin(); it != textures.end(); ++it) {
+			const TextureEntry & entry = it->second;
+			if (entry.pinned || entry.evicted || entry.bytes == 0 || entry.lastDrawn == frame_) {
+				continue;
+			}
+			if (oldest == textures.end() || entry.lastDrawn < oldest->second.lastDrawn) {
+				oldest = it;
+			}
+		}
+		if (oldest == textures.end()) {
+			if (!warnedBudget_) {
+				std::cerr << "TextureCache: " << residentBytes_ / (1024 * 1024) << " MB in use this frame exceeds the "
+					<< budget_ / (1024 * 1024) << " MB budget" << std::endl;
+				warnedBudget_ = true;
+			}
+			break;
+		}
+		out << "TextureCache: evicting " << oldest->second.key << " (" << oldest->second.bytes / 1024
+			<< " KB, last drawn " << frame_ - oldest->second.lastDrawn << " frame(s) ago)" << std::endl;
+		evict(oldest->first, oldest->second);
+	}
+
+	// Residency only changes on loads and evictions, so the report is
+	// printed on the frames where it does rather than every frame.
+	if (residentBytes_ != reportedBytes_ || evictions_ != reportedEvictions_) {
+		size_t drawn = 0;
+		for (const auto & texture : textures) {
+			drawn += texture.second.lastDrawn == frame_ ? 1 : 0;
+		}
+		out << "TextureCache: frame " << frame_ << ", " << residentBytes_ / (1024 * 1024) << " of "
+			<< (budget_ == SIZE_MAX ? std::string("unlimited") : std::to_string(budget_ / (1024 * 1024)))
+			<< " MB resident in " << textures.size() << " textures, " << drawn << " drawn, " << evictions_
+			<< " eviction(s)" << std::endl;
+		reportedBytes_ = residentBytes_;
+		reportedEvictions_ = evictions_;
+	}
+	++frame_;
+}
+
+std::shared_future<DecodedImageRef> TextureCache::acquireImage(const std::string & canonicalPath)
+{
+	auto found = images.find(canonicalPath);
+	if (found != images.end()) {
+		++imageHits_;
+		++found->second.refs;
+		return found->second.image;
+	}
+
+	++imageMisses_;
+	ImageEntry entry;
+	entry.refs = 1;
+	entry.image = decode(canonicalPath);
+	images[canonicalPath] = entry;
+	return entry.image;
+}
+
+std::shared_future<DecodedImageRef> TextureCache::reloadImage(const std::string & canonicalPath)
+{
+	std::shared_future<DecodedImageRef> image = decode(canonicalPath);
+	auto found = images.find(canonicalPath);
+	if (found != images.end()) {
+		found->second.image = image;
+	}
+	return image;
+}
+
+void TextureCache::releaseImage(const std::string & canonicalPath)
+{
+	auto found = images.find(canonicalPath);
+	if (found != images.end() && --found->second.refs == 0) {
+		images.erase(found);
+	}
+}
+
+void TextureCache::report(std::ostream & out) const
+{
+	out << "TextureCache: textures " << textures.size() << " (" << textureHits_ << " hits, "
+		<< textureMisses_ << " misses), images " << images.size() << " held (" << imageHits_ << " hits, "
+		<< imageMisses_ << " misses), " << residentBytes_ / (1024 * 1024) << " MB resident, " << evictions_
+		<< " eviction(s)" << std::endl;
+}
@@ -0,0 +1,110 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include <GL\glew.h>
+
+#include <future>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "PPMImage.h"
+
+// A decoded source image plus how long the loader thread spent on it.
+struct DecodedImage
+{
+	PPMImage image;
+	double decodeMillis;
+};
+typedef std::shared_ptr<const DecodedImage> DecodedImageRef;
+
+// Process-wide, reference-counted cache of textures and decoded images.
+// Textures are keyed by canonical source paths plus the upload parameters,
+// so identical cube maps share one GL texture; images are keyed by canonical
+// path, so a file is decoded once however many faces use it. All methods
+// must be called from the GL thread.
+//
+// The cache also keeps texture memory under a budget. Owners touch() their
+// textures when drawing them; at endFrame(), while the resident total is
+// over budget, the texture drawn least recently loses its storage. Its
+// owner finds out from the next touch() and loads it again. Textures that
+// cannot be reloaded, such as render targets, are pinned.
+class TextureCache
+{
+public:
+	static TextureCache & instance();
+
+	static std::string canonicalPath(const char* path);
+	static std::string cubeMapKey(const std::vector<std::string> & canonicalFaces, GLenum internalFormat, GLint levels);
+
+	// Returns the texture for key, creating an empty one on a miss. created
+	// tells the caller it owns the upload.
+	GLuint acquireTexture(const std::string & key, GLenum target, bool & created);
+	// Tracks a texture created elsewhere; releaseTexture deletes it.
+	void adoptTexture(GLuint texture, GLenum target, size_t bytes, bool pinned);
+	void setTextureBytes(GLuint texture, size_t bytes);
+	void setPinned(GLuint texture, bool pinned);
+	void releaseTexture(GLuint texture);
+
+	// Marks texture as drawn this frame. Returns false if it was evicted;
+	// the owner should release it and acquire it again to reload.
+	bool touch(GLuint texture);
+	void setBudget(size_t bytes) { budget_ = bytes; }
+	size_t budget() const { return budget_; }
+	// Evicts down to the budget and reports when residency has changed.
+	void endFrame(std::ostream & out);
+
+	// Decodes canonicalPath on the loader pool unless it is already held.
+	std::shared_future<DecodedImageRef> acquireImage(const std::string & canonicalPath);
+	void releaseImage(const std::string & canonicalPath);
+	// Decodes canonicalPath again after it changed on disk. A held copy is
+	// replaced, so later acquireImage calls see the new contents too; the
+	// caller takes no reference.
+	std::shared_future<DecodedImageRef> reloadImage(const std::string & canonicalPath);
+
+	size_t textureHits() const { return textureHits_; }
+	size_t textureMisses() const { return textureMisses_; }
+	size_t imageHits() const { return imageHits_; }
+	size_t imageMisses() const { return imageMisses_; }
+	size_t residentBytes() const { return residentBytes_; }
+	size_t evictions() const { return evictions_; }
+	void report(std::ostream & out) const;
+
+private:
+	TextureCache();
+
+	struct TextureEntry
+	{
+		std::string key;
+		GLenum target;
+		int refs;
+		size_t bytes;
+		unsigned lastDrawn;
+		bool pinned;
+		bool evicted;
+	};
+	struct ImageEntry
+	{
+		std::shared_future<DecodedImageRef> image;
+		int refs;
+	};
+
+	std::map<std::string, GLuint> texturesByKey;
+	std::map<GLuint, TextureEntry> textures;
+	std::map<std::string, ImageEntry> images;
+	size_t textureHits_, textureMisses_;
+	size_t imageHits_, imageMisses_;
+	size_t residentBytes_;
+	size_t budget_;
+	size_t evictions_;
+	unsigned frame_;
+	size_t reportedBytes_;
+	size_t reportedEvictions_;
+	bool warnedBudget_;
+
+	void evict(GLuint texture, TextureEntry & entry);
+};
+
+#endif
@@ -0,0 +1,286 @@
+#include "TextureUploader.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <iostream>
+
+TextureUploader::TextureUploader(size_t slotBytes, int slotCount)
+	: slotBytes(slotBytes), persistent(GLEW_ARB_buffer_storage != 0),
+	inFlight(0), stopping(false), uploadedBytes_(0)
+{
+	const GLbitfield persistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	slots.resize(slotCount);
+	for (int i = 0; i < slotCount; i++) {
+		Slot & slot = slots[i];
+		slot.fence = 0;
+		slot.mapped = nullptr;
+		glGenBuffers(1, &slot.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		if (persistent) {
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotBytes, nullptr, persistentFlags);
+			slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes, persistentFlags);
+		}
+		else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, slotBytes, nullptr, GL_STREAM_DRAW);
+			mapSlot(slot);
+		}
+		freeSlots.push_back(i);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	loader = std::thread(&TextureUploader::loaderLoop, this);
+}
+
+TextureUploader::~TextureUploader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	loader.join();
+
+	for (auto & slot : slots) {
+		if (slot.fence) {
+			glDeleteSync(slot.fence);
+		}
+		if (slot.mapped) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		glDeleteBuffers(1, &slot.buffer);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureUploader::mapSlot(Slot & slot)
+{
+	// Only reached once the slot's fence has signalled, so the GPU is done
+	// with the old contents.
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+	slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureUploader::enqueue(const UploadRequest & request)
+{
+	++request.group->remaining;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(std::make_shared<UploadRequest>(request));
+		++inFlight;
+	}
+	wake.notify_all();
+}
+
+bool TextureUploader::idle() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return inFlight == 0;
+}
+
+void TextureUploader::loaderLoop()
+{
+	for (;;) {
+		std::shared_ptr<UploadRequest> request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !requests.empty(); });
+			if (stopping) {
+				return;
+			}
+			request = requests.front();
+			requests.pop_front();
+		}
+		stageRequest(request);
+	}
+}
+
+int TextureUploader::acquireSlot()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	wake.wait(lock, [this] { return stopping || !freeSlots.empty(); });
+	if (stopping) {
+		return -1;
+	}
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+	return slot;
+}
+
+void TextureUploader::stageRequest(const std::shared_ptr<UploadRequest> & request)
+{
+	Band band;
+	band.request = request;
+	band.image = request->image.get();
+	band.slot = -1;
+	band.firstRow = 0;
+	band.rows = 0;
+	band.lastBand = false;
+
+	const PPMImage & image = band.image->image;
+	size_t texelBytes = image.type() == GL_UNSIGNED_SHORT ? 6 : 3;
+	size_t srcRowBytes = (size_t)image.width() * texelBytes;
+	size_t rowBytes = (size_t)image.width() * 4;
+	if (request->group->cancelled || image.pixels() == nullptr || rowBytes > slotBytes) {
+		if (rowBytes > slotBytes) {
+			std::cerr << "TextureUploader: rows of " << rowBytes << " bytes do not fit a " << slotBytes << " byte staging buffer" << std::endl;
+		}
+		// Nothing to upload, but the GL thread still has to retire the request.
+		band.lastBand = true;
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(band);
+		return;
+	}
+
+	if (request->placeholder != 0) {
+		// Point sample the most significant byte of each channel.
+		int size = request->placeholderSize;
+		Band small = band;
+		small.firstRow = -1;
+		small.placeholderPixels.resize((size_t)size * size * 4);
+		for (int y = 0; y < size; y++) {
+			const unsigned char* row = image.pixels() + (size_t)((y * 2 + 1) * image.height() / (size * 2)) * srcRowBytes;
+			for (int x = 0; x < size; x++) {
+				const unsigned char* texel = row + (size_t)((x * 2 + 1) * image.width() / (size * 2)) * texelBytes;
+				unsigned char* dst = &small.placeholderPixels[((size_t)y * size + x) * 4];
+				for (int c = 0; c < 3; c++) {
+					dst[c] = texel[c * (texelBytes / 3)];
+				}
+				dst[3] = 0xff;
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(small);
+	}
+
+	int rowsPerBand = (int)std::min<size_t>(image.height(), slotBytes / rowBytes);
+	for (int row = 0; row < image.height(); row += rowsPerBand) {
+		band.slot = acquireSlot();
+		if (band.slot < 0) {
+			return;
+		}
+		band.firstRow = row;
+		band.rows = std::min(rowsPerBand, image.height() - row);
+		band.lastBand = row + band.rows >= image.height();
+		if (!request->group->cancelled) {
+			// Expanding to RGBA8 here is free next to the copy itself and
+			// keeps the driver off its 3-byte swizzle path.
+			convertToRGBA8(image.pixels() + (size_t)row * srcRowBytes, image.type(), slots[band.slot].mapped,
+				(size_t)band.rows * image.width());
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(band);
+	}
+}
+
+void TextureUploader::recycleSlots()
+{
+	std::vector<int> signalled;
+	for (auto i = fencedSlots.begin(); i != fencedSlots.end();) {
+		Slot & slot = slots[*i];
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			if (!persistent) {
+				mapSlot(slot);
+			}
+			signalled.push_back(*i);
+			i = fencedSlots.erase(i);
+		}
+		else {
+			++i;
+		}
+	}
+
+	if (!signalled.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			freeSlots.insert(freeSlots.end(), signalled.begin(), signalled.end());
+		}
+		wake.notify_all();
+	}
+}
+
+void TextureUploader::update(size_t budgetBytes)
+{
+	recycleSlots();
+
+	size_t spent = 0;
+	// Always retire at least one band so a band larger than the budget
+	// cannot stall the queue.
+	while (spent == 0 || spent < budgetBytes) {
+		Band band;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (ready.empty()) {
+				break;
+			}
+			band = std::move(ready.front());
+			ready.pop_front();
+		}
+		size_t bytes = (size_t)band.rows * band.image->image.width() * 4;
+		uploadBand(band);
+		spent += std::max<size_t>(bytes, 1);
+	}
+	uploadedBytes_ += spent;
+}
+
+void TextureUploader::uploadBand(Band & band)
+{
+	const UploadRequest & request = *band.request;
+	const PPMImage & image = band.image->image;
+
+	if (request.group->cancelled) {
+		if (band.slot >= 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			freeSlots.push_back(band.slot);
+			wake.notify_all();
+		}
+	}
+	else if (band.firstRow < 0) {
+		glBindTexture(request.bindTarget, request.placeholder);
+		glTexImage2D(request.imageTarget, 0, request.internalFormat, request.placeholderSize, request.placeholderSize,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, &band.placeholderPixels[0]);
+		return;
+	}
+	else if (band.rows > 0) {
+		glBindTexture(request.bindTarget, request.texture);
+		if (band.firstRow == 0) {
+			// A re-upload of the same size keeps the old image visible until
+			// each band overwrites it rather than reallocating it blank.
+			GLint width = 0, height = 0;
+			glGetTexLevelParameteriv(request.imageTarget, request.level, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(request.imageTarget, request.level, GL_TEXTURE_HEIGHT, &height);
+			if (width != image.width() || height != image.height()) {
+				glTexImage2D(request.imageTarget, request.level, request.internalFormat, image.width(), image.height(),
+					0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+
+		Slot & slot = slots[band.slot];
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		if (!persistent) {
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			slot.mapped = nullptr;
+		}
+		glTexSubImage2D(request.imageTarget, request.level, 0, band.firstRow, image.width(), band.rows,
+			GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		fencedSlots.push_back(band.slot);
+	}
+
+	if (band.lastBand) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			--inFlight;
+		}
+		if (--request.group->remaining == 0 && !request.group->cancelled && request.group->onResident) {
+			request.group->onResident();
+		}
+	}
+}
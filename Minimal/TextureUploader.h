@@ -0,0 +1,108 @@
+#ifndef _TEXTURE_UPLOADER_H_
+#define _TEXTURE_UPLOADER_H_
+
+#include <GL\glew.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TextureCache.h"
+
+// Faces queued together; onResident runs on the GL thread once every face
+// in the group has been uploaded. Setting cancelled drops whatever has not
+// been uploaded yet (e.g. when the owner is destroyed).
+struct UploadGroup
+{
+	UploadGroup() : cancelled(false), remaining(0) {}
+	std::atomic<bool> cancelled;
+	int remaining;
+	std::function<void()> onResident;
+};
+
+struct UploadRequest
+{
+	std::shared_future<DecodedImageRef> image;
+	GLuint texture;
+	GLenum bindTarget;		// e.g. GL_TEXTURE_CUBE_MAP
+	GLenum imageTarget;		// e.g. GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+	GLint level;
+	GLenum internalFormat;
+	// Optional low resolution stand-in, filled by point sampling the image.
+	GLuint placeholder;
+	int placeholderSize;
+	std::shared_ptr<UploadGroup> group;
+};
+
+// Streams decoded images into existing textures without stalling the render
+// thread. A loader thread converts rows to RGBA8 into a ring of persistently
+// mapped pixel buffer objects; update() then issues glTexSubImage2D from those
+// buffers, at most budgetBytes per call, and fences each buffer before it is
+// reused.
+class TextureUploader
+{
+public:
+	TextureUploader(size_t slotBytes = 4 * 1024 * 1024, int slotCount = 4);
+	~TextureUploader();
+
+	// Both must be called on the GL thread.
+	void enqueue(const UploadRequest & request);
+	void update(size_t budgetBytes);
+
+	bool idle() const;
+	size_t uploadedBytes() const { return uploadedBytes_; }
+
+private:
+	TextureUploader(const TextureUploader &);
+	TextureUploader & operator=(const TextureUploader &);
+
+	struct Slot
+	{
+		GLuint buffer;
+		unsigned char* mapped;
+		GLsync fence;
+	};
+
+	// A band of rows staged in one slot, or a placeholder image in client
+	// memory when slot is -1.
+	struct Band
+	{
+		std::shared_ptr<UploadRequest> request;
+		DecodedImageRef image;
+		int slot;
+		int firstRow, rows;
+		bool lastBand;
+		std::vector<unsigned char> placeholderPixels;
+	};
+
+	void loaderLoop();
+	void stageRequest(const std::shared_ptr<UploadRequest> & request);
+	int acquireSlot();
+	void uploadBand(Band & band);
+	void recycleSlots();
+	void mapSlot(Slot & slot);
+
+	size_t slotBytes;
+	bool persistent;
+	std::vector<Slot> slots;
+
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::shared_ptr<UploadRequest>> requests;
+	std::deque<Band> ready;
+	std::vector<int> freeSlots;
+	std::vector<int> fencedSlots;
+	int inFlight;
+	bool stopping;
+	std::thread loader;
+
+	size_t uploadedBytes_;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threadCount)
+	: stopping(false)
+{
+	if (threadCount == 0) {
+		unsigned cores = std::thread::hardware_concurrency();
+		threadCount = std::min(4u, cores > 1 ? cores - 1 : 1u);
+	}
+	for (unsigned i = 0; i < threadCount; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto & worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool & ThreadPool::shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+size_t ThreadPool::queueReady()
+{
+	size_t queued = 0;
+	for (size_t i = 0; i < deferred_.size();) {
+		if (deferred_[i].ready()) {
+			jobs.push(std::move(deferred_[i].job));
+			deferred_.erase(deferred_.begin() + i);
+			++queued;
+		}
+		else {
+			i++;
+		}
+	}
+	return queued;
+}
+
+void ThreadPool::workerLoop()
+{
+	bool finished = false;
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			// The job just run may be the last input some deferred job was
+			// waiting for; this worker takes one of those and wakes others
+			// for the rest.
+			if (finished) {
+				size_t queued = queueReady();
+				for (size_t i = 1; i < queued; i++) {
+					wake.notify_one();
+				}
+			}
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty()) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		job();
+		finished = true;
+	}
+}
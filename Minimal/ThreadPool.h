@@ -0,0 +1,112 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A small fixed-size pool of worker threads. Jobs run in submission order;
+// submit() returns a future for the job's result. No GL calls may be made
+// from a job - the pool threads have no context current.
+//
+// A job that needs the results of others is given to submitAfter() with
+// their futures rather than waiting on them, so it only takes a worker
+// once they are ready instead of holding one while they run.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+
+	template <typename Function>
+	std::future<typename std::result_of<Function()>::type> submit(Function function) {
+		typedef typename std::result_of<Function()>::type Result;
+		auto task = std::make_shared<std::packaged_task<Result()>>(function);
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push([task] { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	// Queues function once every one of after is ready; each is a
+	// std::shared_future or a std::vector of them. They have to be results
+	// of jobs on this pool, as they are only looked at again when a job
+	// finishes.
+	template <typename Function, typename... Futures>
+	std::future<typename std::result_of<Function()>::type> submitAfter(Function function, const Futures &... after) {
+		typedef typename std::result_of<Function()>::type Result;
+		auto task = std::make_shared<std::packaged_task<Result()>>(function);
+		std::future<Result> result = task->get_future();
+		Deferred deferred;
+		deferred.ready = [after...] { return allReady(after...); };
+		deferred.job = [task] { (*task)(); };
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (deferred.ready()) {
+				jobs.push(std::move(deferred.job));
+			}
+			else {
+				deferred_.push_back(std::move(deferred));
+				return result;
+			}
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	unsigned size() const { return (unsigned)workers.size(); }
+
+	// Pool shared by the loaders, sized to leave one core for the render thread.
+	static ThreadPool & shared();
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool & operator=(const ThreadPool &);
+	void workerLoop();
+	// Moves the deferred jobs whose inputs are now ready to the queue; the
+	// mutex is held. Returns how many.
+	size_t queueReady();
+
+	struct Deferred
+	{
+		std::function<bool()> ready;
+		std::function<void()> job;
+	};
+
+	template <typename T>
+	static bool isReady(const std::shared_future<T> & future) {
+		return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+	template <typename T>
+	static bool isReady(const std::vector<std::shared_future<T>> & futures) {
+		for (const auto & future : futures) {
+			if (!isReady(future)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	static bool allReady() { return true; }
+	template <typename First, typename... Rest>
+	static bool allReady(const First & first, const Rest &... rest) {
+		return isReady(first) && allReady(rest...);
+	}
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::vector<Deferred> deferred_;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "ViewUniforms.h"
+
+const char* const ViewUniforms::BLOCK_NAME = "View";
+const char* const ViewUniforms::LAYERS_BLOCK_NAME = "Layers";
+
+ViewUniforms::ViewUniforms(int slots)
+	: buffer(0), slots(slots), layersBuffer(0), viewProjections(slots)
+{
+	// Ranges bound with glBindBufferRange must start on this alignment.
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = ((GLsizeiptr)sizeof(Block) + alignment - 1) / alignment * alignment;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, stride * slots, nullptr, GL_STREAM_DRAW);
+	glGenBuffers(1, &layersBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, layersBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * MAX_LAYERS, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+ViewUniforms::~ViewUniforms()
+{
+	glDeleteBuffers(1, &layersBuffer);
+	glDeleteBuffers(1, &buffer);
+}
+
+void ViewUniforms::begin()
+{
+	// Last frame's draws may still be reading the old storage; orphaning
+	// gives this frame fresh storage instead of waiting for them.
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, stride * slots, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ViewUniforms::set(int slot, const glm::mat4 & projection, const glm::mat4 & pose)
+{
+	Block block;
+	block.projection = projection;
+	block.view = glm::inverse(pose);
+	block.viewProjection = projection * block.view;
+	block.eyePosition = pose[3];
+	viewProjections[slot] = block.viewProjection;
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, stride * slot, sizeof(block), &block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ViewUniforms::bind(int slot) const
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, stride * slot, sizeof(Block));
+}
+
+void ViewUniforms::bindStereo(int left, int right) const
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, stride * left, sizeof(Block));
+	glBindBufferRange(GL_UNIFORM_BUFFER, RIGHT_BINDING, buffer, stride * right, sizeof(Block));
+}
+
+void ViewUniforms::bindLayers(int first, int count)
+{
+	// A mat4 array has the same layout in C++ as in std140. The whole
+	// block is orphaned, as in begin().
+	if (count > MAX_LAYERS) {
+		count = MAX_LAYERS;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, layersBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * MAX_LAYERS, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4) * count, &viewProjections[first]);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LAYERS_BINDING, layersBuffer);
+}
@@ -0,0 +1,77 @@
+#ifndef _VIEW_UNIFORMS_H_
+#define _VIEW_UNIFORMS_H_
+
+#include <GL\glew.h>
+#include <glm\glm.hpp>
+
+#include <vector>
+
+// The per-view state every draw shares, as a std140 uniform block:
+//
+//	layout (std140) uniform View {
+//		mat4 projection;
+//		mat4 view;
+//		mat4 viewProjection;
+//		vec4 eyePosition;
+//	};
+//
+// One buffer holds a slot per view (eye, wall). begin() orphans it at the
+// start of a frame, set() fills a slot once, and bind() attaches a slot to
+// BINDING for the draws of that view, which then only upload their model
+// matrix. ProgramCache points every program's View block at BINDING.
+//
+// Shaders that draw several layers in one instanced draw instead read
+//
+//	layout (std140) uniform Layers {
+//		mat4 layerViewProjection[MAX_LAYERS];
+//	};
+//
+// filled from a run of slots by bindLayers().
+class ViewUniforms
+{
+public:
+	static const GLuint BINDING = 0;
+	// Stereo shaders declare View as an array of two; the right eye's is
+	// bound here.
+	static const GLuint RIGHT_BINDING = 1;
+	static const char* const BLOCK_NAME;
+	static const GLuint LAYERS_BINDING = 2;
+	static const char* const LAYERS_BLOCK_NAME;
+	static const int MAX_LAYERS = 16;
+
+	explicit ViewUniforms(int slots);
+	~ViewUniforms();
+
+	void begin();
+	// pose is the eye's transform into the world, i.e. the inverse view.
+	void set(int slot, const glm::mat4 & projection, const glm::mat4 & pose);
+	// What set() last wrote to slot.
+	const glm::mat4 & viewProjection(int slot) const { return viewProjections[slot]; }
+	void bind(int slot) const;
+	// For the stereo shaders, which draw both eyes at once.
+	void bindStereo(int left, int right) const;
+	// Uploads the view-projections of slots first to first + count - 1
+	// as the Layers block and binds it.
+	void bindLayers(int first, int count);
+
+private:
+	ViewUniforms(const ViewUniforms &);
+	ViewUniforms & operator=(const ViewUniforms &);
+
+	struct Block
+	{
+		glm::mat4 projection;
+		glm::mat4 view;
+		glm::mat4 viewProjection;
+		glm::vec4 eyePosition;
+	};
+
+	GLuint buffer;
+	int slots;
+	GLsizeiptr stride;
+	GLuint layersBuffer;
+	// What set() last wrote, for bindLayers.
+	std::vector<glm::mat4> viewProjections;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "VirtualTexture.h"
+#include "Program.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+namespace {
+	// lastWanted of the top level tiles, which are never evicted.
+	const unsigned PINNED = UINT_MAX;
+
+	// The head keeps turning between the residency pass and scan-out, so a
+	// little more than the frustum is requested.
+	const float RESIDENCY_MARGIN = 1.15f;
+
+	// Tiles being faulted in on the pool at once.
+	const size_t MAX_PAGE_INS = 64;
+
+	// Major axis selection from the cube map table of the GL spec, with s and
+	// t returned in [-1, 1]. shader.frag repeats this.
+	int cubeFace(const glm::vec3 & d, float & s, float & t)
+	{
+		glm::vec3 a = glm::abs(d);
+		if (a.x >= a.y && a.x >= a.z) {
+			s = (d.x > 0.0f ? -d.z : d.z) / a.x;
+			t = -d.y / a.x;
+			return d.x > 0.0f ? 0 : 1;
+		}
+		if (a.y >= a.z) {
+			s = d.x / a.y;
+			t = (d.y > 0.0f ? d.z : -d.z) / a.y;
+			return d.y > 0.0f ? 2 : 3;
+		}
+		s = (d.z > 0.0f ? d.x : -d.x) / a.z;
+		t = -d.y / a.z;
+		return d.z > 0.0f ? 4 : 5;
+	}
+}
+
+VirtualTexture::VirtualTexture()
+	: atlas(0), pageTable(0), slotsPerSide(0), dirtyLevel(-1), frame(0), warnedFull(false)
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	// The page-in jobs read through the mapping, so it must outlive them.
+	for (auto & pageIn : pageIns) {
+		pageIn.done.wait();
+	}
+	if (atlas != 0) {
+		TextureCache::instance().releaseTexture(atlas);
+	}
+	if (pageTable != 0) {
+		TextureCache::instance().releaseTexture(pageTable);
+	}
+}
+
+bool VirtualTexture::open(const char* filename, size_t budgetBytes)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	if (!file.open(filename)) {
+		return false;
+	}
+	this->filename = filename;
+
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int size = file.slotSize();
+	// Slot coordinates have to fit the 8-bit page table entries.
+	slotsPerSide = (int)sqrt((double)budgetBytes / file.tileBytes());
+	slotsPerSide = std::min(slotsPerSide, std::min(maxSize / size, 256));
+	if (slotsPerSide * slotsPerSide < 6 * 5) {
+		std::cerr << "VirtualTexture " << filename << ": a budget of " << budgetBytes << " bytes holds only "
+			<< slotsPerSide * slotsPerSide << " tiles of " << file.tileBytes() << " bytes" << std::endl;
+		file.close();
+		return false;
+	}
+
+	Slot free = { -1, 0, 0 };
+	slots.assign(slotsPerSide * slotsPerSide, free);
+	slotOfTile.assign(file.tileCount(), -1);
+	wantedFrame.assign(file.tileCount(), 0);
+	pagingIn.assign(file.tileCount(), false);
+
+	glGenTextures(1, &atlas);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, slotsPerSide * size, slotsPerSide * size, 0, GL_RGBA,
+		GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	glGenTextures(1, &pageTable);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+	entries.resize(file.levels());
+	for (int level = 0; level < file.levels(); level++) {
+		int n = file.tilesPerSide(level);
+		entries[level].assign((size_t)n * n * 6 * 4, 0);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8UI, n, n, 6, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, file.levels() - 1);
+
+	// The atlas is already sized by its own budget and the page table cannot
+	// be rebuilt, so neither is evicted; they are counted all the same.
+	TextureCache & cache = TextureCache::instance();
+	cache.adoptTexture(atlas, GL_TEXTURE_2D, (size_t)slotsPerSide * size * slotsPerSide * size * 4, true);
+	size_t pageTableBytes = 0;
+	for (const auto & level : entries) {
+		pageTableBytes += level.size();
+	}
+	cache.adoptTexture(pageTable, GL_TEXTURE_2D_ARRAY, pageTableBytes, true);
+
+	int top = file.levels() - 1;
+	for (int face = 0; face < 6; face++) {
+		int tile = file.tileIndex(face, top, 0, 0);
+		upload(tile, top);
+		slots[slotOfTile[tile]].lastWanted = PINNED;
+	}
+	updatePageTable();
+
+	std::cout << "VirtualTexture " << filename << ": 6 x " << file.header().faceSize << "x" << file.header().faceSize
+		<< " in " << file.tileSize() << " texel tiles, " << file.levels() << " levels; atlas holds " << slots.size()
+		<< " of " << file.tileCount() << " tiles (" << residentBytes() << " bytes), opened in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+		<< " ms" << std::endl;
+	return true;
+}
+
+void VirtualTexture::update(const VirtualTextureView* views, int count, size_t uploadBytes)
+{
+	if (!file.isOpen()) {
+		return;
+	}
+	++frame;
+	wanted.clear();
+
+	float faceScale = 0.5f * file.header().faceSize;
+	// At the level picked below a tile spans at least tileSize / 2 pixels,
+	// so rays half that far apart cannot step over one.
+	int spacing = std::max(1, file.tileSize() / 4);
+	for (int i = 0; i < count; i++) {
+		const VirtualTextureView & view = views[i];
+		float left = view.tanLeft * RESIDENCY_MARGIN, right = view.tanRight * RESIDENCY_MARGIN;
+		float up = view.tanUp * RESIDENCY_MARGIN, down = view.tanDown * RESIDENCY_MARGIN;
+		float pixelTan = (view.tanLeft + view.tanRight) / view.width;
+		int columns = view.width / spacing + 2, rows = view.height / spacing + 2;
+		for (int y = 0; y < rows; y++) {
+			float v = -down + (up + down) * y / (rows - 1);
+			for (int x = 0; x < columns; x++) {
+				float u = -left + (left + right) * x / (columns - 1);
+				float distance = u * u + v * v;
+				float s, t;
+				int face = cubeFace(view.orientation * glm::vec3(u, v, -1.0f), s, t);
+
+				// The same estimate shader.frag makes from its derivatives:
+				// the angle one pixel subtends times the face texels per
+				// radian there.
+				float footprint = pixelTan / sqrtf(1.0f + distance) * faceScale * sqrtf(1.0f + s * s + t * t);
+				int level = footprint > 1.0f ? std::min((int)log2f(footprint), file.levels() - 1) : 0;
+				want(face, level, s, t, distance);
+				// The parent covers the shader rounding to the next level up.
+				if (level + 1 < file.levels()) {
+					want(face, level + 1, s, t, distance);
+				}
+			}
+		}
+	}
+
+	// Coarse tiles first, so everything in view has a fallback, then
+	// outwards from the centre of view.
+	std::sort(wanted.begin(), wanted.end(), [](const Wanted & a, const Wanted & b) {
+		return a.level != b.level ? a.level > b.level : a.distance < b.distance;
+	});
+	if (wanted.size() > slots.size()) {
+		if (!warnedFull) {
+			std::cerr << "VirtualTexture " << filename << ": " << wanted.size() << " tiles in view but room for "
+				<< slots.size() << "; the periphery will stay blurry" << std::endl;
+			warnedFull = true;
+		}
+		for (size_t i = slots.size(); i < wanted.size(); i++) {
+			wantedFrame[wanted[i].tile] = 0;
+		}
+		wanted.resize(slots.size());
+	}
+
+	for (const Wanted & tile : wanted) {
+		int slot = slotOfTile[tile.tile];
+		if (slot >= 0) {
+			if (slots[slot].lastWanted != PINNED) {
+				slots[slot].lastWanted = frame;
+			}
+			continue;
+		}
+		if (pagingIn[tile.tile] || pageIns.size() >= MAX_PAGE_INS) {
+			continue;
+		}
+		// Fault the pages in on the pool so the upload below does not
+		// stall the GL thread on the disk.
+		pagingIn[tile.tile] = true;
+		const VirtualTextureFile* source = &file;
+		int index = tile.tile;
+		PageIn pageIn;
+		pageIn.tile = tile.tile;
+		pageIn.level = tile.level;
+		pageIn.done = ThreadPool::shared().submit([source, index] { source->prefetch(index); });
+		pageIns.push_back(std::move(pageIn));
+	}
+
+	size_t spent = 0;
+	size_t kept = 0;
+	for (size_t i = 0; i < pageIns.size(); i++) {
+		if (spent >= uploadBytes || pageIns[i].done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			if (kept != i) {
+				pageIns[kept] = std::move(pageIns[i]);
+			}
+			++kept;
+			continue;
+		}
+		pagingIn[pageIns[i].tile] = false;
+		// Tiles the views have moved away from are dropped rather than
+		// evicting ones still in use.
+		if (wantedFrame[pageIns[i].tile] == frame && upload(pageIns[i].tile, pageIns[i].level)) {
+			spent += file.tileBytes();
+		}
+	}
+	pageIns.erase(pageIns.begin() + kept, pageIns.end());
+
+	if (dirtyLevel >= 0) {
+		updatePageTable();
+	}
+}
+
+void VirtualTexture::want(int face, int level, float s, float t, float distance)
+{
+	int n = file.tilesPerSide(level);
+	int x = std::max(0, std::min(n - 1, (int)((s * 0.5f + 0.5f) * n)));
+	int y = std::max(0, std::min(n - 1, (int)((t * 0.5f + 0.5f) * n)));
+	int tile = file.tileIndex(face, level, x, y);
+	if (wantedFrame[tile] == frame) {
+		return;
+	}
+	wantedFrame[tile] = frame;
+	Wanted entry = { tile, level, distance };
+	wanted.push_back(entry);
+}
+
+int VirtualTexture::findSlot()
+{
+	int oldest = -1;
+	for (int i = 0; i < (int)slots.size(); i++) {
+		if (slots[i].tile < 0) {
+			return i;
+		}
+		// Tiles wanted this frame are in view; pinned ones never compare older.
+		if (slots[i].lastWanted < frame && (oldest < 0 || slots[i].lastWanted < slots[oldest].lastWanted)) {
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+bool VirtualTexture::upload(int tile, int level)
+{
+	int slot = findSlot();
+	if (slot < 0) {
+		return false;
+	}
+	Slot & entry = slots[slot];
+	if (entry.tile >= 0) {
+		slotOfTile[entry.tile] = -1;
+		dirtyLevel = std::max(dirtyLevel, entry.level);
+	}
+	entry.tile = tile;
+	entry.level = level;
+	entry.lastWanted = frame;
+	slotOfTile[tile] = slot;
+	dirtyLevel = std::max(dirtyLevel, level);
+
+	int size = file.slotSize();
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % slotsPerSide) * size, (slot / slotsPerSide) * size, size, size,
+		GL_RGBA, GL_UNSIGNED_BYTE, file.tile(tile));
+	return true;
+}
+
+void VirtualTexture::updatePageTable()
+{
+	// A change at one level shows through every finer level that falls
+	// back to it, so those are rebuilt too, coarsest first.
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+	for (int level = dirtyLevel; level >= 0; level--) {
+		int n = file.tilesPerSide(level);
+		std::vector<unsigned char> & texels = entries[level];
+		for (int face = 0; face < 6; face++) {
+			for (int y = 0; y < n; y++) {
+				for (int x = 0; x < n; x++) {
+					unsigned char* entry = &texels[(((size_t)face * n + y) * n + x) * 4];
+					int slot = slotOfTile[file.tileIndex(face, level, x, y)];
+					if (slot >= 0) {
+						entry[0] = (unsigned char)(slot % slotsPerSide);
+						entry[1] = (unsigned char)(slot / slotsPerSide);
+						entry[2] = (unsigned char)level;
+						entry[3] = 0;
+					}
+					else {
+						// The top level is pinned, so a missing tile always has a parent.
+						int parent = n / 2;
+						memcpy(entry, &entries[level + 1][(((size_t)face * parent + y / 2) * parent + x / 2) * 4], 4);
+					}
+				}
+			}
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, n, n, 6, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &texels[0]);
+	}
+	dirtyLevel = -1;
+}
+
+void VirtualTexture::bind(Program & program) const
+{
+	glActiveTexture(GL_TEXTURE0 + PAGE_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+	glActiveTexture(GL_TEXTURE0 + ATLAS_UNIT);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glActiveTexture(GL_TEXTURE0);
+
+	program.set("vtFaceSize", (GLfloat)file.header().faceSize);
+	program.set("vtTileSize", (GLfloat)file.tileSize());
+	program.set("vtBorder", (GLfloat)file.border());
+	program.set("vtSlotSize", (GLfloat)file.slotSize());
+	program.set("vtAtlasSize", (GLfloat)(slotsPerSide * file.slotSize()));
+	program.set("vtLevels", (GLint)file.levels());
+}
@@ -0,0 +1,104 @@
+#ifndef _VIRTUAL_TEXTURE_H_
+#define _VIRTUAL_TEXTURE_H_
+
+#include <GL\glew.h>
+#include <glm\glm.hpp>
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "VirtualTextureFile.h"
+
+class Program;
+
+// What one eye can see: the rotation from eye space into the cube map's
+// space, the tangents of the frustum half angles (as in ovrFovPort) and the
+// viewport it is rendered at.
+struct VirtualTextureView
+{
+	glm::mat3 orientation;
+	float tanLeft, tanRight, tanUp, tanDown;
+	int width, height;
+};
+
+// A cube map streamed tile by tile out of a .vtex file (see
+// VirtualTextureFile). Resident tiles live in one atlas texture whose size
+// is fixed by the byte budget given to open(), whatever the size of the
+// asset; when it is full the tile wanted least recently is evicted. A page
+// table texture, one texel per tile with a mip level per tile level and a
+// layer per face, points each tile at the finest resident tile covering it,
+// so shader.frag falls back to a coarser tile until the finer one arrives.
+// The top level of every face is pinned so there is always something to
+// fall back to.
+class VirtualTexture
+{
+public:
+	// Texture units the page table and atlas are bound to; shader.frag's
+	// cube map sampler stays on unit 0.
+	static const GLuint PAGE_TABLE_UNIT = 1;
+	static const GLuint ATLAS_UNIT = 2;
+
+	VirtualTexture();
+	~VirtualTexture();
+	// GL thread only. Maps the file, creates the textures and uploads the
+	// pinned top level.
+	bool open(const char* filename, size_t budgetBytes);
+	// Works out which tiles the views need and at what level, starts paging
+	// in the ones that are missing and uploads up to uploadBytes of tiles
+	// whose pages are in. Call once per frame on the GL thread.
+	void update(const VirtualTextureView* views, int count, size_t uploadBytes);
+	// Binds the textures and sets the layout uniforms shader.frag reads
+	// with SHADER_VIRTUAL_TEXTURE.
+	void bind(Program & program) const;
+	size_t residentBytes() const { return slots.size() * file.tileBytes(); }
+
+private:
+	VirtualTexture(const VirtualTexture &);
+	VirtualTexture & operator=(const VirtualTexture &);
+
+	struct Slot
+	{
+		int tile;				// -1 when free
+		int level;
+		unsigned lastWanted;	// PINNED for the top level
+	};
+
+	struct Wanted
+	{
+		int tile;
+		int level;
+		float distance;			// from the centre of the view, in tangent units
+	};
+
+	struct PageIn
+	{
+		int tile;
+		int level;
+		std::future<void> done;
+	};
+
+	void want(int face, int level, float s, float t, float distance);
+	bool upload(int tile, int level);
+	int findSlot();
+	void updatePageTable();
+
+	VirtualTextureFile file;
+	std::string filename;
+	GLuint atlas, pageTable;
+	int slotsPerSide;
+	std::vector<Slot> slots;
+	std::vector<int> slotOfTile;
+	std::vector<unsigned> wantedFrame;
+	std::vector<bool> pagingIn;
+	std::vector<Wanted> wanted;
+	std::vector<PageIn> pageIns;
+	// Per level, RGBA8UI texels of (slot x, slot y, resident level, 0) for
+	// every tile of every face.
+	std::vector<std::vector<unsigned char>> entries;
+	int dirtyLevel;
+	unsigned frame;
+	bool warnedFull;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "VirtualTextureFile.h"
+
+#include <iostream>
+#include <string.h>
+
+bool VirtualTextureFile::makeHeader(VirtualTextureFileHeader & header, uint32_t faceSize, uint32_t tileSize,
+	uint32_t border)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VIRTUAL_TEXTURE_FILE_MAGIC, 4);
+	header.version = VIRTUAL_TEXTURE_FILE_VERSION;
+	header.faceSize = faceSize;
+	header.tileSize = tileSize;
+	header.border = border;
+	if (tileSize == 0 || faceSize < tileSize || faceSize % tileSize != 0) {
+		return false;
+	}
+	uint32_t tiles = faceSize / tileSize;
+	if ((tiles & (tiles - 1)) != 0) {
+		return false;
+	}
+	for (header.levels = 1; tiles > 1; tiles /= 2) {
+		++header.levels;
+	}
+	return true;
+}
+
+uint64_t VirtualTextureFile::fileSize(const VirtualTextureFileHeader & header)
+{
+	uint64_t slot = header.tileSize + 2 * header.border;
+	uint64_t tiles = 0;
+	for (uint32_t level = 0; level < header.levels; level++) {
+		uint64_t side = (header.faceSize / header.tileSize) >> level;
+		tiles += side * side;
+	}
+	return sizeof(VirtualTextureFileHeader) + tiles * 6 * slot * slot * 4;
+}
+
+bool VirtualTextureFile::open(const char* filename)
+{
+	close();
+	if (!file.open(filename)) {
+		std::cerr << "error reading virtual texture file, could not locate " << filename << std::endl;
+		return false;
+	}
+
+	const VirtualTextureFileHeader* header = (const VirtualTextureFileHeader*)file.data();
+	if (file.size() < sizeof(VirtualTextureFileHeader) || memcmp(header->magic, VIRTUAL_TEXTURE_FILE_MAGIC, 4) != 0
+		|| header->version != VIRTUAL_TEXTURE_FILE_VERSION) {
+		std::cerr << "error parsing virtual texture file, " << filename << " is not a version "
+			<< VIRTUAL_TEXTURE_FILE_VERSION << " .vtex file" << std::endl;
+		close();
+		return false;
+	}
+
+	VirtualTextureFileHeader expected;
+	if (!makeHeader(expected, header->faceSize, header->tileSize, header->border) || expected.levels != header->levels
+		|| header->border > header->tileSize || file.size() < fileSize(*header)) {
+		std::cerr << "error parsing virtual texture file, bad tile layout or incomplete data in " << filename << std::endl;
+		close();
+		return false;
+	}
+
+	header_ = header;
+	tilesPerFace = 0;
+	for (int level = 0; level < levels(); level++) {
+		levelStart[level] = tilesPerFace;
+		tilesPerFace += tilesPerSide(level) * tilesPerSide(level);
+	}
+	return true;
+}
+
+void VirtualTextureFile::close()
+{
+	file.close();
+	header_ = nullptr;
+}
+
+int VirtualTextureFile::tileIndex(int face, int level, int x, int y) const
+{
+	return face * tilesPerFace + levelStart[level] + y * tilesPerSide(level) + x;
+}
@@ -0,0 +1,67 @@
+#ifndef _VIRTUAL_TEXTURE_FILE_H_
+#define _VIRTUAL_TEXTURE_FILE_H_
+
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+// Tiled cube map for virtual texturing (.vtex). Every face of every mip
+// level is cut into tileSize x tileSize tiles, stored as sRGB RGBA8 with
+// border texels copied from the neighbouring tiles of the same face (the
+// outermost ring is clamped) so bilinear filtering never reads outside a
+// tile. Levels run from faceSize down to a single tile per face. Tiles are
+// laid out face by face, then level by level, then row by row, so the
+// offset of any tile is computed rather than stored.
+#define VIRTUAL_TEXTURE_FILE_MAGIC "VTEX"
+#define VIRTUAL_TEXTURE_FILE_VERSION 1
+
+struct VirtualTextureFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t faceSize;			// level 0 face width and height in texels
+	uint32_t tileSize;			// texels of each tile that belong to it
+	uint32_t border;			// texels copied from the neighbours on each side
+	uint32_t levels;
+	uint32_t reserved[10];
+};
+
+class VirtualTextureFile
+{
+public:
+	VirtualTextureFile() : header_(nullptr) {}
+	bool open(const char* filename);
+	void close();
+	bool isOpen() const { return header_ != nullptr; }
+
+	const VirtualTextureFileHeader & header() const { return *header_; }
+	int levels() const { return (int)header_->levels; }
+	int tileSize() const { return (int)header_->tileSize; }
+	int border() const { return (int)header_->border; }
+	// Width and height of a stored tile, borders included.
+	int slotSize() const { return (int)(header_->tileSize + 2 * header_->border); }
+	size_t tileBytes() const { return (size_t)slotSize() * slotSize() * 4; }
+	int tilesPerSide(int level) const { return (int)(header_->faceSize / header_->tileSize) >> level; }
+	int tileCount() const { return tilesPerFace * 6; }
+
+	// Dense index over all tiles, in file order.
+	int tileIndex(int face, int level, int x, int y) const;
+	const unsigned char* tile(int index) const { return file.data() + offset(index); }
+	// Touch the pages of one tile; safe to call from a pool thread.
+	void prefetch(int index) const { file.prefetch(offset(index), tileBytes()); }
+
+	// Fills in the derived fields of a header for the given face and tile
+	// size, or returns false if faceSize is not tileSize times a power of two.
+	static bool makeHeader(VirtualTextureFileHeader & header, uint32_t faceSize, uint32_t tileSize, uint32_t border);
+	static uint64_t fileSize(const VirtualTextureFileHeader & header);
+
+private:
+	size_t offset(int index) const { return sizeof(VirtualTextureFileHeader) + (size_t)index * tileBytes(); }
+
+	MappedFile file;
+	const VirtualTextureFileHeader* header_;
+	int tilesPerFace;
+	int levelStart[32];
+};
+
+#endif
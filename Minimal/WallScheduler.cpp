@@ -0,0 +1,134 @@
+#include "WallScheduler.h"
+
+#include <algorithm>
+
+WallScheduler::WallScheduler(double budgetPixels)
+	: budgetPixels(budgetPixels), replans_(0)
+{
+}
+
+int WallScheduler::add(int pixels, int minInterval, int maxInterval)
+{
+	Pass pass;
+	pass.pixels = pixels;
+	pass.minInterval = std::max(1, std::min(minInterval, (int)MAX_INTERVAL));
+	pass.maxInterval = std::max(pass.minInterval, std::min(maxInterval, (int)MAX_INTERVAL));
+	pass.salience = 1.0f;
+	// Redrawn as often as it may be until the first plan(), which places
+	// it as it would a pass coming into view.
+	pass.interval = pass.minInterval;
+	pass.phase = 0;
+	pass.active = false;
+	passes.push_back(pass);
+	return (int)passes.size() - 1;
+}
+
+void WallScheduler::setSalience(int pass, float salience)
+{
+	passes[pass].salience = std::max(0.0f, std::min(salience, 1.0f));
+}
+
+bool WallScheduler::turn(int pass, unsigned frame) const
+{
+	const Pass & p = passes[pass];
+	return (int)(frame % (unsigned)p.interval) == p.phase;
+}
+
+double WallScheduler::plannedPixels() const
+{
+	double pixels = 0.0;
+	for (size_t i = 0; i < passes.size(); i++) {
+		if (passes[i].active) {
+			pixels += (double)passes[i].pixels / passes[i].interval;
+		}
+	}
+	return pixels;
+}
+
+void WallScheduler::plan()
+{
+	std::vector<int> intervals(passes.size());
+	for (size_t i = 0; i < passes.size(); i++) {
+		const Pass & pass = passes[i];
+		int wanted = pass.maxInterval;
+		if (pass.salience > 0.0f) {
+			// At least the share of the rate the pass deserves; a pass near
+			// a boundary keeps its interval, so it does not flip between
+			// two from one frame to the next.
+			wanted = (int)(1.0f / pass.salience);
+			if (pass.interval >= (int)(0.9f / pass.salience) && pass.interval <= (int)(1.1f / pass.salience)) {
+				wanted = pass.interval;
+			}
+		}
+		intervals[i] = std::max(pass.minInterval, std::min(wanted, pass.maxInterval));
+	}
+
+	// Over budget, the least salient pass that can still slow down does,
+	// a frame at a time.
+	if (budgetPixels > 0.0) {
+		for (;;) {
+			double pixels = 0.0;
+			int slowest = -1;
+			for (size_t i = 0; i < passes.size(); i++) {
+				const Pass & pass = passes[i];
+				if (pass.salience <= 0.0f) {
+					continue;
+				}
+				pixels += (double)pass.pixels / intervals[i];
+				if (intervals[i] < pass.maxInterval && (slowest < 0 || pass.salience < passes[slowest].salience)) {
+					slowest = (int)i;
+				}
+			}
+			if (pixels <= budgetPixels || slowest < 0) {
+				break;
+			}
+			++intervals[slowest];
+		}
+	}
+
+	// Passes that kept their interval keep their phase; the rest are
+	// placed, largest first, where the frames they land on are least
+	// loaded so far.
+	float load[CYCLE] = {};
+	std::vector<int> moved;
+	for (size_t i = 0; i < passes.size(); i++) {
+		Pass & pass = passes[i];
+		bool active = pass.salience > 0.0f;
+		if (intervals[i] == pass.interval && active == pass.active) {
+			if (active) {
+				for (int frame = pass.phase; frame < CYCLE; frame += pass.interval) {
+					load[frame] += (float)pass.pixels;
+				}
+			}
+			continue;
+		}
+		pass.interval = intervals[i];
+		pass.phase = 0;
+		pass.active = active;
+		if (active) {
+			moved.push_back((int)i);
+		}
+	}
+	if (moved.empty()) {
+		return;
+	}
+	std::sort(moved.begin(), moved.end(), [this](int a, int b) { return passes[a].pixels > passes[b].pixels; });
+	for (size_t m = 0; m < moved.size(); m++) {
+		Pass & pass = passes[moved[m]];
+		float best = 0.0f;
+		for (int phase = 0; phase < pass.interval; phase++) {
+			float peak = 0.0f;
+			for (int frame = phase; frame < CYCLE; frame += pass.interval) {
+				peak = std::max(peak, load[frame]);
+			}
+			if (phase == 0 || peak < best) {
+				best = peak;
+				pass.phase = phase;
+			}
+		}
+		for (int frame = pass.phase; frame < CYCLE; frame += pass.interval) {
+			load[frame] += (float)pass.pixels;
+		}
+	}
+	++replans_;
+}
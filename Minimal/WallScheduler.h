@@ -0,0 +1,62 @@
+#ifndef _WALL_SCHEDULER_H_
+#define _WALL_SCHEDULER_H_
+
+#include <vector>
+
+// Decides how often each of the CAVE's offscreen passes is redrawn. Every
+// frame plan() gets each pass's salience, the share of the full frame
+// rate it deserves (1 every frame, 0.5 every other, ...), and gives it an
+// interval within its bounds; if the passes would then draw more pixels a
+// frame than the budget, the least salient are slowed further. Each pass
+// also gets a phase, its turn within the interval, chosen so the pixels
+// drawn are spread evenly over the frames rather than all landing on the
+// same one.
+class WallScheduler
+{
+public:
+	// The longest interval; 30 frames a second on a 90 Hz headset.
+	static const int MAX_INTERVAL = 4;
+
+	// budgetPixels is the most pixels to draw a frame on average; 0 for no
+	// limit.
+	explicit WallScheduler(double budgetPixels);
+
+	// Adds a pass drawing pixels each update, redrawn every minInterval to
+	// maxInterval frames; returns its index.
+	int add(int pixels, int minInterval, int maxInterval);
+	// Salience of pass in (0, 1], or 0 when it is not drawn at all (hidden
+	// passes take no share of the budget).
+	void setSalience(int pass, float salience);
+	// Updates the intervals from the saliences, and the phases of the
+	// passes whose interval changed.
+	void plan();
+
+	int interval(int pass) const { return passes[pass].interval; }
+	// Whether frame is pass's turn to be redrawn.
+	bool turn(int pass, unsigned frame) const;
+	// Pixels the visible passes draw a frame on average, as planned.
+	double plannedPixels() const;
+	double budget() const { return budgetPixels; }
+	// Times plan() had to reassign phases.
+	int replans() const { return replans_; }
+
+private:
+	struct Pass
+	{
+		int pixels;
+		int minInterval, maxInterval;
+		float salience;
+		int interval, phase;
+		bool active;
+	};
+
+	// Every interval divides this many frames, over which the load is
+	// balanced.
+	static const int CYCLE = 12;
+
+	std::vector<Pass> passes;
+	double budgetPixels;
+	int replans_;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "WallTargets.h"
+#include "TextureCache.h"
+
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+
+namespace {
+	GLuint createLayers(GLenum internalFormat, GLenum format, GLenum type, int width, int height, int layers)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, layers, 0, format, type, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return texture;
+	}
+}
+
+bool WallTargets::layeredSupported()
+{
+	return glfwExtensionSupported("GL_ARB_shader_viewport_layer_array")
+		|| glfwExtensionSupported("GL_AMD_vertex_shader_layer");
+}
+
+WallTargets::WallTargets(int width, int height, int walls)
+	: width(width), height(height), walls_(walls), layeredFramebuffer(0), layerFramebuffer(0), color(0), depth(0)
+{
+	// sRGB storage keeps dark gradients from banding, since the scene is
+	// rendered in linear.
+	color = createLayers(GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height, layers());
+	depth = createLayers(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, width, height, layers());
+
+	// Rewritten every frame, so counted against the budget but never evicted.
+	size_t bytes = (size_t)width * height * 4 * layers();
+	TextureCache::instance().adoptTexture(color, GL_TEXTURE_2D_ARRAY, bytes, true);
+	TextureCache::instance().adoptTexture(depth, GL_TEXTURE_2D_ARRAY, bytes, true);
+
+	glGenFramebuffers(1, &layeredFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layeredFramebuffer);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "WallTargets: the layered framebuffer is incomplete" << std::endl;
+	}
+	glGenFramebuffers(1, &layerFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+WallTargets::~WallTargets()
+{
+	glDeleteFramebuffers(1, &layerFramebuffer);
+	glDeleteFramebuffers(1, &layeredFramebuffer);
+	TextureCache::instance().releaseTexture(depth);
+	TextureCache::instance().releaseTexture(color);
+}
+
+void WallTargets::bindLayered() const
+{
+	TextureCache::instance().touch(color);
+	TextureCache::instance().touch(depth);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layeredFramebuffer);
+	glViewport(0, 0, width, height);
+}
+
+void WallTargets::bindLayer(int layer) const
+{
+	TextureCache::instance().touch(color);
+	TextureCache::instance().touch(depth);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layerFramebuffer);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color, 0, layer);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0, layer);
+	glViewport(0, 0, width, height);
+}
@@ -0,0 +1,42 @@
+#ifndef _WALL_TARGETS_H_
+#define _WALL_TARGETS_H_
+
+#include <GL\glew.h>
+
+// What the CAVE walls show, rendered into one 2D texture array with a
+// layer per wall and eye (see layer()), plus a matching depth array.
+// Where the vertex shader can pick the layer, every layer is drawn by one
+// instanced draw per object (SHADER_LAYERED), so adding walls adds no
+// draw calls; elsewhere the layers are drawn one at a time.
+class WallTargets
+{
+public:
+	static const int EYES = 2;
+
+	// Whether the driver has ARB_shader_viewport_layer_array or
+	// AMD_vertex_shader_layer; the context must be current.
+	static bool layeredSupported();
+	static int layer(int wall, int eye) { return wall * EYES + eye; }
+
+	WallTargets(int width, int height, int walls);
+	~WallTargets();
+
+	// Binds every layer for drawing, with the viewport covering one.
+	void bindLayered() const;
+	// Binds the one layer, for drivers without layered support.
+	void bindLayer(int layer) const;
+	// The colour array, for sampling the walls.
+	GLuint texture() const { return color; }
+	int walls() const { return walls_; }
+	int layers() const { return walls_ * EYES; }
+
+private:
+	WallTargets(const WallTargets &);
+	WallTargets & operator=(const WallTargets &);
+
+	int width, height, walls_;
+	GLuint layeredFramebuffer, layerFramebuffer;
+	GLuint color, depth;
+};
+
+#endif
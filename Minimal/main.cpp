@@ -22,6 +22,7 @@ limitations under the License.
 #include <memory>
 #include <exception>
 #include <algorithm>
+#include <chrono>
 
 #include <Windows.h>
 
@@ -315,8 +316,19 @@ private:
 #include <OVR_CAPI.h>
 #include <OVR_CAPI_GL.h>
 #include "shader.h"
-#include "ScreenQuad.h"
+#include "Cave.h"
+#include "CaveConfig.h"
+#include "CubeVideo.h"
+#include "FileWatcher.h"
+#include "MultiviewTarget.h"
+#include "ProgramCache.h"
+#include "ShaderVariants.h"
 #include "SkyBox.h"
+#include "TextureCache.h"
+#include "TextureUploader.h"
+#include "ViewUniforms.h"
+#include "VirtualTexture.h"
+#include "WallTargets.h"
 
 namespace ovr {
 
@@ -445,10 +457,43 @@ private:
 	bool pressA, pressB = false;
 
 	ovrSizei myEyeL, myEyeR;
-	ScreenQuad * screen;
-    ScreenQuad * screen2;
-	GLuint screenShader, skyShader;
-	SkyBox *custom;
+	std::unique_ptr<ShaderVariants> screenShaders;
+	std::unique_ptr<ShaderVariants> skyShaders;
+	std::unique_ptr<SkyBox> custom;
+
+	// Projection and view per eye, written once a frame and shared by
+	// every draw for that eye.
+	std::unique_ptr<ViewUniforms> viewUniforms;
+
+	// Texture streaming; at most this many bytes are uploaded per frame.
+	std::unique_ptr<TextureUploader> uploader;
+	size_t uploadBudget{ 8 * 1024 * 1024 };
+
+	// Texture memory kept resident; past it the least recently drawn
+	// textures are evicted and reloaded when next drawn.
+	size_t textureBudget{ 512 * 1024 * 1024 };
+
+	// Edited face and shader files are picked up without restarting.
+	FileWatcher watcher;
+
+	// Played on the custom box in place of its faces when present.
+	std::unique_ptr<CubeVideo> video;
+
+	// How the eyes are drawn into the swap chain: one pass each, or both
+	// in one pass with instancing or GL_OVR_multiview. V cycles through
+	// the ones this machine supports, to compare them.
+	enum StereoMode { STEREO_PER_EYE, STEREO_INSTANCED, STEREO_MULTIVIEW, STEREO_MODES };
+	StereoMode stereoMode{ STEREO_PER_EYE };
+	// Both eyes' layers when drawing with multiview.
+	std::unique_ptr<MultiviewTarget> multiview;
+
+	// The walls, described by cave.txt. Their views follow the eyes' in
+	// ViewUniforms, from slot WALL_SLOTS on.
+	static const int WALL_SLOTS = 2;
+	std::unique_ptr<Cave> cave;
+	// Each eye's wall views for paging in virtual textures, kept to reuse
+	// their storage.
+	std::vector<VirtualTextureView> wallViews[2];
 
 public:
 
@@ -544,11 +589,59 @@ protected:
 			FAIL("Could not create mirror texture");
 		}
 		glGenFramebuffers(1, &_mirrorFbo);
-		screenShader = LoadShaders("../Minimal/screenShader.vert", "../Minimal/screenShader.frag");
-		skyShader = LoadShaders("../Minimal/shader.vert", "../Minimal/shader.frag");
-		screen = new ScreenQuad(0);
-		screen2 = new ScreenQuad(0);
-		custom = new SkyBox(3);
+		// Every way the shaders are drawn, built together up front (or read
+		// from the binary cache) so none compiles mid-session.
+		std::vector<unsigned> viewModes = { 0, SHADER_STEREO_INSTANCED };
+		if (MultiviewTarget::supported()) {
+			viewModes.push_back(SHADER_MULTIVIEW);
+		}
+		screenShaders.reset(new ShaderVariants("../Minimal/screenShader.vert", "../Minimal/screenShader.frag"));
+		skyShaders.reset(new ShaderVariants("../Minimal/shader.vert", "../Minimal/shader.frag"));
+		if (!screenShaders->preload(viewModes)
+			|| !skyShaders->preload(ShaderVariants::combinations(viewModes, SHADER_SRGB_DECODE | SHADER_MIP_BIAS))) {
+			FAIL("Could not load the shaders");
+		}
+		ProgramCache::instance().watch(watcher);
+		CaveConfig caveConfig;
+		if (!caveConfig.load("../Minimal/cave.txt")) {
+			FAIL("Could not load the CAVE description");
+		}
+		cave.reset(new Cave(caveConfig));
+		cave->report(std::cout);
+		viewUniforms.reset(new ViewUniforms(WALL_SLOTS + cave->slots()));
+		const ovrRecti & leftViewport = _sceneLayer.Viewport[ovrEye_Left];
+		if (MultiviewTarget::supported()) {
+			multiview.reset(new MultiviewTarget(leftViewport.Size.w, leftViewport.Size.h));
+		}
+		// Instancing needs no copy afterwards, so it is preferred.
+		stereoMode = stereoSupported(STEREO_INSTANCED) ? STEREO_INSTANCED
+			: stereoSupported(STEREO_MULTIVIEW) ? STEREO_MULTIVIEW : STEREO_PER_EYE;
+		std::cout << "Stereo: " << stereoName(stereoMode) << std::endl;
+		TextureCache::instance().setBudget(textureBudget);
+		uploader.reset(new TextureUploader());
+		custom.reset(new SkyBox(3, uploader.get()));
+		custom->watch(watcher);
+
+		video.reset(new CubeVideo());
+		if (video->open("../Minimal/Textures/video")) {
+			custom->setVideo(video.get());
+		}
+		else {
+			video.reset();
+		}
+	}
+
+	void shutdownGl() override {
+		// The box cancels its uploads, so it has to go before the uploader.
+		custom.reset();
+		video.reset();
+		uploader.reset();
+		cave->report(std::cout);
+		cave.reset();
+		multiview.reset();
+		viewUniforms.reset();
+		ProgramCache::instance().shutdown();
+		GlfwApp::shutdownGl();
 	}
 
 	void onKey(int key, int scancode, int action, int mods) override {
@@ -556,14 +649,60 @@ protected:
 		case GLFW_KEY_R:
 			ovr_RecenterTrackingOrigin(_session);
 			return;
+
+		case GLFW_KEY_LEFT_BRACKET:
+		case GLFW_KEY_RIGHT_BRACKET:
+			custom->setMipBias(custom->getMipBias() + (key == GLFW_KEY_LEFT_BRACKET ? -0.5f : 0.5f));
+			std::cout << "Mip bias " << custom->getMipBias() << std::endl;
+			return;
+
+		case GLFW_KEY_V:
+			do {
+				stereoMode = (StereoMode)((stereoMode + 1) % STEREO_MODES);
+			} while (!stereoSupported(stereoMode));
+			std::cout << "Stereo: " << stereoName(stereoMode) << std::endl;
+			return;
 		}
 
 		GlfwApp::onKey(key, scancode, action, mods);
 	}
 
 	void draw() final override {
+		std::vector<std::string> changed = watcher.changes();
+		if (!changed.empty()) {
+			custom->reloadFaces(changed);
+		}
+		// Also swaps in shaders that finished compiling since last frame.
+		ProgramCache::instance().reloadShaders(changed);
+		uploader->update(uploadBudget);
+		if (video) {
+			// Frames are picked for when this one reaches the display, not
+			// for when it is rendered.
+			video->update(ovr_GetPredictedDisplayTime(_session, frame));
+		}
+
 		ovrPosef eyePoses[2];
 		ovr_GetEyePoses(_session, frame, true, _viewScaleDesc.HmdToEyeOffset, eyePoses, &_sceneLayer.SensorSampleTime);
+		viewUniforms->begin();
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			viewUniforms->set(eye, _eyeProjections[eye], ovr::toGlm(eyePoses[eye]));
+			_sceneLayer.RenderPose[eye] = eyePoses[eye];
+		});
+		// The walls are seen from the headset's eyes, as if it were the
+		// CAVE's tracked glasses.
+		vec3 eyePositions[2] = { ovr::toGlm(eyePoses[ovrEye_Left].Position), ovr::toGlm(eyePoses[ovrEye_Right].Position) };
+		cave->setViews(*viewUniforms, WALL_SLOTS, eyePositions);
+		cave->cull(*viewUniforms, ovrEye_Left);
+		vec3 gaze = -glm::mat3(ovr::toGlm(eyePoses[ovrEye_Left]))[2];
+		cave->schedule(0.5f * (eyePositions[0] + eyePositions[1]), gaze);
+
+		// Virtual textures are only drawn into the walls, so they page in
+		// what the walls' views can see, at the walls' resolution, before
+		// any of it is drawn.
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			cave->residencyViews(eye, wallViews[eye]);
+		});
+		updateResidency(wallViews);
 
 		if (OVR_SUCCESS(ovr_GetInputState(_session, ovrControllerType_Touch, &inputState))) {
 			
@@ -633,33 +772,15 @@ protected:
 
 
 
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screen->FramebufferName);
-		
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screen->renderedTexture, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		ovr::for_each_eye([&](ovrEyeType eye) {
-			const auto& vp = _sceneLayer.Viewport[eye];
-			glViewport(0, 0, 1024, 768);
-			_sceneLayer.RenderPose[eye] = eyePoses[eye];
-
-			if(ovrEye_Left == eye) renderScene(_eyeProjections[eye], ovr::toGlm(eyePoses[eye]), eye, vp, _fbo);
-			
-		});
-		//glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
-		//glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		ovr::for_each_eye([&](ovrEyeType eye) {
-			const auto& vp = _sceneLayer.Viewport[eye];
-			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
-			_sceneLayer.RenderPose[eye] = eyePoses[eye];
-			screen->draw(screenShader, _eyeProjections[eye], glm::inverse(ovr::toGlm(eyePoses[eye])));
-			custom->draw(skyShader, _eyeProjections[eye], glm::inverse(ovr::toGlm(eyePoses[eye])));
-		});
+		// Textures are sampled as sRGB, so shading happens in linear space;
+		// encode again when writing to the sRGB wall and eye targets.
+		glEnable(GL_FRAMEBUFFER_SRGB);
+		cave->render(*viewUniforms, WALL_SLOTS, frame, [&](int layers, int eye) { renderScene(layers, eye); });
+		drawEyes(curTexId);
 		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		// The mirror texture is already encoded; blit it unchanged.
+		glDisable(GL_FRAMEBUFFER_SRGB);
 
 		ovr_CommitTextureSwapChain(_session, _eyeTexture);
 		ovrLayerHeader* headerList = &_sceneLayer.Header;
@@ -671,12 +792,96 @@ protected:
 		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureId, 0);
 		glBlitFramebuffer(0, 0, _mirrorSize.x, _mirrorSize.y, 0, _mirrorSize.y, _mirrorSize.x, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		cave->endFrame(std::cout);
+		TextureCache::instance().endFrame(std::cout);
+	}
+
+	// Whether mode can be used with this driver and eye layout. Both single
+	// pass modes need the eyes the same size; instancing also needs them
+	// side by side from the left edge, since it halves one viewport.
+	bool stereoSupported(StereoMode mode) const {
+		const ovrRecti & left = _sceneLayer.Viewport[ovrEye_Left];
+		const ovrRecti & right = _sceneLayer.Viewport[ovrEye_Right];
+		bool sameSize = left.Size.w == right.Size.w && left.Size.h == right.Size.h;
+		switch (mode) {
+		case STEREO_INSTANCED:
+			return sameSize && left.Pos.x == 0 && left.Pos.y == 0
+				&& right.Pos.x == left.Size.w && right.Pos.y == 0;
+		case STEREO_MULTIVIEW:
+			return sameSize && multiview && multiview->complete();
+		default:
+			return true;
+		}
+	}
+
+	static const char* stereoName(StereoMode mode) {
+		static const char* const names[STEREO_MODES] = { "one pass per eye", "instanced", "multiview" };
+		return names[mode];
 	}
 
-	//TODO Remove the vp and _fbo from the parameters
-	virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, ovrEyeType eye, ovrRecti vp, GLuint _fbo) = 0;
+	// The HMD pass: the walls and the custom box, for both eyes, into the
+	// swap chain texture.
+	void drawEyes(GLuint curTexId) {
+		ovrRecti left = _sceneLayer.Viewport[ovrEye_Left];
+		if (stereoMode == STEREO_MULTIVIEW) {
+			multiview->bind();
+		}
+		else {
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
+		}
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		switch (stereoMode) {
+		case STEREO_INSTANCED:
+			// One viewport over both eyes; the shaders clip each instance
+			// to its half.
+			glViewport(0, 0, left.Size.w * 2, left.Size.h);
+			glEnable(GL_CLIP_DISTANCE0);
+			viewUniforms->bindStereo(ovrEye_Left, ovrEye_Right);
+			cave->draw(*screenShaders, 0, SHADER_STEREO_INSTANCED);
+			custom->draw(*skyShaders, 0, SHADER_STEREO_INSTANCED);
+			glDisable(GL_CLIP_DISTANCE0);
+			break;
+
+		case STEREO_MULTIVIEW: {
+			viewUniforms->bindStereo(ovrEye_Left, ovrEye_Right);
+			cave->draw(*screenShaders, 0, SHADER_MULTIVIEW);
+			custom->draw(*skyShaders, 0, SHADER_MULTIVIEW);
+			GLint viewports[2][4];
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				const ovrRecti & vp = _sceneLayer.Viewport[eye];
+				viewports[eye][0] = vp.Pos.x;
+				viewports[eye][1] = vp.Pos.y;
+				viewports[eye][2] = vp.Size.w;
+				viewports[eye][3] = vp.Size.h;
+			});
+			multiview->resolve(_fbo, curTexId, viewports);
+			break;
+		}
+
+		default:
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				const auto& vp = _sceneLayer.Viewport[eye];
+				glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+				viewUniforms->bind(eye);
+				cave->draw(*screenShaders, eye);
+				custom->draw(*skyShaders, eye);
+			});
+			break;
+		}
+	}
+
+	// Draws eye's scene into the bound wall target: with layers of 1 into
+	// its one layer, with the view bound to ViewUniforms::BINDING, otherwise
+	// into eye's layers of that many at once (see SkyBox::drawLayered and
+	// Cave).
+	virtual void renderScene(int layers, int eye) = 0;
 	virtual void changeScale(int direction) = 0;
 	virtual void moveLittleBox(vec3 direction) = 0;
+	// views holds each eye's wall views, as Cave::residencyViews.
+	virtual void updateResidency(const std::vector<VirtualTextureView> views[2]) = 0;
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -708,21 +913,47 @@ struct Scene {
 	int state = 0;
 	int viewState = 0;
 	mat4 view = mat4(1.0f);
-	SkyBox *littleBox;
-	SkyBox *left;
-	SkyBox *right;
+	std::unique_ptr<SkyBox> littleBox;
+	std::unique_ptr<SkyBox> left;
+	std::unique_ptr<SkyBox> right;
 	
-	GLuint shader;
-	GLuint screenShader;
+	std::unique_ptr<ShaderVariants> shaders;
 	float scaleFactor;
 
+	// Tile memory per eye for virtual texture boxes, and the most uploaded
+	// to each per frame.
+	size_t virtualTextureBytes{ 256 * 1024 * 1024 };
+	size_t tileUploadBudget{ 4 * 1024 * 1024 };
+
 public:
 	Scene() {
-		shader = LoadShaders("../Minimal/shader.vert", "../Minimal/shader.frag");
+		// The walls are drawn a layer at a time, or all together where the
+		// driver allows; the rest were built by RiftApp.
+		std::vector<unsigned> wallModes = { 0 };
+		if (WallTargets::layeredSupported()) {
+			wallModes.push_back(SHADER_LAYERED);
+		}
+		// Virtual texture boxes are never decoded in the shader.
+		std::vector<unsigned> virtualModes;
+		for (unsigned mode : wallModes) {
+			virtualModes.push_back(mode | SHADER_VIRTUAL_TEXTURE);
+		}
+		std::vector<unsigned> featureSets = ShaderVariants::combinations(wallModes, SHADER_SRGB_DECODE | SHADER_MIP_BIAS);
+		std::vector<unsigned> virtualSets = ShaderVariants::combinations(virtualModes, SHADER_MIP_BIAS);
+		featureSets.insert(featureSets.end(), virtualSets.begin(), virtualSets.end());
+		shaders.reset(new ShaderVariants("../Minimal/shader.vert", "../Minimal/shader.frag"));
+		if (!shaders->preload(featureSets)) {
+			FAIL("Could not load the scene shader");
+		}
 		
-		littleBox = new SkyBox(0);
-		left = new SkyBox(1);
-		right = new SkyBox(2);
+		// The boxes decode in parallel on the loader pool; the uploads
+		// happen here as their faces become ready.
+		littleBox.reset(new SkyBox(0));
+		left.reset(new SkyBox(1, nullptr, virtualTextureBytes));
+		right.reset(new SkyBox(2, nullptr, virtualTextureBytes));
+		littleBox->finishLoading();
+		left->finishLoading();
+		right->finishLoading();
 
 
 		scaleFactor = .2f;
@@ -746,15 +977,20 @@ public:
 		littleBox->translate(direction);
 	}
 
-	void render(const mat4 & projection, const mat4 & modelview, ovrEyeType eye, ovrRecti vp, GLuint _fbo) {
-		// Render to our framebuffer
-
-			
-			
+	// Each eye's box only needs the tiles that eye's wall layers show.
+	void updateResidency(const std::vector<VirtualTextureView> views[2]) {
+		left->updateResidency(views[ovrEye_Left].data(), (int)views[ovrEye_Left].size(), tileUploadBudget);
+		right->updateResidency(views[ovrEye_Right].data(), (int)views[ovrEye_Right].size(), tileUploadBudget);
+	}
 
-		if (eye == ovrEye_Left) { left->draw(shader, projection, modelview); }
-		//else { right->draw(shader, projection, modelview); }
-		//littleBox->draw(shader, projection, modelview);
+	// Each eye sees its own box: eye's layers of the bound target when
+	// layers is above 1, else just the bound view.
+	void render(int layers, int eye) {
+		// The views are already bound by the caller.
+		SkyBox & box = eye == ovrEye_Left ? *left : *right;
+		if (layers > 1) { box.drawLayered(*shaders, layers, eye); }
+		else { box.draw(*shaders, eye); }
+		//littleBox->draw(*shaders);
 
 	}
 };
@@ -769,15 +1005,22 @@ public:
 
 protected:
 	void initGl() override {
+		auto start = std::chrono::high_resolution_clock::now();
 		RiftApp::initGl();
 		glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 		glEnable(GL_DEPTH_TEST);
 		ovr_RecenterTrackingOrigin(_session);
 		cubeScene = std::shared_ptr<Scene>(new Scene());
+		TextureCache::instance().report(std::cout);
+		ProgramCache::instance().report(std::cout);
+		std::cout << "Startup: initGl took " << std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
 	}
 
 	void shutdownGl() override {
-		//cubeScene.reset();
+		ProgramCache::instance().report(std::cout);
+		cubeScene.reset();
+		RiftApp::shutdownGl();
 	}
 
 	void changeScale(int direction) {
@@ -788,9 +1031,12 @@ protected:
 		cubeScene->moveLittleBox(direction);
 	}
 
-	void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, ovrEyeType eye, ovrRecti vp, GLuint _fbo) override {
+	void updateResidency(const std::vector<VirtualTextureView> views[2]) override {
+		cubeScene->updateResidency(views);
+	}
 
-		cubeScene->render(projection, glm::inverse(headPose), eye, vp, _fbo);
+	void renderScene(int layers, int eye) override {
+		cubeScene->render(layers, eye);
 	}
 };
 
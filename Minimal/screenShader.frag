@@ -1,8 +1,19 @@
 #version 330 core
-in vec2 Texcoord;
+in vec2 TexCoords;
 out vec4 color;
-uniform sampler2D texFramebuffer;
+// The wall's layers of WallTargets' array, one per eye.
+uniform sampler2DArray texFramebuffer;
+uniform int layer;
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW)
+uniform int rightLayer;
+flat in int Eye;
+#endif
 void main()
 {
-    color = texture(texFramebuffer, Texcoord);
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW)
+    int shown = Eye == 0 ? layer : rightLayer;
+#else
+    int shown = layer;
+#endif
+    color = texture(texFramebuffer, vec3(TexCoords, float(shown)));
 }
\ No newline at end of file
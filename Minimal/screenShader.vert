@@ -1,12 +1,43 @@
 #version 330 core
+#ifdef MULTIVIEW
+#extension GL_OVR_multiview : require
+layout (num_views = 2) in;
+#endif
 layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 texCoord;
 out vec2 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 modelview;
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW)
+// Both eyes in one draw; the right eye's block is bound after the left's.
+layout (std140) uniform View {
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 eyePosition;
+} views[2];
+// Lets the fragment shader pick the eye's layer.
+flat out int Eye;
+#else
+layout (std140) uniform View {
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 eyePosition;
+};
+#endif
+uniform mat4 model;
 
 void main()
 {
-    gl_Position =   projection * modelview * vec4(position, 1.0);  
-    TexCoords = vec2(position);
+    vec4 world = model * vec4(position, 1.0);
+#if defined(STEREO_INSTANCED)
+    // Injected with the define (see InjectShaderDefines).
+    STEREO_INSTANCED_POSITION(views[0].viewProjection, views[1].viewProjection, world);
+#elif defined(MULTIVIEW)
+    gl_Position = (gl_ViewID_OVR == 0u ? views[0].viewProjection : views[1].viewProjection) * world;
+    Eye = int(gl_ViewID_OVR);
+#else
+    gl_Position = viewProjection * world;
+#endif
+    TexCoords = texCoord;
 }
@@ -8,51 +8,93 @@ using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.h"
+#include "ProgramCache.h"
+#include "Resources.h"
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path) {
-
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+	Program* program = ProgramCache::instance().load(vertex_file_path, fragment_file_path);
+	return program != nullptr ? program->id() : 0;
+}
+
+std::string InjectShaderDefines(const std::string & source, unsigned features) {
+	static const char* const names[SHADER_FEATURE_BITS] = { "STEREO_INSTANCED", "MULTIVIEW", "SRGB_DECODE", "MIP_BIAS", "LAYERED",
+		"VIRTUAL_TEXTURE" };
+	// Code every vertex shader with the feature shares, as macros, since
+	// nothing else may come before the shaders' #extension lines.
+	static const char* const snippets[SHADER_FEATURE_BITS] = {
+		// STEREO_INSTANCED_POSITION(left, right, world): even instances are
+		// the left eye, odd the right. The eyes share one viewport spanning
+		// both: each is squeezed into its half and clipped at the middle
+		// (GL_CLIP_DISTANCE0 must be enabled). Sets Eye.
+		"#define STEREO_INSTANCED_POSITION(left, right, world) { "
+			"int eye = gl_InstanceID & 1; "
+			"vec4 clip = (eye == 0 ? (left) : (right)) * (world); "
+			"gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x; "
+			"clip.x = clip.x * 0.5 + (eye == 0 ? -0.5 : 0.5) * clip.w; "
+			"gl_Position = clip; "
+			"Eye = eye; }\n",
+		nullptr, nullptr, nullptr, nullptr, nullptr,
+	};
+	if (features == 0) {
+		return source;
 	}
-	else {
-		printf("Impossible to open %s. Check to make sure the file exists and is in the right directory !\n", vertex_file_path);
-		printf("The current working directory is:");
-#ifdef _WIN32
-		system("CD");
-#else
-		system("pwd");
-#endif
-		getchar();
-		return 0;
+	std::string defines;
+	for (int bit = 0; bit < SHADER_FEATURE_BITS; bit++) {
+		if (features & (1u << bit)) {
+			defines += std::string("#define ") + names[bit] + " 1\n";
+			if (snippets[bit] != nullptr) {
+				defines += snippets[bit];
+			}
+		}
 	}
-
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	// Nothing but comments may come before #version.
+	size_t version = source.find("#version");
+	size_t insert = version == std::string::npos ? 0 : source.find('\n', version);
+	insert = insert == std::string::npos ? source.size() : insert + 1;
+	std::string injected = source.substr(0, insert);
+	if (insert > 0 && injected[insert - 1] != '\n') {
+		injected += '\n';
 	}
+	return injected + defines + source.substr(insert);
+}
+
+bool ReadShaderFile(const char * file_path, std::string & source) {
+	// Embedded shaders come from the executable (see Resources). A missing
+	// file is reported and left to the caller: this also runs while the
+	// headset is showing frames, so it must not wait for input.
+	if (!Resources::read(file_path, source)) {
+		char directory[1024];
+		printf("Impossible to open %s. Check to make sure the file exists and is in the right directory !\n",
+			Resources::diskPath(file_path).c_str());
+		printf("The current working directory is: %s\n", getcwd(directory, sizeof(directory)) != nullptr ? directory : "unknown");
+		return false;
+	}
+	return true;
+}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+GLuint CompileProgram(const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode, bool retrievable) {
+	GLuint ProgramID = BeginProgram(vertex_file_path, VertexShaderCode, fragment_file_path, FragmentShaderCode, retrievable);
+	FinishProgram(ProgramID);
+	return ProgramID;
+}
+
+GLuint BeginProgram(const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode, bool retrievable) {
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
 	// Compile Vertex Shader
 	printf("Compiling shader : %s\n", vertex_file_path);
@@ -60,41 +102,46 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
 	glCompileShader(VertexShaderID);
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
-	}
-
-
-
 	// Compile Fragment Shader
 	printf("Compiling shader : %s\n", fragment_file_path);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
 	glCompileShader(FragmentShaderID);
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
-	}
-
-
-
 	// Link the program
 	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (retrievable) {
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 	glLinkProgram(ProgramID);
 
+	// Only flagged while attached; FinishProgram detaches them.
+	glDeleteShader(VertexShaderID);
+	glDeleteShader(FragmentShaderID);
+
+	return ProgramID;
+}
+
+bool FinishProgram(GLuint ProgramID) {
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Check the shaders
+	GLuint ShaderIDs[2];
+	GLsizei ShaderCount = 0;
+	glGetAttachedShaders(ProgramID, 2, &ShaderCount, ShaderIDs);
+	for (GLsizei i = 0; i < ShaderCount; i++) {
+		glGetShaderiv(ShaderIDs[i], GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if (InfoLogLength > 0) {
+			std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+			glGetShaderInfoLog(ShaderIDs[i], InfoLogLength, NULL, &ShaderErrorMessage[0]);
+			printf("%s\n", &ShaderErrorMessage[0]);
+		}
+	}
+
 	// Check the program
 	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
 	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
@@ -104,12 +151,9 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
+	for (GLsizei i = 0; i < ShaderCount; i++) {
+		glDetachShader(ProgramID, ShaderIDs[i]);
+	}
 
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
-
-	return ProgramID;
+	return Result == GL_TRUE;
 }
\ No newline at end of file
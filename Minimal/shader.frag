@@ -4,7 +4,93 @@ layout (location = 0) out vec3 color;
 
 uniform samplerCube skybox;
 
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW) || defined(LAYERED)
+// Both eyes in one draw; a stereo video binds its right eye here, any
+// other box the same texture as skybox.
+uniform samplerCube skyboxRight;
+flat in int Eye;
+#endif
+
+#ifdef MIP_BIAS
+// Added to the level of detail; negative sharpens, positive softens.
+uniform float mipBias;
+#else
+const float mipBias = 0.0;
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// See VirtualTexture.h. The page table has a mip level per tile level and
+// a layer per face; each texel holds the atlas slot and level of the
+// finest resident tile covering that tile.
+uniform usampler2DArray pageTable;
+uniform sampler2D atlas;
+uniform float vtFaceSize;
+uniform float vtTileSize;
+uniform float vtBorder;
+uniform float vtSlotSize;
+uniform float vtAtlasSize;
+uniform int vtLevels;
+
+vec3 sampleVirtual(vec3 direction)
+{
+    // Face selection as in the cube map table of the GL spec.
+    vec3 d = normalize(direction);
+    vec3 a = abs(d);
+    int face;
+    vec2 st;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = d.x > 0.0 ? 0 : 1;
+        st = vec2(d.x > 0.0 ? -d.z : d.z, -d.y) / a.x;
+    }
+    else if (a.y >= a.z) {
+        face = d.y > 0.0 ? 2 : 3;
+        st = vec2(d.x, d.y > 0.0 ? d.z : -d.z) / a.y;
+    }
+    else {
+        face = d.z > 0.0 ? 4 : 5;
+        st = vec2(d.z > 0.0 ? d.x : -d.x, -d.y) / a.z;
+    }
+
+    // Level from the angle a pixel subtends rather than from face
+    // coordinates, which jump at the cube edges. VirtualTexture::update
+    // makes the same estimate when choosing tiles.
+    float footprint = max(length(dFdx(d)), length(dFdy(d))) * 0.5 * vtFaceSize * sqrt(1.0 + dot(st, st));
+    int level = clamp(int(floor(log2(max(footprint, 1.0)) + mipBias)), 0, vtLevels - 1);
+
+    vec2 uv = st * 0.5 + 0.5;
+    ivec2 tiles = textureSize(pageTable, level).xy;
+    uvec4 entry = texelFetch(pageTable, ivec3(clamp(ivec2(uv * vec2(tiles)), ivec2(0), tiles - 1), face), level);
+
+    // Position inside the resident tile, which may be coarser than asked for.
+    float residentTiles = vtFaceSize / (vtTileSize * exp2(float(entry.z)));
+    vec2 tile = uv * residentTiles;
+    vec2 inTile = tile - min(floor(tile), vec2(residentTiles - 1.0));
+    vec2 texel = vec2(entry.xy) * vtSlotSize + vtBorder + inTile * vtTileSize;
+    return textureLod(atlas, texel / vtAtlasSize, 0.0).rgb;
+}
+#endif
+
+// Faces in formats with no sRGB variant (16-bit) are not decoded by the
+// sampler, so it is done here.
+vec3 decode(vec3 c)
+{
+#ifdef SRGB_DECODE
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), c));
+#else
+    return c;
+#endif
+}
+
 void main()
-{    
-    color = vec3(texture(skybox, TexCoords));
-}
\ No newline at end of file
+{
+#if defined(VIRTUAL_TEXTURE)
+    color = sampleVirtual(TexCoords);
+#else
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW) || defined(LAYERED)
+    vec4 texel = Eye == 0 ? texture(skybox, TexCoords, mipBias) : texture(skyboxRight, TexCoords, mipBias);
+#else
+    vec4 texel = texture(skybox, TexCoords, mipBias);
+#endif
+    color = decode(vec3(texel));
+#endif
+}
@@ -2,6 +2,39 @@
 #define SHADER_HPP
 #include <GL/glew.h>
 
+#include <string>
+
+// Optional parts of a shader, compiled in by defining the macro of the same
+// name (without the prefix). A program is built once per combination used;
+// see ShaderVariants.
+enum ShaderFeature
+{
+	SHADER_STEREO_INSTANCED = 1 << 0,	// both eyes in one instanced draw, side by side
+	SHADER_MULTIVIEW = 1 << 1,			// both eyes in one draw through OVR_multiview
+	SHADER_SRGB_DECODE = 1 << 2,		// the texture holds sRGB values in a linear format
+	SHADER_MIP_BIAS = 1 << 3,			// adds the mipBias uniform to the sampled level
+	SHADER_LAYERED = 1 << 4,			// one instance per layer of the bound array target
+	SHADER_VIRTUAL_TEXTURE = 1 << 5,	// samples a VirtualTexture through its page table
+};
+const int SHADER_FEATURE_BITS = 6;
+
+// source with a #define for each feature in features inserted after its
+// #version line.
+std::string InjectShaderDefines(const std::string & source, unsigned features);
+
+// Programs come from ProgramCache, so loading the same pair twice returns
+// the same program, and a binary saved by an earlier run skips the compile.
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path);
 
+// The uncached pieces ProgramCache is built from.
+bool ReadShaderFile(const char * file_path, std::string & source);
+GLuint CompileProgram(const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode, bool retrievable);
+// CompileProgram in two halves, for drivers that compile in the background:
+// BeginProgram only issues the compile and link, and FinishProgram reports
+// the logs and releases the shaders, returning whether the link succeeded.
+GLuint BeginProgram(const char * vertex_file_path, const std::string & VertexShaderCode,
+	const char * fragment_file_path, const std::string & FragmentShaderCode, bool retrievable);
+bool FinishProgram(GLuint program);
+
 #endif
\ No newline at end of file
@@ -1,12 +1,63 @@
 #version 330 core
+#ifdef MULTIVIEW
+#extension GL_OVR_multiview : require
+layout (num_views = 2) in;
+#endif
+#ifdef LAYERED
+// Either lets the vertex shader pick the layer (see WallTargets).
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+#endif
 layout (location = 0) in vec3 position;
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 modelview;
+#if defined(STEREO_INSTANCED) || defined(MULTIVIEW)
+// Both eyes in one draw; the right eye's block is bound after the left's.
+layout (std140) uniform View {
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 eyePosition;
+} views[2];
+// Lets the fragment shader pick the eye's texture of a stereo video.
+flat out int Eye;
+#elif defined(LAYERED)
+// One instance per layer, wall by wall with the eyes interleaved. Sized
+// as ViewUniforms::MAX_LAYERS.
+layout (std140) uniform Layers {
+    mat4 layerViewProjection[16];
+};
+// Instance i draws layer firstLayer + i * layerStep, so one eye's box can
+// fill only that eye's layers.
+uniform int firstLayer;
+uniform int layerStep;
+flat out int Eye;
+#else
+layout (std140) uniform View {
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 eyePosition;
+};
+#endif
+uniform mat4 model;
 
 void main()
 {
-    gl_Position =   projection * modelview * vec4(position, 1.0);  
+    vec4 world = model * vec4(position, 1.0);
+#if defined(STEREO_INSTANCED)
+    // Injected with the define (see InjectShaderDefines).
+    STEREO_INSTANCED_POSITION(views[0].viewProjection, views[1].viewProjection, world);
+#elif defined(MULTIVIEW)
+    gl_Position = (gl_ViewID_OVR == 0u ? views[0].viewProjection : views[1].viewProjection) * world;
+    Eye = int(gl_ViewID_OVR);
+#elif defined(LAYERED)
+    int layer = firstLayer + gl_InstanceID * layerStep;
+    gl_Position = layerViewProjection[layer] * world;
+    gl_Layer = layer;
+    Eye = layer & 1;
+#else
+    gl_Position = viewProjection * world;
+#endif
     TexCoords = position;
 }